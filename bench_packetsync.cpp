@@ -0,0 +1,370 @@
+﻿/***************************************
+* @file     bench_packetsync.cpp
+* @brief    PacketSync解析性能测试: 不同校验方式、不同帧长下recvdata的吞吐(MB/s与bytes/cycle)
+            以及各种垃圾数据下的解析耗时(应与数据量成线性，bytes/cycle不随帧长变差)
+            VARINT为BasicFramer<VarintLengthHeader, NoChecksum, NoDelimiter>，对照NONE看NetPacket帧头的开销
+            /v2为紧凑的v2帧格式(net_base.h)，与同一校验方式的v1对照看帧头大小对小帧的影响
+            zlib-N为以级别N压缩包数据(packet_compress.h，需NET_WITH_ZLIB)，对照plain看省下的字节与编码、解码的CPU开销
+            AES128GCM/CHACHA20为AEAD加密包数据(packet_aead.h)，对照MD5看编码(含加密)与解码(含解密认证)的吞吐
+* @details  先把帧编码到内存，再按读缓冲区大小(默认64K，与一次uv_read相当)分块喂给recvdata，
+            只测解析与校验，不含网络收发. 请用Release(-O2)编译，否则XXH64/CRC32C的结果没有意义
+* @author   phata, wqvbjhc@gmail.com
+* @date     2026-10-19
+****************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "uv.h"
+#include "net/packet_sync.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_TSC 1
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define BENCH_HAS_TSC 1
+#endif
+
+#define BENCH_STREAM_SIZE (64 * 1024 * 1024)//每种帧长编码的数据量
+#define BENCH_ROUNDS 3
+#define GARBAGE_STREAM_SIZE (16 * 1024 * 1024)//每种垃圾数据的数据量
+
+static uint64_t readtsc()
+{
+#ifdef BENCH_HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct BenchResult {
+    int frames;
+    uint64_t sum;
+};
+
+typedef BasicFramer<VarintLengthHeader, NoChecksum, NoDelimiter> VarintFramer;//varint长度前缀，无包头包尾，不校验
+
+template <class Header>
+static void GetPacket(const Header& packethead, const unsigned char* packetdata, void* userdata)
+{
+    BenchResult* result = (BenchResult*)userdata;
+    ++result->frames;
+    result->sum += packethead.datalen > 0 ? packetdata[packethead.datalen - 1] : 0;
+}
+
+static std::string CheckName(int checktype, int format)
+{
+    static const char* names[] = {"MD5", "CRC32C", "XXH64", "NONE", "AES128GCM", "CHACHA20"};
+    return std::string(names[checktype]) + (NET_PACKAGE_VERSION_V2 == format ? "/v2" : "");
+}
+
+//编码约BENCH_STREAM_SIZE字节、帧长为framesize的帧，*framecount返回帧数. format为v1或v2
+static std::string MakeStream(int framesize, int checktype, int format, int* framecount)
+{
+    std::vector<unsigned char> payload(framesize);
+    for (int i = 0; i < framesize; ++i) {
+        payload[i] = (unsigned char)(i * 31 + 7);
+    }
+    NetPacket packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.header = 0x01;
+    packet.tail = 0x02;
+    packet.version = format;
+    packet.type = 1;
+    packet.datalen = framesize;
+    SetNetPacketCheckType(packet, checktype);
+    std::string frame = PacketData(packet, payload.data());
+    *framecount = (std::max)(1, BENCH_STREAM_SIZE / (int)frame.size());
+    std::string stream;
+    stream.reserve(frame.size() * *framecount);
+    for (int i = 0; i < *framecount; ++i) {
+        stream.append(frame);
+    }
+    return stream;
+}
+
+static const PacketKeyring* bench_keyring = NULL;//AEAD帧解析时用的密钥
+
+//把stream按chunksize分块喂给recvdata，返回最快一轮的时间
+static void StartFramer(PacketSync& packet)
+{
+    packet.Start(0x01, 0x02);
+    packet.SetKeyring(bench_keyring);
+}
+static void StartFramer(VarintFramer&)
+{
+}
+
+template <class Framer>
+static void ParseStream(const std::string& stream, int chunksize, BenchResult* result, uint64_t* ns, uint64_t* cycles)
+{
+    for (int round = 0; round < BENCH_ROUNDS; ++round) {//取最快的一轮
+        result->frames = 0;
+        Framer packet;
+        packet.SetPacketCB(GetPacket<typename Framer::Header>, result);
+        StartFramer(packet);
+        uint64_t starttime = uv_hrtime();
+        uint64_t starttsc = readtsc();
+        for (size_t pos = 0; pos < stream.size(); pos += chunksize) {
+            int len = (int)(std::min)((size_t)chunksize, stream.size() - pos);
+            packet.recvdata((const unsigned char*)stream.data() + pos, len);
+        }
+        uint64_t roundcycles = readtsc() - starttsc;
+        uint64_t roundns = uv_hrtime() - starttime;
+        if (0 == round || roundns < *ns) {
+            *ns = roundns;
+            *cycles = roundcycles;
+        }
+    }
+}
+
+static void RunBench(int framesize, int chunksize, int checktype, int format)
+{
+    int framecount = 0;
+    std::string stream = MakeStream(framesize, checktype, format, &framecount);
+    BenchResult result = {0, 0};
+    uint64_t cycles = 0, ns = 0;
+    ParseStream<PacketSync>(stream, chunksize, &result, &ns, &cycles);
+    fprintf(stdout, "%-9s frame %8d bytes: %7d frames%s, %9.1f MB/s", CheckName(checktype, format).c_str(), framesize, result.frames,
+            result.frames == framecount ? "" : "(LOST)", stream.size() / 1048576.0 / (ns / 1e9));
+    if (cycles > 0) {
+        fprintf(stdout, ", %.3f bytes/cycle", (double)stream.size() / cycles);
+    }
+    fprintf(stdout, "\n");
+}
+
+//同样的帧长，varint格式(BasicFramer的另一个实例)
+static void RunVarintBench(int framesize, int chunksize)
+{
+    std::string frame(VarintLengthHeader::MAX_HEADLEN, 0);
+    frame.resize(VarintLengthHeader::Encode(framesize, (unsigned char*)&frame[0]));
+    for (int i = 0; i < framesize; ++i) {
+        frame.append(1, (char)(i * 31 + 7));
+    }
+    int framecount = (std::max)(1, BENCH_STREAM_SIZE / (int)frame.size());
+    std::string stream;
+    stream.reserve(frame.size() * framecount);
+    for (int i = 0; i < framecount; ++i) {
+        stream.append(frame);
+    }
+    BenchResult result = {0, 0};
+    uint64_t cycles = 0, ns = 0;
+    ParseStream<VarintFramer>(stream, chunksize, &result, &ns, &cycles);
+    fprintf(stdout, "%-9s frame %8d bytes: %7d frames%s, %9.1f MB/s", "VARINT", framesize, result.frames,
+            result.frames == framecount ? "" : "(LOST)", stream.size() / 1048576.0 / (ns / 1e9));
+    if (cycles > 0) {
+        fprintf(stdout, ", %.3f bytes/cycle", (double)stream.size() / cycles);
+    }
+    fprintf(stdout, "\n");
+}
+
+//伪造的帧头: 合法的包头、帧头，包数据长为datalen
+static std::string FakeHead(int datalen)
+{
+    NetPacket packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.header = 0x01;
+    packet.tail = 0x02;
+    packet.datalen = datalen;
+    unsigned char packchar[NET_PACKAGE_HEADLEN];
+    NetPacketToChar(packet, packchar);
+    std::string head(1, (char)packet.header);
+    head.append((const char*)packchar, NET_PACKAGE_HEADLEN);
+    return head;
+}
+
+//垃圾数据: 没有一个合法的帧，解析耗时应与数据量成线性
+static void RunGarbageBench(int garbagetype, int chunksize)
+{
+    static const char* names[] = {"random bytes", "all head bytes", "nested fake heads(64K)", "bad checksum(1K)"};
+    std::string stream;
+    stream.reserve(GARBAGE_STREAM_SIZE + 65536);
+    if (0 == garbagetype) {
+        uint32_t seed = 12345;
+        while (stream.size() < GARBAGE_STREAM_SIZE) {
+            seed = seed * 1103515245 + 12345;
+            stream.append(1, (char)(seed >> 16));
+        }
+    } else if (1 == garbagetype) {//每个字节都是包头
+        stream.assign(GARBAGE_STREAM_SIZE, 0x01);
+    } else if (2 == garbagetype) {//每36字节一个声称64K包数据的帧头，帧互相嵌套且没有包尾
+        std::string head = FakeHead(64 * 1024);
+        while (stream.size() < GARBAGE_STREAM_SIZE) {
+            stream.append(head);
+            stream.append(1, 0x00);
+        }
+    } else {//包尾正确而校验码错误的帧
+        std::string frame = FakeHead(1024);
+        frame.append(1024, 0x01);//包数据全是包头
+        frame.append(1, 0x02);
+        while (stream.size() < GARBAGE_STREAM_SIZE) {
+            stream.append(frame);
+        }
+    }
+    BenchResult result = {0, 0};
+    uint64_t cycles = 0, ns = 0;
+    ParseStream<PacketSync>(stream, chunksize, &result, &ns, &cycles);
+    fprintf(stdout, "garbage %-24s: %7d frames, %9.1f MB/s", names[garbagetype], result.frames, stream.size() / 1048576.0 / (ns / 1e9));
+    if (cycles > 0) {
+        fprintf(stdout, ", %.3f bytes/cycle", (double)stream.size() / cycles);
+    }
+    fprintf(stdout, "\n");
+}
+
+#ifdef NET_WITH_ZLIB
+//类似JSON的包数据，有重复也有变化，压缩率接近实际的业务数据
+static std::string MakeJsonPayload(int framesize)
+{
+    std::string payload;
+    char item[128];
+    for (int i = 0; (int)payload.size() < framesize; ++i) {
+        snprintf(item, sizeof(item), "{\"id\":%d,\"name\":\"user%d\",\"score\":%d,\"online\":%s},", i, i * 7, (i * 7919) % 1000,
+                 i % 3 ? "true" : "false");
+        payload.append(item);
+    }
+    payload.resize(framesize);
+    return payload;
+}
+
+//压缩与不压缩对照: 线上字节数，编码(PacketCompress+PacketData)与解码(recvdata含解压)按原数据计的吞吐
+static void RunCompressBench(int framesize, int chunksize, int level)
+{
+    std::string payload = MakeJsonPayload(framesize);
+    int framecount = (std::max)(1, BENCH_STREAM_SIZE / 4 / framesize);
+    NetPacket packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.header = 0x01;
+    packet.tail = 0x02;
+    packet.version = NET_PACKAGE_VERSION_V2;
+    packet.type = 1;
+    SetNetPacketCheckType(packet, NET_CHECK_CRC32C);
+    std::string stream, zbuf;
+    uint64_t encodens = 0;
+    for (int round = 0; round < BENCH_ROUNDS; ++round) {
+        stream.clear();
+        uint64_t starttime = uv_hrtime();
+        for (int i = 0; i < framecount; ++i) {
+            packet.datalen = framesize;
+            SetNetPacketCompressType(packet, NET_COMPRESS_NONE);
+            const unsigned char* data = (const unsigned char*)payload.data();
+            if (level != 0) {
+                data = PacketCompress(packet, data, 1, level, zbuf);
+            }
+            stream.append(PacketData(packet, data));
+        }
+        uint64_t roundns = uv_hrtime() - starttime;
+        if (0 == round || roundns < encodens) {
+            encodens = roundns;
+        }
+    }
+    BenchResult result = {0, 0};
+    uint64_t cycles = 0, decodens = 0;
+    ParseStream<PacketSync>(stream, chunksize, &result, &decodens, &cycles);
+    double rawmb = (double)framesize * framecount / 1048576.0;
+    char name[16];
+    snprintf(name, sizeof(name), level ? "zlib-%d" : "plain", level);
+    fprintf(stdout, "%-9s frame %8d bytes: %7d frames%s, wire %5.1f%%, encode %8.1f MB/s, decode %8.1f MB/s\n", name, framesize,
+            result.frames, result.frames == framecount ? "" : "(LOST)", 100.0 * stream.size() / (framesize * (double)framecount),
+            rawmb / (encodens / 1e9), rawmb / (decodens / 1e9));
+}
+#endif
+
+//AEAD与MD5对照: 编码(Seal+PacketData)与解码(recvdata含解密认证)按包数据计的吞吐
+static void RunAEADBench(int framesize, int chunksize, int checktype)
+{
+    std::vector<unsigned char> payload(framesize);
+    for (int i = 0; i < framesize; ++i) {
+        payload[i] = (unsigned char)(i * 31 + 7);
+    }
+    PacketKeyring keyring;
+    if (NetCheckIsAEAD(checktype)) {
+        unsigned char key[32];
+        for (int i = 0; i < 32; ++i) {
+            key[i] = (unsigned char)(i * 13 + 1);
+        }
+        if (!keyring.AddKey(1, checktype, key, NET_CHECK_AES128GCM == checktype ? 16 : 32)) {
+            fprintf(stdout, "%-9s not supported by this openssl\n", CheckName(checktype, 0).c_str());
+            return;
+        }
+    }
+    PacketSealer sealer;
+    sealer.SetKeyring(keyring);
+    int framecount = (std::max)(1, BENCH_STREAM_SIZE / 4 / framesize);
+    NetPacket packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.header = 0x01;
+    packet.tail = 0x02;
+    packet.version = NET_PACKAGE_VERSION_V2;
+    packet.type = 1;
+    std::string stream, sbuf;
+    uint64_t encodens = 0;
+    for (int round = 0; round < BENCH_ROUNDS; ++round) {
+        stream.clear();
+        uint64_t starttime = uv_hrtime();
+        for (int i = 0; i < framecount; ++i) {
+            packet.datalen = framesize;
+            SetNetPacketCheckType(packet, checktype);//AEAD由Seal设置
+            stream.append(PacketData(packet, sealer.Seal(packet, payload.data(), sbuf)));
+        }
+        uint64_t roundns = uv_hrtime() - starttime;
+        if (0 == round || roundns < encodens) {
+            encodens = roundns;
+        }
+    }
+    BenchResult result = {0, 0};
+    uint64_t cycles = 0, decodens = 0;
+    bench_keyring = keyring.Empty() ? NULL : &keyring;
+    ParseStream<PacketSync>(stream, chunksize, &result, &decodens, &cycles);
+    bench_keyring = NULL;
+    double rawmb = (double)framesize * framecount / 1048576.0;
+    fprintf(stdout, "%-9s frame %8d bytes: %7d frames%s, wire %5.1f%%, encode %8.1f MB/s, decode %8.1f MB/s\n",
+            CheckName(checktype, 0).c_str(), framesize, result.frames, result.frames == framecount ? "" : "(LOST)",
+            100.0 * stream.size() / (framesize * (double)framecount), rawmb / (encodens / 1e9), rawmb / (decodens / 1e9));
+}
+
+int main(int argc, char** argv)
+{
+    int chunksize = argc > 1 ? atoi(argv[1]) : 64 * 1024;
+    int checktype = argc > 2 ? atoi(argv[2]) : -1;//-1测试所有校验方式
+    if (chunksize <= 0 || (checktype != -1 && !PacketCheck::IsValid(checktype))) {
+        fprintf(stdout, "usage: %s [chunksize] [checktype]\neg.%s 65536 1\n", argv[0], argv[0]);
+        return 0;
+    }
+    fprintf(stdout, "recvdata chunk size %d\n", chunksize);
+    const int framesizes[] = {16, 64, 256, 1024, 4096, 65536, 1024 * 1024};
+    const int formats[] = {NET_PACKAGE_VERSION, NET_PACKAGE_VERSION_V2};
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+        for (int type = NET_CHECK_MD5; type <= NET_CHECK_NONE; ++type) {
+            if (checktype != -1 && checktype != type) {
+                continue;
+            }
+            for (size_t i = 0; i < sizeof(framesizes) / sizeof(framesizes[0]); ++i) {
+                RunBench(framesizes[i], chunksize, type, formats[f]);
+            }
+        }
+    }
+    for (size_t i = 0; i < sizeof(framesizes) / sizeof(framesizes[0]); ++i) {
+        RunVarintBench(framesizes[i], chunksize);
+    }
+    for (int garbagetype = 0; garbagetype < 4; ++garbagetype) {
+        RunGarbageBench(garbagetype, chunksize);
+    }
+    const int aeadsizes[] = {64, 1024, 16384, 1024 * 1024};
+    const int aeadtypes[] = {NET_CHECK_MD5, NET_CHECK_AES128GCM, NET_CHECK_CHACHA20POLY1305};
+    for (size_t i = 0; i < sizeof(aeadsizes) / sizeof(aeadsizes[0]); ++i) {
+        for (size_t t = 0; t < sizeof(aeadtypes) / sizeof(aeadtypes[0]); ++t) {
+            RunAEADBench(aeadsizes[i], chunksize, aeadtypes[t]);
+        }
+    }
+#ifdef NET_WITH_ZLIB
+    const int compresssizes[] = {256, 4096, 65536, 1024 * 1024};
+    const int levels[] = {0, 1, 6};//0为不压缩
+    for (size_t i = 0; i < sizeof(compresssizes) / sizeof(compresssizes[0]); ++i) {
+        for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+            RunCompressBench(compresssizes[i], chunksize, levels[l]);
+        }
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,234 @@
+﻿/***************************************
+* @file     disk_spool.h
+* @brief    磁盘缓存队列: 断线或发送缓冲区满时，把待发送的数据追加到内存映射的分段文件，连接后按顺序取出重发
+* @details  DiskSpool: 多个线程append，一个线程front/pop。记录格式为[uint32_t长度][数据]，记录不跨段。
+            每个段是一个segsize大小的文件，映射后立即删除(Windows用FILE_FLAG_DELETE_ON_CLOSE)，进程退出不留下文件。
+            段写满后新建下一个段，段读完后解除映射，内存由系统页缓存管理，不随缓存的数据量增长
+* @author   phata, wqvbjhc@gmail.com
+* @date     2026-10-19
+****************************************/
+#ifndef DISK_SPOOL_H
+#define DISK_SPOOL_H
+#include <memory.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <deque>
+#include <mutex>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+class DiskSpool
+{
+public:
+    DiskSpool()
+        : m_nSegSize(0), m_nMaxBytes(0), m_nBytes(0), m_nSegSeq(0) {
+    }
+    virtual ~DiskSpool() {
+        close();
+    }
+
+    /************************************************************************/
+    /* 段文件为dir/prefix.序号.spool，segsize为每段大小，maxbytes为缓存上限(0不限制) */
+    /************************************************************************/
+    bool open(const char* dir, const char* prefix, size_t segsize, uint64_t maxbytes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!dir || !prefix || segsize <= sizeof(uint32_t)) {
+            return false;
+        }
+        m_strPath = std::string(dir) + "/" + prefix;
+        m_nSegSize = segsize;
+        m_nMaxBytes = maxbytes;
+        return true;
+    }
+    void close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (!m_segs.empty()) {
+            unmapsegment(m_segs.front());
+            m_segs.pop_front();
+        }
+        m_nBytes = 0;
+    }
+
+    bool empty() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_nBytes == 0;
+    }
+    // 缓存的数据字节数，不含记录头
+    uint64_t size() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_nBytes;
+    }
+
+    /************************************************************************/
+    /* 追加一条记录，成功返回true。超过上限或文件操作失败返回false           */
+    /************************************************************************/
+    bool append(const char* data, size_t len) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        char* record = allocrecord(len);
+        if (!record) {
+            return false;
+        }
+        memcpy(record, data, len);
+        return true;
+    }
+    // 把count段数据(如uv_buf_t，需有base/len成员)拼成一条记录追加，不需要调用者先拼接
+    template <class Span>
+    bool appendv(const Span* spans, int count) {
+        size_t len = 0;
+        for (int i = 0; i < count; ++i) {
+            len += spans[i].len;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        char* record = allocrecord(len);
+        if (!record) {
+            return false;
+        }
+        for (int i = 0; i < count; ++i) {
+            memcpy(record, spans[i].base, spans[i].len);
+            record += spans[i].len;
+        }
+        return true;
+    }
+
+    /************************************************************************/
+    /* 取最早的一条记录，没有时返回false。data在pop之前有效                  */
+    /************************************************************************/
+    bool front(const char** data, size_t* len) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_nBytes == 0) {
+            return false;
+        }
+        const Segment* seg = &m_segs.front();// 读完的段在pop时已释放
+        uint32_t len32;
+        memcpy(&len32, seg->base + seg->readpos, sizeof(len32));
+        *data = seg->base + seg->readpos + sizeof(len32);
+        *len = len32;
+        return true;
+    }
+    // 删除最早的一条记录，所在段读完时释放。只剩正在写的段时从头复用，不反复创建文件
+    void pop() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_nBytes == 0) {
+            return;
+        }
+        Segment& seg = m_segs.front();
+        uint32_t len32;
+        memcpy(&len32, seg.base + seg.readpos, sizeof(len32));
+        seg.readpos += sizeof(len32) + len32;
+        m_nBytes -= len32;
+        if (seg.readpos < seg.writepos) {
+            return;
+        }
+        if (m_segs.size() > 1) {
+            unmapsegment(seg);
+            m_segs.pop_front();
+        } else {
+            seg.readpos = seg.writepos = 0;
+        }
+    }
+
+private:
+    typedef struct _segment {
+        char* base;
+        size_t size;
+        size_t writepos;
+        size_t readpos;
+#if defined(_WIN32)
+        HANDLE file;
+        HANDLE mapping;
+#endif
+    } Segment;
+
+    // 在最后一段分配一条len字节的记录并写入长度，返回数据的位置，失败返回NULL. 调用者持有m_mutex
+    char* allocrecord(size_t len) {
+        if (m_nSegSize == 0 || len == 0 || len > UINT32_MAX || (m_nMaxBytes > 0 && m_nBytes + len > m_nMaxBytes)) {
+            return NULL;
+        }
+        size_t need = sizeof(uint32_t) + len;
+        if (m_segs.empty() || m_segs.back().size - m_segs.back().writepos < need) {
+            Segment seg;
+            if (!mapsegment(seg, need > m_nSegSize ? need : m_nSegSize)) {// 比段大的记录单独一段
+                return NULL;
+            }
+            m_segs.push_back(seg);
+        }
+        Segment& seg = m_segs.back();
+        uint32_t len32 = (uint32_t)len;
+        memcpy(seg.base + seg.writepos, &len32, sizeof(len32));
+        char* record = seg.base + seg.writepos + sizeof(len32);
+        seg.writepos += need;
+        m_nBytes += len;
+        return record;
+    }
+    bool mapsegment(Segment& seg, size_t size) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s.%llu.spool", m_strPath.c_str(), (unsigned long long)m_nSegSeq++);
+        seg.size = size;
+        seg.writepos = 0;
+        seg.readpos = 0;
+#if defined(_WIN32)
+        seg.file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+        if (seg.file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        seg.mapping = CreateFileMappingA(seg.file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+        if (!seg.mapping) {
+            CloseHandle(seg.file);
+            return false;
+        }
+        seg.base = (char*)MapViewOfFile(seg.mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        if (!seg.base) {
+            CloseHandle(seg.mapping);
+            CloseHandle(seg.file);
+            return false;
+        }
+#else
+        int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        unlink(path);// 映射保持文件内容，退出后不留下文件
+        if (ftruncate(fd, size) != 0) {
+            ::close(fd);
+            return false;
+        }
+        void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+        seg.base = (char*)base;
+#endif
+        return true;
+    }
+    void unmapsegment(Segment& seg) {
+#if defined(_WIN32)
+        UnmapViewOfFile(seg.base);
+        CloseHandle(seg.mapping);
+        CloseHandle(seg.file);
+#else
+        munmap(seg.base, seg.size);
+#endif
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::string m_strPath;
+    size_t m_nSegSize;
+    uint64_t m_nMaxBytes;
+    uint64_t m_nBytes;
+    uint64_t m_nSegSeq;
+    std::deque<Segment> m_segs;
+private:// no copy
+    DiskSpool(const DiskSpool&);
+    DiskSpool& operator = (const DiskSpool&);
+};
+
+#endif // DISK_SPOOL_H
@@ -0,0 +1,362 @@
+﻿/***************************************
+* @file     fuzz_packetsync.cpp
+* @brief    BasicFramer(basic_framer.h)的差分测试与随机分块测试
+* @details  参照解析: 整个流在一块内存中，按PacketSync的解析规则从头逐帧解析，不缓存、不分段，逻辑简单可直接核对:
+            帧头不合法从下一字节重新查找；帧头合法而包尾或校验码不合法跳过整帧；超过最大帧长停止；
+            包数据长不小于阈值的帧分段回调(拼接后记一行)，流结束时不完整的帧不回调
+            随机生成的流(混有翻转的字节、截断的帧、垃圾数据、伪造的帧头)按随机大小分块喂给recvdata，
+            回调的帧与返回值须与参照解析完全相同，因而同一个流的各种分块之间也相同. 不损坏的流还须收到生成的每一帧
+            实例: NetPacket格式(v1/v2混合，含type超出v2范围而退回v1的帧，MD5/CRC32C/XXH64/不校验)，varint长度前缀(无包头包尾，不校验)
+            用法: fuzz_packetsync [streams] [seed] >/dev/null. 解析错误信息在stdout，结果在stderr
+            有不一致时打印种子与第一处不同，返回1
+* @author   phata, wqvbjhc@gmail.com
+* @date     2026-10-19
+****************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "uv.h"
+#include "net/packet_sync.h"
+
+#define FUZZ_STREAMS 3000//每项测试的流个数
+#define FUZZ_FRAMES 40//每个流最多的帧数
+
+typedef BasicFramer<NetPacketHeader, NetPacketChecksum, ByteDelimiter> NetPacketFramer;
+typedef BasicFramer<VarintLengthHeader, NoChecksum, NoDelimiter> VarintFramer;
+
+//xorshift伪随机数，同一种子得到同样的流与分块，便于复现
+class FuzzRand
+{
+public:
+    explicit FuzzRand(uint64_t seed): state_(seed * 2654435761ULL + 88172645463325252ULL) {}
+    uint32_t Next() {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 7;
+        state_ ^= state_ << 17;
+        return (uint32_t)(state_ >> 16);
+    }
+    int Range(int lo, int hi) {//[lo, hi]
+        return lo + (int)(Next() % (uint32_t)(hi - lo + 1));
+    }
+    bool Chance(int percent) {
+        return (int)(Next() % 100) < percent;
+    }
+private:
+    uint64_t state_;
+};
+
+struct FuzzConfig {
+    int maxframesize;
+    int streamthreshold;//0为不分段回调
+};
+
+//回调记录: 每帧一行(帧类型、包数据长、包数据的hash)，分段回调的帧拼接各段后记一行
+struct FrameLog {
+    std::vector<std::string> lines;
+    std::string streamdata;//正在分段接收的帧已收到的包数据
+    bool streaming;
+    bool badoffset;//分段的offset与已收到的长度不符
+};
+
+static void AddLine(FrameLog* log, const char* kind, const unsigned char* data, int len)
+{
+    uint64_t hash = 14695981039346656037ULL;//FNV-1a
+    for (int i = 0; i < len; ++i) {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    char line[64];
+    snprintf(line, sizeof(line), "%s len=%d hash=%016llx", kind, len, (unsigned long long)hash);
+    log->lines.push_back(line);
+}
+
+template <class Header>
+static void OnFrame(const Header& head, const unsigned char* data, void* userdata)
+{
+    AddLine((FrameLog*)userdata, "F", data, head.datalen);
+}
+
+template <class Header>
+static void OnChunk(const Header& head, const unsigned char* chunk, int chunklen, int offset, int chunktype, void* userdata)
+{
+    FrameLog* log = (FrameLog*)userdata;
+    if (offset != (int)log->streamdata.size() || offset + chunklen > head.datalen) {
+        log->badoffset = true;
+    }
+    if (PACKET_CHUNK_DATA == chunktype) {
+        log->streaming = true;
+        log->streamdata.append((const char*)chunk, chunklen);
+        return;
+    }
+    AddLine(log, PACKET_CHUNK_END == chunktype ? "S-END" : "S-ERROR", (const unsigned char*)log->streamdata.data(), (int)log->streamdata.size());
+    log->streamdata.clear();
+    log->streaming = false;
+}
+
+/***********************************************参照解析***************************************************/
+template <class HeaderPolicy, class ChecksumPolicy, class DelimiterPolicy>
+static void RefParse(const HeaderPolicy& header_policy, const DelimiterPolicy& delimiter_policy, const FuzzConfig& config,
+                     const std::string& stream, FrameLog* log)
+{
+    typename HeaderPolicy::Header head;
+    const unsigned char* data = (const unsigned char*)stream.data();
+    int len = (int)stream.size();
+    int pos = 0;
+    while (pos < len) {
+        const unsigned char* lead = delimiter_policy.FindLead(data + pos, len - pos);
+        if (!lead) {
+            break;
+        }
+        int headpos = (int)(lead - data);
+        int remainlen = len - headpos;
+        int ret = header_policy.Parse(lead + DelimiterPolicy::LEADLEN, remainlen - DelimiterPolicy::LEADLEN, head);
+        if (0 == ret) {//流结束时帧头不完整
+            break;
+        }
+        if (ret < 0 || !ChecksumPolicy::Accept(head)) {
+            pos = headpos + 1;
+            continue;
+        }
+        int headlen = DelimiterPolicy::LEADLEN + ret;
+        int datalen = HeaderPolicy::DataLen(head);
+        if (datalen > config.maxframesize) {
+            log->lines.push_back("OVERSIZE");
+            return;
+        }
+        int taillen = (DelimiterPolicy::TAILLEN > 0 && HeaderPolicy::HasTail(head)) ? 1 : 0;
+        const unsigned char* packetdata = lead + headlen;
+        bool complete = remainlen >= headlen + datalen + taillen;
+        bool frameok = complete && (0 == taillen || delimiter_policy.CheckTail(packetdata + datalen))
+                       && ChecksumPolicy::Verify(head, packetdata);
+        if (config.streamthreshold > 0 && datalen >= config.streamthreshold) {
+            if (!complete) {//已收到的包数据已分段回调
+                int availlen = (std::min)(datalen, remainlen - headlen);
+                if (availlen > 0) {
+                    AddLine(log, "S-PART", packetdata, availlen);
+                }
+                break;
+            }
+            AddLine(log, frameok ? "S-END" : "S-ERROR", packetdata, datalen);
+        } else if (!complete) {
+            break;
+        } else if (frameok) {
+            AddLine(log, "F", packetdata, datalen);
+        }
+        pos = headpos + headlen + datalen + taillen;
+    }
+}
+
+/***********************************************帧格式***************************************************/
+//NetPacket格式: v1/v2混合，随机校验方式
+struct NetPacketFormat {
+    typedef NetPacketFramer Framer;
+    typedef NetPacketHeader HeaderPolicy;
+    typedef NetPacketChecksum ChecksumPolicy;
+    typedef ByteDelimiter DelimiterPolicy;
+
+    static void Start(Framer& framer) {
+        framer.GetHeaderPolicy().SetMarkers(0x01, 0x02);
+        framer.GetDelimiterPolicy().SetMarkers(0x01, 0x02);
+    }
+    static std::string Encode(FuzzRand& rnd, const std::string& payload) {
+        static const int checktypes[] = {NET_CHECK_MD5, NET_CHECK_CRC32C, NET_CHECK_XXH64, NET_CHECK_NONE};
+        NetPacket packet;
+        memset(&packet, 0, sizeof(packet));
+        packet.header = 0x01;
+        packet.tail = 0x02;
+        packet.version = rnd.Chance(50) ? NET_PACKAGE_VERSION : NET_PACKAGE_VERSION_V2;
+        //少数v2帧的type超出0-65535，编码时退回v1帧
+        packet.type = rnd.Chance(5) ? 0x10000 + rnd.Range(0, 100000) : rnd.Range(0, 1000);
+        packet.reserve = rnd.Chance(30) ? rnd.Range(1, 100000) : 0;
+        packet.datalen = (int)payload.size();
+        SetNetPacketCheckType(packet, checktypes[rnd.Range(0, 3)]);
+        return PacketData(packet, (const unsigned char*)payload.data());
+    }
+    //伪造的v1帧头: 包头、帧头合法，后面没有所声称的包数据
+    static std::string FakeHead(FuzzRand& rnd) {
+        NetPacket packet;
+        memset(&packet, 0, sizeof(packet));
+        packet.header = 0x01;
+        packet.tail = 0x02;
+        packet.datalen = rnd.Range(0, 3 * BUFFER_SIZE);
+        unsigned char packchar[NET_PACKAGE_HEADLEN];
+        NetPacketToChar(packet, packchar);
+        std::string head(1, (char)packet.header);
+        head.append((const char*)packchar, NET_PACKAGE_HEADLEN);
+        return head;
+    }
+};
+
+//varint长度前缀，无包头包尾，不校验
+struct VarintFormat {
+    typedef VarintFramer Framer;
+    typedef VarintLengthHeader HeaderPolicy;
+    typedef NoChecksum ChecksumPolicy;
+    typedef NoDelimiter DelimiterPolicy;
+
+    static void Start(Framer&) {
+    }
+    static std::string Encode(FuzzRand&, const std::string& payload) {
+        std::string frame(VarintLengthHeader::MAX_HEADLEN, 0);
+        frame.resize(VarintLengthHeader::Encode((int32_t)payload.size(), (unsigned char*)&frame[0]));
+        return frame + payload;
+    }
+    static std::string FakeHead(FuzzRand& rnd) {
+        std::string head(VarintLengthHeader::MAX_HEADLEN, 0);
+        head.resize(VarintLengthHeader::Encode(rnd.Range(0, 3 * BUFFER_SIZE), (unsigned char*)&head[0]));
+        return head;
+    }
+};
+
+//生成一个流. corrupt时部分帧被损坏，payloads返回各帧的包数据(不损坏时应原样收到)
+template <class Format>
+static std::string MakeStream(FuzzRand& rnd, bool corrupt, std::vector<std::string>* payloads)
+{
+    std::string stream;
+    int framecount = rnd.Range(1, FUZZ_FRAMES);
+    for (int i = 0; i < framecount; ++i) {
+        //少数大帧跨越多次读取，且超过缓存的初始大小
+        int datalen = rnd.Chance(10) ? rnd.Range(BUFFER_SIZE, 3 * BUFFER_SIZE) : rnd.Range(0, 300);
+        std::string payload(datalen, 0);
+        for (int j = 0; j < datalen; ++j) {
+            payload[j] = rnd.Chance(5) ? 0x01 : (char)rnd.Next();//混入包头字节
+        }
+        payloads->push_back(payload);
+        std::string frame = Format::Encode(rnd, payload);
+        if (corrupt && rnd.Chance(30)) {
+            switch (rnd.Range(0, 4)) {
+            case 0://翻转一个字节
+                frame[rnd.Range(0, (int)frame.size() - 1)] ^= (char)rnd.Range(1, 255);
+                break;
+            case 1://截断
+                frame.resize(rnd.Range(0, (int)frame.size() - 1));
+                break;
+            case 2: {//前面插入垃圾数据
+                std::string garbage(rnd.Range(1, 64), 0);
+                for (size_t j = 0; j < garbage.size(); ++j) {
+                    garbage[j] = rnd.Chance(20) ? 0x01 : (char)rnd.Next();
+                }
+                frame = garbage + frame;
+                break;
+            }
+            case 3://前面插入伪造的帧头
+                frame = Format::FakeHead(rnd) + frame;
+                break;
+            default://损坏最后一个字节(v1为包尾)
+                frame[frame.size() - 1] ^= 0x40;
+                break;
+            }
+        }
+        stream.append(frame);
+    }
+    return stream;
+}
+
+//把stream分块喂给framer，maxchunk为0时整块一次. 分块大小在[1, maxchunk]中随机
+template <class Format>
+static void FramerParse(const FuzzConfig& config, const std::string& stream, FuzzRand& rnd, int maxchunk, FrameLog* log)
+{
+    typedef typename Format::Framer::Header Header;
+    typename Format::Framer framer;
+    Format::Start(framer);
+    framer.SetMaxFrameSize(config.maxframesize);
+    framer.SetPacketCB(OnFrame<Header>, log);
+    if (config.streamthreshold > 0) {
+        framer.SetPacketChunkCB(OnChunk<Header>, log);
+        framer.SetStreamThreshold(config.streamthreshold);
+    }
+    size_t pos = 0;
+    while (pos < stream.size()) {
+        int len = (int)(stream.size() - pos);
+        if (maxchunk > 0) {
+            len = (std::min)(len, rnd.Range(1, maxchunk));
+        }
+        int ret = framer.recvdata((const unsigned char*)stream.data() + pos, len);
+        pos += len;
+        if (PACKET_ERR_OVERSIZE == ret) {//调用者关闭连接，不再解析
+            log->lines.push_back("OVERSIZE");
+            break;
+        }
+    }
+    if (log->streaming) {
+        AddLine(log, "S-PART", (const unsigned char*)log->streamdata.data(), (int)log->streamdata.size());
+    }
+    if (log->badoffset) {
+        log->lines.push_back("BADOFFSET");
+    }
+}
+
+static bool SameLog(const FrameLog& expect, const FrameLog& got, const char* what, uint64_t seed)
+{
+    size_t count = (std::max)(expect.lines.size(), got.lines.size());
+    for (size_t i = 0; i < count; ++i) {
+        const char* e = i < expect.lines.size() ? expect.lines[i].c_str() : "(none)";
+        const char* g = i < got.lines.size() ? got.lines[i].c_str() : "(none)";
+        if (strcmp(e, g) != 0) {
+            fprintf(stderr, "seed %llu %s: line %d expect \"%s\" got \"%s\"\n", (unsigned long long)seed, what, (int)i, e, g);
+            return false;
+        }
+    }
+    return true;
+}
+
+//每个流: 参照解析一次，再按整块、1-8、1-100、1-2*BUFFER_SIZE字节分块各解析一次，与参照比较
+//不损坏且不超过最大帧长的流，参照解析的结果还须与生成的帧一致. 返回不一致的流个数
+template <class Format>
+static int RunFuzz(const char* name, bool corrupt, int streams, uint64_t seed)
+{
+    static const int maxchunks[] = {0, 8, 100, 2 * BUFFER_SIZE};
+    int mismatch = 0;
+    for (int i = 0; i < streams; ++i) {
+        uint64_t streamseed = seed * 1000003 + i;
+        FuzzRand rnd(streamseed);
+        FuzzConfig config;
+        config.maxframesize = rnd.Chance(20) ? rnd.Range(64, 3 * BUFFER_SIZE) : PACKET_MAX_FRAME_SIZE;
+        config.streamthreshold = rnd.Chance(40) ? rnd.Range(1, 2 * BUFFER_SIZE) : 0;
+        std::vector<std::string> payloads;
+        std::string stream = MakeStream<Format>(rnd, corrupt, &payloads);
+
+        FrameLog expect = FrameLog();
+        typename Format::Framer policies;
+        Format::Start(policies);
+        RefParse<typename Format::HeaderPolicy, typename Format::ChecksumPolicy, typename Format::DelimiterPolicy>(
+            policies.GetHeaderPolicy(), policies.GetDelimiterPolicy(), config, stream, &expect);
+        bool ok = true;
+        if (!corrupt && config.maxframesize == PACKET_MAX_FRAME_SIZE) {
+            FrameLog generated = FrameLog();
+            for (size_t j = 0; j < payloads.size(); ++j) {
+                bool isstream = config.streamthreshold > 0 && (int)payloads[j].size() >= config.streamthreshold;
+                AddLine(&generated, isstream ? "S-END" : "F", (const unsigned char*)payloads[j].data(), (int)payloads[j].size());
+            }
+            ok = SameLog(generated, expect, "reference", streamseed);
+        }
+        for (size_t c = 0; ok && c < sizeof(maxchunks) / sizeof(maxchunks[0]); ++c) {
+            FrameLog got = FrameLog();
+            FramerParse<Format>(config, stream, rnd, maxchunks[c], &got);
+            char what[32];
+            snprintf(what, sizeof(what), "maxchunk %d", maxchunks[c]);
+            ok = SameLog(expect, got, what, streamseed);
+        }
+        if (!ok) {
+            ++mismatch;
+        }
+    }
+    fprintf(stderr, "%-24s %6d streams x 4 chunkings: %d mismatch\n", name, streams, mismatch);
+    return mismatch;
+}
+
+int main(int argc, char** argv)
+{
+    int streams = argc > 1 ? atoi(argv[1]) : FUZZ_STREAMS;
+    uint64_t seed = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+    if (streams <= 0) {
+        fprintf(stdout, "usage: %s [streams] [seed]\neg.%s 3000 1\n", argv[0], argv[0]);
+        return 0;
+    }
+    int mismatch = 0;
+    mismatch += RunFuzz<NetPacketFormat>("netpacket clean", false, streams, seed);
+    mismatch += RunFuzz<NetPacketFormat>("netpacket corrupted", true, streams, seed);
+    mismatch += RunFuzz<VarintFormat>("varint clean", false, streams, seed);
+    mismatch += RunFuzz<VarintFormat>("varint corrupted", true, streams, seed);
+    return mismatch > 0 ? 1 : 0;
+}
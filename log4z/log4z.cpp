@@ -44,7 +44,7 @@
 #include <string>
 #include <vector>
 #include <map>
-#include <list>
+#include <atomic>
 #include <sstream>
 #include <iostream>
 #include <fstream>
@@ -125,6 +125,14 @@ public:
 			m_file = NULL;
 		}
 	}
+	//! no stdio buffer, one Write is one write. call it after Open.
+	void SetNoBuffer()
+	{
+		if (m_file)
+		{
+			setvbuf(m_file, NULL, _IONBF, 0);
+		}
+	}
 	void Write(const char * data, size_t len)
 	{
 		if (!m_file)
@@ -196,13 +204,16 @@ static const char *const LOG_STRING[]=
 	"LOG_FATAL",
 };
 
-struct LogData
+//! a log record in the log queue, the content follows the header.
+struct LogRecord
 {
-	LoggerId _id;		//dest logger id
-	int	_level;	//log level
-	time_t _time;		//create time
+	std::atomic<unsigned int> _size; //record size with header and align. 0: not committed.
+	short _id;		//dest logger id
+	short _level;	//log level
 	unsigned int _precise;
-	char _content[LOG4Z_LOG_BUF_SIZE]; //content
+	unsigned int _len; //content length, without '\0'
+	long long _time;		//create time
+	char * Content(){return (char*)(this+1);}
 };
 
 
@@ -221,6 +232,7 @@ struct LoggerInfo
 	time_t _curFileCreateTime;//file create time
 	unsigned int _curFileIndex;
 	unsigned int _curWriteLen;
+	std::string _batch; //formatted logs not written to the file yet.
 	CLog4zFile	_handle; //file handle.
 	LoggerInfo()
 	{
@@ -241,6 +253,7 @@ struct LoggerInfo
 };
 
 static void SleepMillisecond(unsigned int ms);
+static unsigned long long GetTickMillisecond();
 static bool TimeToTm(const time_t & t, tm * tt);
 static bool IsSameDay(time_t t1, time_t t2);
 
@@ -255,6 +268,7 @@ static bool IsDirectory(const char* path);
 static bool CreateRecursionDir(const char* path);
 void GetProcessInfo(std::string &name, std::string &pid);
 static void ShowColorText(const char *text, int level = LOG_LEVEL_DEBUG);
+static void AppendColorText(std::string &out, const char *text, int level);
 
 #ifdef WIN32
 
@@ -407,9 +421,12 @@ public:
 		}
 		else
 		{
+			struct timeval now;
+			gettimeofday(&now, NULL);
+			long long nsec = now.tv_usec*1000LL + (timeout%1000)*1000000LL;
 			timespec ts;
-			ts.tv_sec = time(NULL) + timeout/1000;
-			ts.tv_nsec = (timeout%1000)*1000000;
+			ts.tv_sec = now.tv_sec + timeout/1000 + (time_t)(nsec/1000000000);
+			ts.tv_nsec = (long)(nsec%1000000000);
 			return (sem_timedwait(&m_semid, &ts) == 0);
 		}
 #endif
@@ -518,18 +535,144 @@ void * ThreadProc(void * pParam)
 
 
 
+//! bounded lock-free MPSC queue of variable-length LogRecord.
+//! producers reserve a record by CAS on the write position, fill it and commit it by the _size.
+//! the log thread reads the committed records in order, and zeroes them before freeing.
+//! a record never wraps: the tail of the buffer is skipped by a padding record.
+#define LOG4Z_RECORD_ALIGN 8
+#define LOG4Z_RECORD_PADDING 0x80000000u
+class CLogQueue
+{
+public:
+	explicit CLogQueue(size_t size)
+	{
+		m_size = LOG4Z_RECORD_ALIGN * 512;
+		while (m_size < size)
+		{
+			m_size <<= 1;
+		}
+		m_mask = m_size - 1;
+		m_buf = new char[m_size];
+		memset(m_buf, 0, m_size);
+		m_writePos = 0;
+		m_readPos = 0;
+	}
+	~CLogQueue()
+	{
+		delete []m_buf;
+	}
+	size_t Capacity() const {return m_size;}
+	bool Empty() const {return m_readPos.load(std::memory_order_acquire) == m_writePos.load(std::memory_order_acquire);}
+
+	//! reserve a record for len bytes content. limit is the max bytes of the queue can be used after reserve.
+	//! return NULL if no room.
+	LogRecord * Reserve(size_t len, size_t limit)
+	{
+		size_t need = RecordSize(len);
+		unsigned long long pos = m_writePos.load(std::memory_order_relaxed);
+		size_t offset = 0;
+		size_t total = 0;
+		while (true)
+		{
+			unsigned long long readPos = m_readPos.load(std::memory_order_acquire);
+			if (readPos > pos)
+			{
+				//! pos is stale: the log thread freed the records reserved after it was read. reload, it is not full.
+				pos = m_writePos.load(std::memory_order_relaxed);
+				continue;
+			}
+			offset = (size_t)(pos & m_mask);
+			total = need <= m_size - offset ? need : m_size - offset + need;
+			if (pos - readPos + total > limit)
+			{
+				return NULL;
+			}
+			if (m_writePos.compare_exchange_weak(pos, pos + total, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		if (total != need)
+		{
+			((LogRecord*)(m_buf + offset))->_size.store((unsigned int)(m_size - offset) | LOG4Z_RECORD_PADDING, std::memory_order_release);
+			offset = 0;
+		}
+		LogRecord * pLog = (LogRecord*)(m_buf + offset);
+		pLog->_len = (unsigned int)len;
+		return pLog;
+	}
+	void Commit(LogRecord * pLog)
+	{
+		pLog->_size.store((unsigned int)RecordSize(pLog->_len), std::memory_order_release);
+	}
+
+	//! log thread only. the first committed record, NULL if empty or the first one not committed.
+	LogRecord * Front()
+	{
+		while (true)
+		{
+			unsigned long long pos = m_readPos.load(std::memory_order_relaxed);
+			if (pos == m_writePos.load(std::memory_order_acquire))
+			{
+				return NULL;
+			}
+			LogRecord * pLog = (LogRecord*)(m_buf + (size_t)(pos & m_mask));
+			unsigned int size = pLog->_size.load(std::memory_order_acquire);
+			if (size == 0)
+			{
+				return NULL;
+			}
+			if ((size & LOG4Z_RECORD_PADDING) == 0)
+			{
+				return pLog;
+			}
+			Free(pLog, size & ~LOG4Z_RECORD_PADDING);
+		}
+	}
+	//! log thread only. free the record return by Front.
+	void Pop(LogRecord * pLog)
+	{
+		Free(pLog, pLog->_size.load(std::memory_order_relaxed));
+	}
+private:
+	static size_t RecordSize(size_t len)
+	{
+		return (sizeof(LogRecord) + len + 1 + LOG4Z_RECORD_ALIGN - 1) & ~(size_t)(LOG4Z_RECORD_ALIGN - 1);
+	}
+	void Free(LogRecord * pLog, size_t size)
+	{
+		//! a padding record may be smaller than the header, so only _size is touched through the record.
+		memset((char*)pLog + sizeof(pLog->_size), 0, size - sizeof(pLog->_size));
+		pLog->_size.store(0, std::memory_order_release);//the reserved record must be zero, so the log thread can find it not committed.
+		m_readPos.store(m_readPos.load(std::memory_order_relaxed) + size, std::memory_order_release);
+	}
+	char * m_buf;
+	size_t m_size;
+	size_t m_mask;
+	std::atomic<unsigned long long> m_writePos;
+	char m_pad[64]; //writers and the reader use diffrent cache line
+	std::atomic<unsigned long long> m_readPos;
+private:// no copy
+	CLogQueue(const CLogQueue&);
+	CLogQueue& operator = (const CLogQueue&);
+};
+
 class CLogerManager : public CThread, public ILog4zManager
 {
 public:
-	CLogerManager()
+	CLogerManager():m_queue(LOG4Z_QUEUE_SIZE)
 	{
 		m_bRuning = false;
+		m_bWaiting = false;
+		m_overflowPolicy = LOG4Z_DEFAULT_OVERFLOW;
+		m_flushDelay = LOG4Z_DEFAULT_FLUSH_DELAY;
 		m_lastId = LOG4Z_MAIN_LOGGER_ID;
 		GetProcessInfo(m_loggers[LOG4Z_MAIN_LOGGER_ID]._name, m_loggers[LOG4Z_MAIN_LOGGER_ID]._pid);
 		m_ids[LOG4Z_MAIN_LOGGER_NAME] = LOG4Z_MAIN_LOGGER_ID;
 
 		m_ullStatusTotalPushLog = 0;
 		m_ullStatusTotalPopLog = 0;
+		m_ullStatusTotalDropLog = 0;
 		m_ullStatusTotalWriteFileCount = 0;
 		m_ullStatusTotalWriteFileBytes = 0;
 	}
@@ -638,6 +781,7 @@ public:
 			return false;
 		}
 		m_semaphore.Create(0);
+		m_semWrite.Create(0);
 		bool ret = CThread::Start();
 		return ret && m_semaphore.Wait(3000);
 	}
@@ -646,6 +790,7 @@ public:
 		if (m_bRuning == true)
 		{
 			m_bRuning = false;
+			m_semWrite.Post();
 			Wait();
 			return true;
 		}
@@ -667,59 +812,79 @@ public:
 			return true;
 		}
 
-		LogData * pLog = new LogData;
-		pLog->_id =id;
-		pLog->_level = level;
-
+		time_t now = 0;
+		unsigned int precise = 0;
 		{
 #ifdef WIN32
 			FILETIME ft;
 			GetSystemTimeAsFileTime(&ft);
-			unsigned long long now = ft.dwHighDateTime;
-			now <<= 32;
-			now |= ft.dwLowDateTime;
-			now /=10;
-			now -=11644473600000000ULL;
-			now /=1000;
-			pLog->_time = now/1000;
-			pLog->_precise = (unsigned int)(now%1000);
+			unsigned long long ms = ft.dwHighDateTime;
+			ms <<= 32;
+			ms |= ft.dwLowDateTime;
+			ms /=10;
+			ms -=11644473600000000ULL;
+			ms /=1000;
+			now = ms/1000;
+			precise = (unsigned int)(ms%1000);
 #else
 			struct timeval tm;
 			gettimeofday(&tm, NULL);
-			pLog->_time = tm.tv_sec;
-			pLog->_precise = tm.tv_usec/1000;
+			now = tm.tv_sec;
+			precise = tm.tv_usec/1000;
 #endif
 		}
 
-		if (m_loggers[pLog->_id]._display && LOG4Z_SYNCHRONOUS_DISPLAY)
+		if (m_loggers[id]._display && LOG4Z_SYNCHRONOUS_DISPLAY)
 		{
 			tm tt;
-			if (!TimeToTm(pLog->_time, &tt))
+			if (!TimeToTm(now, &tt))
 			{
 				memset(&tt, 0, sizeof(tt));
 			}
+			char head[64];
 			std::string text;
-			sprintf(pLog->_content, "%d-%02d-%02d %02d:%02d:%02d.%03d %s ",
-				tt.tm_year+1900, tt.tm_mon+1, tt.tm_mday, tt.tm_hour, tt.tm_min, tt.tm_sec, pLog->_precise,
-				LOG_STRING[pLog->_level]);
-			text = pLog->_content;
+			sprintf(head, "%d-%02d-%02d %02d:%02d:%02d.%03d %s ",
+				tt.tm_year+1900, tt.tm_mon+1, tt.tm_mday, tt.tm_hour, tt.tm_min, tt.tm_sec, precise,
+				LOG_STRING[level]);
+			text = head;
 			text += log;
 			text += " \r\n";
-			ShowColorText(text.c_str(), pLog->_level);
+			ShowColorText(text.c_str(), level);
 		}
 
-		int len = (int) strlen(log);
+		size_t len = strlen(log);
 		if (len >= LOG4Z_LOG_BUF_SIZE)
 		{
-			memcpy(pLog->_content, log, LOG4Z_LOG_BUF_SIZE);
-			pLog->_content[LOG4Z_LOG_BUF_SIZE-1] = '\0';
+			len = LOG4Z_LOG_BUF_SIZE - 1;
 		}
-		else
+		size_t limit = m_queue.Capacity();
+		if (m_overflowPolicy == LOG4Z_OVERFLOW_DROP_LOWEST)
+		{
+			limit = limit / 8 * (level - LOG_LEVEL_DEBUG + 3);
+		}
+		LogRecord * pLog = NULL;
+		while ((pLog = m_queue.Reserve(len, limit)) == NULL)
+		{
+			if (m_overflowPolicy != LOG4Z_OVERFLOW_BLOCK || !m_bRuning)
+			{
+				m_ullStatusTotalDropLog ++;
+				return false;
+			}
+			SleepMillisecond(1);
+		}
+		pLog->_id = (short)id;
+		pLog->_level = (short)level;
+		pLog->_time = now;
+		pLog->_precise = precise;
+		memcpy(pLog->Content(), log, len);
+		pLog->Content()[len] = '\0';
+		m_queue.Commit(pLog);
+		//wake the log thread if it is waiting. pairs with the fence in Run.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_bWaiting.load(std::memory_order_relaxed) && m_bWaiting.exchange(false))
 		{
-			memcpy(pLog->_content, log, len+1);
+			m_semWrite.Post();
 		}
-		CAutoLock l(m_lock);
-		m_logs.push_back(pLog);
 		m_ullStatusTotalPushLog ++;
 		return true;
 	}
@@ -767,6 +932,17 @@ public:
 		m_loggers[nLoggerID]._limitsize = limitsize;
 		return true;
 	}
+	bool SetOverflowPolicy(int policy)
+	{
+		if (policy < LOG4Z_OVERFLOW_BLOCK || policy > LOG4Z_OVERFLOW_DROP_LOWEST) return false;
+		m_overflowPolicy = policy;
+		return true;
+	}
+	bool SetFlushDelay(unsigned int ms)
+	{
+		m_flushDelay = ms;
+		return true;
+	}
 	bool UpdateConfig()
 	{
 		if (m_configFile.empty())
@@ -800,6 +976,10 @@ public:
 	{
 		return m_ullStatusTotalPushLog - m_ullStatusTotalPopLog;
 	}
+	unsigned long long GetStatusDropCount()
+	{
+		return m_ullStatusTotalDropLog;
+	}
 	unsigned int GetStatusActiveLoggers()
 	{
 		unsigned int actives = 0;
@@ -850,19 +1030,31 @@ protected:
 			t.tm_hour, t.tm_min, t.tm_sec, pLogger->_curFileIndex);
 		path += buf;
 		pLogger->_handle.Open(path.c_str(), "ab");
+		pLogger->_handle.SetNoBuffer();//logs are written by batch, see WriteBatch
 		return pLogger->_handle.IsOpen();
 	}
 
-	bool PopLog(LogData *& log)
+	bool PopLog(LogRecord *& log)
 	{
-		CAutoLock l(m_lock);
-		if (m_logs.empty())
+		if (log != NULL)
 		{
-			return false;
+			m_queue.Pop(log);
 		}
-		log = m_logs.front();
-		m_logs.pop_front();
-		return true;
+		log = m_queue.Front();
+		return log != NULL;
+	}
+	//! write the formatted logs of one logger to its file by one write.
+	void WriteBatch(LoggerInfo & logger)
+	{
+		if (logger._batch.empty())
+		{
+			return;
+		}
+		if (LOG4Z_WRITE_TO_FILE)
+		{
+			logger._handle.Write(logger._batch.data(), logger._batch.size());
+		}
+		logger._batch.clear();
 	}
 	virtual void Run()
 	{
@@ -886,9 +1078,10 @@ protected:
 		m_semaphore.Post();
 
 
-		LogData * pLog = NULL;
+		LogRecord * pLog = NULL;//the record in use, freed by the next PopLog
 		char *pWriteBuf = new char[LOG4Z_LOG_BUF_SIZE + 512];
-		int needFlush[LOG4Z_LOGGER_MAX] = {0};
+		std::string display; //colored text to the screen, shown once after the queue is drained.
+		unsigned long long firstPending = 0; //tick of the oldest log in the batches, 0: no log in the batches.
 		while (true)
 		{
 			while(PopLog(pLog))
@@ -899,8 +1092,6 @@ protected:
 				LoggerInfo & curLogger = m_loggers[pLog->_id];
 				if (!curLogger._enable || pLog->_level <curLogger._level  )
 				{
-					delete pLog;
-					pLog = NULL;
 					continue;
 				}
 
@@ -913,6 +1104,7 @@ protected:
 						|| !sameday
 						|| needChageFile)
 					{
+						WriteBatch(curLogger);//the batch belongs to the old file
 						if (!sameday)
 						{
 							curLogger._curFileIndex = 0;
@@ -927,8 +1119,6 @@ protected:
 						if (!OpenLogger(pLog->_id))
 						{
 							curLogger._enable = false;
-							delete pLog;
-							pLog = NULL;
 							ShowColorText("log4z: Run can not update file, open file false! \r\n", LOG_LEVEL_FATAL);
 							continue;
 						}
@@ -941,53 +1131,76 @@ protected:
 				{
 					memset(&tt, 0, sizeof(tt));
 				}
-				sprintf(pWriteBuf, "%d-%02d-%02d %02d:%02d:%02d.%03d %s %s \r\n",
+				int writeLen = sprintf(pWriteBuf, "%d-%02d-%02d %02d:%02d:%02d.%03d %s %s \r\n",
 					tt.tm_year+1900, tt.tm_mon+1, tt.tm_mday, tt.tm_hour, tt.tm_min, tt.tm_sec, pLog->_precise,
-					LOG_STRING[pLog->_level], pLog->_content);
+					LOG_STRING[pLog->_level], pLog->Content());
+				if (writeLen < 0)
+				{
+					continue;
+				}
 
-				if (LOG4Z_WRITE_TO_FILE)
+				if (curLogger._batch.size() + writeLen > LOG4Z_WRITE_BATCH)
 				{
-					size_t writeLen = strlen(pWriteBuf);
-					curLogger._handle.Write(pWriteBuf, writeLen);
-					curLogger._curWriteLen += (unsigned int)writeLen;
-					needFlush[pLog->_id] ++;
-					m_ullStatusTotalWriteFileCount++;
-					m_ullStatusTotalWriteFileBytes += writeLen;
+					WriteBatch(curLogger);
 				}
-				else
+				if (curLogger._batch.capacity() < LOG4Z_WRITE_BATCH)
+				{
+					curLogger._batch.reserve(LOG4Z_WRITE_BATCH);
+				}
+				curLogger._batch.append(pWriteBuf, writeLen);
+				if (firstPending == 0)
 				{
-					size_t writeLen = strlen(pWriteBuf);
-					m_ullStatusTotalWriteFileCount++;
-					m_ullStatusTotalWriteFileBytes += writeLen;
+					firstPending = GetTickMillisecond();
 				}
+				curLogger._curWriteLen += (unsigned int)writeLen;
+				m_ullStatusTotalWriteFileCount++;
+				m_ullStatusTotalWriteFileBytes += writeLen;
 
 				if (curLogger._display && !LOG4Z_SYNCHRONOUS_DISPLAY)
 				{
-					ShowColorText(pWriteBuf, pLog->_level);
+					AppendColorText(display, pWriteBuf, pLog->_level);
 				}
+			}
 
-
-
-				delete pLog;
-				pLog = NULL;
+			if (!display.empty())
+			{
+				fwrite(display.data(), 1, display.size(), stdout);
+				fflush(stdout);
+				display.clear();
 			}
 
-			for (int i=0; i<LOG4Z_LOGGER_MAX; i++)
+			//! write the batches when the oldest log waits for the flush delay.
+			unsigned long long waitTime = 0;
+			if (firstPending != 0)
 			{
-				if (m_loggers[i]._enable && needFlush[i] > 0)
+				unsigned long long now = GetTickMillisecond();
+				if (now - firstPending >= m_flushDelay || !m_bRuning)
 				{
-					m_loggers[i]._handle.Flush();
-					needFlush[i] = 0;
+					for (int i=0; i<LOG4Z_LOGGER_MAX; i++)
+					{
+						WriteBatch(m_loggers[i]);
+					}
+					firstPending = 0;
+				}
+				else
+				{
+					waitTime = firstPending + m_flushDelay - now;
 				}
 			}
 
 			//! quit
-			if (!m_bRuning && m_logs.empty())
+			if (!m_bRuning && m_queue.Empty())
 			{
 				break;
 			}
-			//! delay.
-			SleepMillisecond(100);
+			//! wait for new logs, the flush delay or Stop. PushLog posts m_semWrite only when m_bWaiting is set.
+			m_bWaiting.store(true);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (m_bRuning && m_queue.Front() == NULL)
+			{
+				m_semWrite.Wait((int)waitTime);
+			}
+			m_bWaiting.store(false);
 		}
 
 		for (int i=0; i<LOG4Z_LOGGER_MAX; i++)
@@ -1009,6 +1222,11 @@ private:
 	bool		m_bRuning;
 	//! wait thread started.
 	CSem		m_semaphore;
+	//! wake the log thread.
+	CSem		m_semWrite;
+	std::atomic<bool> m_bWaiting;
+	//! max milliseconds a log stay in the batch before written.
+	unsigned int m_flushDelay;
 
 	//! config file name
 	std::string m_configFile;
@@ -1019,8 +1237,8 @@ private:
 	LoggerInfo m_loggers[LOG4Z_LOGGER_MAX];
 
 	//! log queue
-	std::list<LogData *> m_logs;
-	CLock	m_lock;
+	CLogQueue	m_queue;
+	int			m_overflowPolicy;
 
 	//status statistics
 	//write file
@@ -1028,8 +1246,9 @@ private:
 	unsigned long long m_ullStatusTotalWriteFileBytes;
 
 	//Log queue statistics
-	unsigned long long m_ullStatusTotalPushLog;
+	std::atomic<unsigned long long> m_ullStatusTotalPushLog;
 	unsigned long long m_ullStatusTotalPopLog;
+	std::atomic<unsigned long long> m_ullStatusTotalDropLog;
 
 };
 
@@ -1045,6 +1264,17 @@ void SleepMillisecond(unsigned int ms)
 #endif
 }
 
+unsigned long long GetTickMillisecond()
+{
+#ifdef WIN32
+	return ::GetTickCount64();
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000ULL + ts.tv_nsec/1000000;
+#endif
+}
+
 bool TimeToTm(const time_t &t, tm * tt)
 {
 #ifdef WIN32
@@ -1446,6 +1676,24 @@ void ShowColorText(const char *text, int level)
 	return;
 }
 
+//! colored text for the screen, shown later by one write. windows changes the console color per text, so it shows now.
+void AppendColorText(std::string &out, const char *text, int level)
+{
+#ifndef WIN32
+	if (level <= LOG_LEVEL_DEBUG || level > LOG_LEVEL_FATAL)
+	{
+		out += text;
+		return;
+	}
+	out += cs_strColor[level];
+	out += text;
+	out += "\e[0m";
+#else
+	(void)out;
+	ShowColorText(text, level);
+#endif
+}
+
 ILog4zManager* ILog4zManager::m_instance = new CLogerManager;
 ILog4zManager * ILog4zManager::GetInstance()
 {
@@ -136,6 +136,12 @@ zsummer::log4z::ILog4zManager::GetInstance()->PushLog(LOG4Z_MAIN_LOGGER_ID,LOG_L
  *  fix sem_timewait in linux
  *  add format string method at input log
  *
+ * VERSION 2.6 <DATE: 2026.10.19>
+ *  phata: the log queue is a preallocated lock-free ring of variable-length records,
+ *  no new/lock per log. add overflow policy and GetStatusDropCount.
+ *  phata: the log thread is woken by a semaphore instead of polling per 100ms, writes logs by batch
+ *  with a max flush delay(SetFlushDelay), and shows logs to the screen.
+ *
  */
 
 
@@ -187,12 +193,26 @@ typedef int LoggerId;
  //! default logger output file limit size, unit M byte.
 #define LOG4Z_DEFAULT_LIMITSIZE 100
 
-//! synchronous or asynchronous display to the screen
-#define LOG4Z_SYNCHRONOUS_DISPLAY true
+//! synchronous or asynchronous display to the screen.
+//! asynchronous: the log thread shows logs, the caller threads don't wait for the screen.
+#define LOG4Z_SYNCHRONOUS_DISPLAY false
 
 //! write log to file
 #define LOG4Z_WRITE_TO_FILE true
 
+//! log queue size in bytes, preallocated. must be a power of 2.
+#define LOG4Z_QUEUE_SIZE (2*1024*1024)
+
+//! default overflow policy when the log queue is full
+#define LOG4Z_DEFAULT_OVERFLOW LOG4Z_OVERFLOW_BLOCK
+
+//! the log thread formats logs to a batch per logger, and writes the batch to file by one write.
+//! max size of a batch in bytes.
+#define LOG4Z_WRITE_BATCH (256*1024)
+
+//! default max delay in millisecond from a log formatted to it written to file. 0: write as soon as the queue is empty.
+#define LOG4Z_DEFAULT_FLUSH_DELAY 100
+
 
 //! LOG Level
 enum ENUM_LOG_LEVEL
@@ -205,6 +225,14 @@ enum ENUM_LOG_LEVEL
 	LOG_LEVEL_FATAL,
 };
 
+//! overflow policy when the log queue is full
+enum ENUM_LOG4Z_OVERFLOW
+{
+	LOG4Z_OVERFLOW_BLOCK = 0, //wait for the log thread, no log lost.
+	LOG4Z_OVERFLOW_DROP, //drop the new log and count it.
+	LOG4Z_OVERFLOW_DROP_LOWEST, //lower level can only use a part of the queue: DEBUG 3/8, INFO 4/8 ... FATAL all. so the lowest level is dropped first.
+};
+
 
 #ifndef _ZSUMMER_BEGIN
 #define _ZSUMMER_BEGIN namespace zsummer {
@@ -258,6 +286,10 @@ public:
 	virtual bool SetLoggerPath(LoggerId nLoggerID, const char* path) = 0;
 	virtual bool SetLoggerMonthdir(LoggerId nLoggerID, bool use) = 0;
 	virtual bool SetLoggerLimitSize(LoggerId nLoggerID, unsigned int limitsize) = 0;
+	//! set overflow policy of the log queue(ENUM_LOG4Z_OVERFLOW), thread safe.
+	virtual bool SetOverflowPolicy(int policy) = 0;
+	//! set max delay in millisecond of logs written to file, thread safe.
+	virtual bool SetFlushDelay(unsigned int ms) = 0;
 	//! update logger's attribute from config file, thread safe.
 	virtual bool UpdateConfig() = 0;
 
@@ -266,6 +298,8 @@ public:
 	virtual unsigned long long GetStatusTotalWriteBytes() = 0;
 	virtual unsigned long long GetStatusWaitingCount() = 0;
 	virtual unsigned int GetStatusActiveLoggers() = 0;
+	//! the count of logs dropped because the log queue is full.
+	virtual unsigned long long GetStatusDropCount() = 0;
 
 private:
 	static ILog4zManager* m_instance;
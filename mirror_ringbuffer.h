@@ -0,0 +1,111 @@
+﻿/***************************************
+* @file     mirror_ringbuffer.h
+* @brief    环形缓冲区用的虚拟内存镜像: 同一段物理内存(memfd)连续映射两次，回绕的区域也是连续的
+* @details  MirrorMemory: 申请/释放镜像内存，base[i]与base[i+size]是同一字节。仅Linux支持，其他平台返回NULL
+            每块镜像内存占2个VMA(memfd映射后即关闭)，同时存在的块数不超过MIRROR_MEMORY_MAX_COUNT，
+            超出时alloc返回NULL，调用者退化为普通缓冲区，避免大量连接时超过vm.max_map_count
+* @author   phata, wqvbjhc@gmail.com
+* @date     2026-10-19
+****************************************/
+#ifndef MIRROR_RING_BUFFER_H
+#define MIRROR_RING_BUFFER_H
+#include <assert.h>
+#include <memory.h>
+#include <stdint.h>
+#include <stdlib.h>
+#if defined(__linux__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#include <atomic>
+
+#ifndef MIRROR_MEMORY_MAX_COUNT
+#define MIRROR_MEMORY_MAX_COUNT 256
+#endif
+
+class MirrorMemory
+{
+public:
+    /************************************************************************/
+    /* 镜像内存的大小必须是页大小的整数倍，把size向上取到2的幂且不小于页大小  */
+    /************************************************************************/
+    static size_t roundsize(size_t size) {
+        size_t pagesize = 4096;
+#if defined(__linux__)
+        long syspagesize = sysconf(_SC_PAGESIZE);
+        if (syspagesize > 0) {
+            pagesize = (size_t)syspagesize;
+        }
+#endif
+        size_t ret = 1;
+        while (ret < size || ret < pagesize) {
+            ret <<= 1;
+        }
+        return ret;
+    }
+
+    /************************************************************************/
+    /* 申请2*size的虚拟地址，前后两半映射到同一段size大小的内存              */
+    /* size须由roundsize得到，失败、平台不支持或超过块数上限返回NULL        */
+    /************************************************************************/
+    static char* alloc(size_t size) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+        if (++count() > MIRROR_MEMORY_MAX_COUNT) {
+            --count();
+            return NULL;
+        }
+        int fd = (int)syscall(SYS_memfd_create, "mirror_ringbuffer", 1/*MFD_CLOEXEC*/);
+        if (fd < 0) {
+            --count();
+            return NULL;
+        }
+        if (ftruncate(fd, size) != 0) {
+            close(fd);
+            --count();
+            return NULL;
+        }
+        // 先占用2*size的地址空间，再把memfd映射到前后两半
+        char* base = (char*)mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            close(fd);
+            --count();
+            return NULL;
+        }
+        if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+                || mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap(base, 2 * size);
+            close(fd);
+            --count();
+            return NULL;
+        }
+        close(fd);// 映射会保持memfd的内存
+        return base;
+#else
+        (void)size;
+        return NULL;
+#endif
+    }
+
+    static void dealloc(char* base, size_t size) {
+#if defined(__linux__)
+        if (base) {
+            munmap(base, 2 * size);
+            --count();
+        }
+#else
+        (void)base;
+        (void)size;
+#endif
+    }
+
+private:
+    // 当前存在的镜像内存块数
+    static std::atomic<int>& count() {
+        static std::atomic<int> s_count(0);
+        return s_count;
+    }
+};
+
+#endif // MIRROR_RING_BUFFER_H
@@ -0,0 +1,237 @@
+﻿/***************************************
+* @file     mpsc_ringbuffer.h
+* @brief    无锁多生产者单消费者(MPSC)字节环形缓冲区，用于替代TCPClient发送路径上的mutex+PodCircularBuffer
+* @details  容量取2的幂，读写位置为单调递增的64位流偏移(不回绕)，下标用掩码计算。
+            生产者: CAS预留一段空间 -> 拷贝数据 -> 按预留顺序提交(等待前面的生产者提交完成)
+            消费者: 只读取已提交的数据，读完后推进读位置释放空间
+            唤醒合并: 生产者提交后仅在wakeup标志由false变为true时才需要通知消费者，
+            消费者发现缓冲区为空或停止读取(如未连接、写失败)时清除标志(见clearwakeup)
+            构造时mirror为true且支持时使用镜像内存(见mirror_ringbuffer.h)，回绕的数据也是连续的，读写只需一次memcpy，peek只返回一段。
+            镜像内存块数有上限，超出时使用普通缓冲区
+            writev聚集写入多段数据(如帧头、用户数据、包尾)，只预留提交一次，调用者不必先把它们拼成一段
+* @author   phata, wqvbjhc@gmail.com
+* @date     2026-10-19
+****************************************/
+#ifndef MPSC_RING_BUFFER_H
+#define MPSC_RING_BUFFER_H
+#include <assert.h>
+#include <memory.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "mirror_ringbuffer.h"
+
+class MpscRingBuffer
+{
+public:
+    explicit MpscRingBuffer(size_t capacity, bool mirror = false)
+        : m_nReservePos(0), m_nCommitPos(0), m_nReadPos(0), m_bWakeup(false) {
+        m_nBufSize = MirrorMemory::roundsize(capacity);
+        m_nMask = m_nBufSize - 1;
+        m_pBuf = mirror ? MirrorMemory::alloc(m_nBufSize) : NULL;
+        m_bMirrored = (m_pBuf != NULL);
+        if (!m_bMirrored) {
+            m_pBuf = new char[m_nBufSize];
+        }
+    }
+    virtual ~MpscRingBuffer() {
+        if (m_bMirrored) {
+            MirrorMemory::dealloc(m_pBuf, m_nBufSize);
+        } else {
+            delete[] m_pBuf;
+        }
+    }
+
+    bool mirrored() const {
+        return m_bMirrored;
+    }
+
+    size_t capacity() const {
+        return m_nBufSize;
+    }
+    /************************************************************************/
+    /* 已提交未读取的数据长度(消费者调用才准确)                             */
+    /************************************************************************/
+    size_t size() const {
+        return (size_t)(m_nCommitPos.load() - m_nReadPos.load(std::memory_order_relaxed));
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+    /************************************************************************/
+    /* 剩余可写入的空间(生产者预留的空间不可写)                             */
+    /************************************************************************/
+    size_t freesize() const {
+        return m_nBufSize - (size_t)(m_nReservePos.load() - m_nReadPos.load());
+    }
+
+    /************************************************************************/
+    /* 生产者写入数据，任意线程可调用，返回实际写入的字节数                 */
+    /* allornothing为true时空间不足则一个字节也不写(保证整帧连续)           */
+    /* startpos返回写入数据在流中的起始偏移，needwakeup返回是否需要通知消费者*/
+    /************************************************************************/
+    size_t write(const char* buf, size_t count, bool allornothing, uint64_t* startpos = NULL, bool* needwakeup = NULL) {
+        if (needwakeup) {
+            *needwakeup = false;
+        }
+        uint64_t start = 0;
+        size_t len = reserve(count, allornothing, &start);
+        if (len == 0) {
+            return 0;
+        }
+        copyin(start, buf, len);
+        commit(start, len, startpos, needwakeup);
+        return len;
+    }
+
+    /************************************************************************/
+    /* 聚集写入: 把count段数据(如uv_buf_t，需有base/len成员)依次写入，     */
+    /* 从各段拼接后的第offset字节开始，只预留提交一次，各段直接拷入缓冲区   */
+    /* 返回值与其他参数同write                                              */
+    /************************************************************************/
+    template <class Span>
+    size_t writev(const Span* spans, int count, size_t offset, bool allornothing, uint64_t* startpos = NULL, bool* needwakeup = NULL) {
+        size_t total = 0;
+        for (int i = 0; i < count; ++i) {
+            total += spans[i].len;
+        }
+        if (needwakeup) {
+            *needwakeup = false;
+        }
+        uint64_t start = 0;
+        size_t len = reserve(total > offset ? total - offset : 0, allornothing, &start);
+        if (len == 0) {
+            return 0;
+        }
+        size_t copied = 0;
+        for (int i = 0; i < count && copied < len; ++i) {
+            size_t spanlen = spans[i].len;
+            if (offset >= spanlen) {
+                offset -= spanlen;
+                continue;
+            }
+            size_t n = spanlen - offset < len - copied ? spanlen - offset : len - copied;
+            copyin(start + copied, spans[i].base + offset, n);
+            copied += n;
+            offset = 0;
+        }
+        commit(start, len, startpos, needwakeup);
+        return len;
+    }
+
+    /************************************************************************/
+    /* 消费者读取数据，只能在一个线程调用，返回实际读取的字节数             */
+    /************************************************************************/
+    size_t read(char* buf, size_t count) {
+        uint64_t readpos = m_nReadPos.load(std::memory_order_relaxed);
+        size_t datalen = (size_t)(m_nCommitPos.load() - readpos);
+        size_t len = count < datalen ? count : datalen;
+        if (len == 0) {
+            return 0;
+        }
+        size_t pos = (size_t)(readpos & m_nMask);
+        size_t leftcount = m_nBufSize - pos;
+        if (m_bMirrored || leftcount >= len) {
+            memcpy(buf, &m_pBuf[pos], len);
+        } else {// 回绕到缓冲区头
+            memcpy(buf, &m_pBuf[pos], leftcount);
+            memcpy(&buf[leftcount], m_pBuf, len - leftcount);
+        }
+        m_nReadPos.store(readpos + len);// 与等待空间的生产者配对，不能只用release
+        return len;
+    }
+
+    /************************************************************************/
+    /* 消费者不拷贝地获取从读位置偏移offset处开始的已提交数据               */
+    /* 最多两段连续内存(回绕时第二段从缓冲区头开始)，返回两段的总长度       */
+    /* 数据在release之前一直有效，offset用于跳过已peek但还未release的数据   */
+    /************************************************************************/
+    size_t peek(size_t offset, const char** span1, size_t* len1, const char** span2, size_t* len2) const {
+        uint64_t readpos = m_nReadPos.load(std::memory_order_relaxed) + offset;
+        size_t datalen = (size_t)(m_nCommitPos.load() - readpos);
+        *span2 = NULL;
+        *len2 = 0;
+        size_t pos = (size_t)(readpos & m_nMask);
+        *span1 = &m_pBuf[pos];
+        *len1 = datalen;
+        if (!m_bMirrored && m_nBufSize - pos < datalen) {// 回绕到缓冲区头
+            *len1 = m_nBufSize - pos;
+            *span2 = m_pBuf;
+            *len2 = datalen - *len1;
+        }
+        return datalen;
+    }
+
+    /************************************************************************/
+    /* 消费者释放peek得到的数据(从读位置开始)，空间可再被生产者写入         */
+    /************************************************************************/
+    void release(size_t count) {
+        assert(count <= size());
+        m_nReadPos.store(m_nReadPos.load(std::memory_order_relaxed) + count);// 与等待空间的生产者配对，不能只用release
+    }
+
+    /************************************************************************/
+    /* 消费者发现缓冲区为空时调用，之后必须再检查一次empty()，              */
+    /* 否则可能丢失清除标志前提交的数据的通知                               */
+    /* 消费者停止读取而数据还在时也要调用，否则后续写入不再通知消费者       */
+    /************************************************************************/
+    void clearwakeup() {
+        m_bWakeup.store(false);
+    }
+
+private:
+    // CAS预留count字节(allornothing为false时最多预留剩余空间)，返回预留的长度，缓冲区已满返回0
+    size_t reserve(size_t count, bool allornothing, uint64_t* start) {
+        if (count == 0) {
+            return 0;
+        }
+        uint64_t pos = m_nReservePos.load(std::memory_order_relaxed);
+        size_t len = 0;
+        do {
+            size_t freelen = m_nBufSize - (size_t)(pos - m_nReadPos.load(std::memory_order_acquire));
+            len = count <= freelen ? count : (allornothing ? 0 : freelen);
+            if (len == 0) {// 缓冲区已满
+                return 0;
+            }
+        } while (!m_nReservePos.compare_exchange_weak(pos, pos + len, std::memory_order_acq_rel, std::memory_order_relaxed));
+        *start = pos;
+        return len;
+    }
+    // 把buf拷贝到流偏移start处(必须在已预留的范围内)
+    void copyin(uint64_t start, const char* buf, size_t len) {
+        size_t pos = (size_t)(start & m_nMask);
+        size_t leftcount = m_nBufSize - pos;
+        if (m_bMirrored || leftcount >= len) {
+            memcpy(&m_pBuf[pos], buf, len);
+        } else {// 回绕到缓冲区头
+            memcpy(&m_pBuf[pos], buf, leftcount);
+            memcpy(m_pBuf, &buf[leftcount], len - leftcount);
+        }
+    }
+    // 按预留顺序提交，等待前面预留的生产者拷贝完成
+    void commit(uint64_t start, size_t len, uint64_t* startpos, bool* needwakeup) {
+        while (m_nCommitPos.load(std::memory_order_acquire) != start) {
+            std::this_thread::yield();
+        }
+        m_nCommitPos.store(start + len);
+        if (startpos) {
+            *startpos = start;
+        }
+        if (needwakeup) {
+            *needwakeup = !m_bWakeup.exchange(true);
+        }
+    }
+
+    char* m_pBuf;
+    bool m_bMirrored;
+    size_t m_nBufSize;
+    size_t m_nMask;
+    std::atomic<uint64_t> m_nReservePos;// 生产者预留到的位置
+    std::atomic<uint64_t> m_nCommitPos; // 生产者提交到的位置，消费者可读到此处
+    std::atomic<uint64_t> m_nReadPos;   // 消费者读取到的位置
+    std::atomic<bool> m_bWakeup;        // 已通知消费者且消费者还未清空
+private://Noncopyable
+    MpscRingBuffer(const MpscRingBuffer&);
+    const MpscRingBuffer& operator=(const MpscRingBuffer&);
+};
+#endif // MPSC_RING_BUFFER_H
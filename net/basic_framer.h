@@ -0,0 +1,598 @@
+﻿/***************************************
+* @file     basic_framer.h
+* @brief    通用的分帧解析模板: 接收数据，解析得到一帧后回调给用户. 帧格式由三个策略类在编译期指定
+* @details  BasicFramer<HeaderPolicy, ChecksumPolicy, DelimiterPolicy>
+            帧格式: [包头(0-1字节)][帧头(变长)][包数据(帧头给出长度)][包尾(0-1字节)]
+            HeaderPolicy   : 帧头的解析. 需提供
+                             typedef ... Header;                  回调给用户的帧头类型
+                             enum { MAX_HEADLEN = n };            帧头最大字节数(不含包头)
+                             int Parse(p, len, Header&) const;    返回帧头长度，数据不够返回0，不合法返回-1
+                             static int DataLen(const Header&);   包数据长度(>=0)
+                             static bool HasTail(const Header&);  该帧是否带包尾(同一流中可混有不带包尾的帧格式)
+            ChecksumPolicy : 包数据的校验. 需提供State类型及Accept/Init/Update/Final/Verify，
+                             BATCH_MAX>0时还需BatchLanes/Batchable/VerifyBatch(成批校验，见PacketSync的md5)
+            DelimiterPolicy: 包头包尾. LEADLEN/TAILLEN为0或1; FindLead查找包头，IsLead/CheckTail检查单个字节
+            策略都在编译期确定，解析循环全部内联. 解析规则(原地解码、跨读缓存、分段回调、线性重新同步、限速的
+            错误信息)见PacketSync(packet_sync.h)，它是NetPacket格式的实例
+            本文件另提供通用策略: ByteDelimiter(单字节包头包尾)、NoDelimiter、NoChecksum、VarintLengthHeader
+* @author   phata, wqvbjhc@gmail.com
+* @date     2026-10-19
+****************************************/
+#ifndef BASIC_FRAMER_H
+#define BASIC_FRAMER_H
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include "uv.h"
+
+//recvdata分段回调的chunktype
+//PACKET_CHUNK_DATA时chunk有效；PACKET_CHUNK_END表示整包接收完且校验通过；
+//PACKET_CHUNK_ERROR表示包尾或校验码不合法，之前回调的分段都应丢弃。END与ERROR时chunk为NULL
+typedef enum {
+    PACKET_CHUNK_DATA = 0,
+    PACKET_CHUNK_END,
+    PACKET_CHUNK_ERROR
+} PACKET_CHUNK_TYPE;
+
+//recvdata的返回值
+typedef enum {
+    PACKET_OK = 0,
+    PACKET_ERR_OVERSIZE = -1 //帧长超过最大帧长，调用者应关闭连接
+} PACKET_ERR_TYPE;
+
+#ifndef BUFFER_SIZE
+#define BUFFER_SIZE (1024*10)
+#endif
+
+#ifndef PACKET_DIAG_INTERVAL
+#define PACKET_DIAG_INTERVAL 1000//解析错误信息的限速周期(毫秒)
+#endif
+
+#ifndef PACKET_DIAG_BURST
+#define PACKET_DIAG_BURST 10//每个周期最多输出的解析错误信息条数
+#endif
+
+#ifndef PACKET_MAX_FRAME_SIZE
+#define PACKET_MAX_FRAME_SIZE (1024*1024*16)//默认最大帧长(包数据部分)16M
+#endif
+
+/***********************************************通用策略***************************************************/
+//单字节的包头包尾，由SetMarkers设置
+class ByteDelimiter
+{
+public:
+    enum { LEADLEN = 1, TAILLEN = 1 };
+    ByteDelimiter(): head_(0), tail_(0) {}
+    void SetMarkers(unsigned char head, unsigned char tail) {
+        head_ = head;
+        tail_ = tail;
+    }
+    const unsigned char* FindLead(const unsigned char* data, int len) const {
+        return (const unsigned char*)memchr(data, head_, len);
+    }
+    bool IsLead(unsigned char c) const {
+        return c == head_;
+    }
+    bool CheckTail(const unsigned char* tail) const {
+        return *tail == tail_;
+    }
+private:
+    unsigned char head_;
+    unsigned char tail_;
+};
+
+//没有包头包尾，帧紧挨着帧. 帧头不合法时逐字节重新查找
+class NoDelimiter
+{
+public:
+    enum { LEADLEN = 0, TAILLEN = 0 };
+    const unsigned char* FindLead(const unsigned char* data, int /*len*/) const {
+        return data;
+    }
+    bool IsLead(unsigned char /*c*/) const {
+        return true;
+    }
+    bool CheckTail(const unsigned char* /*tail*/) const {
+        return true;
+    }
+};
+
+//不校验包数据，用于可信链路或由下层(如TLS)保证完整性
+struct NoChecksum {
+    enum { BATCH_MAX = 0 };
+    struct State {};
+    template <class Header>
+    static bool Accept(const Header&) {
+        return true;
+    }
+    template <class Header>
+    static void Init(State&, const Header&) {
+    }
+    static void Update(State&, const unsigned char*, size_t) {
+    }
+    template <class Header>
+    static bool Final(State&, const Header&) {
+        return true;
+    }
+    template <class Header>
+    static bool Verify(const Header&, const unsigned char*) {
+        return true;
+    }
+    static int BatchLanes() {
+        return 0;
+    }
+    template <class Header>
+    static bool Batchable(const Header&) {
+        return false;
+    }
+    template <class Header>
+    static void VerifyBatch(const Header* const*, const unsigned char* const*, bool*, int) {
+    }
+};
+
+//只有包数据长度的帧头: LEB128编码的varint(1-5字节，每字节低7位为数据，最高位为1表示后面还有)
+typedef struct _varint_header {
+    int32_t datalen;
+} VarintHeader;
+
+class VarintLengthHeader
+{
+public:
+    typedef VarintHeader Header;
+    enum { MAX_HEADLEN = 5 };
+    int Parse(const unsigned char* data, int len, VarintHeader& head) const {
+        uint32_t value = 0;
+        for (int i = 0; i < MAX_HEADLEN; ++i) {
+            if (i >= len) {
+                return 0;//数据不够
+            }
+            value |= (uint32_t)(data[i] & 0x7f) << (7 * i);
+            if (!(data[i] & 0x80)) {
+                if (value > 0x7fffffff) {
+                    return -1;
+                }
+                head.datalen = (int32_t)value;
+                return i + 1;
+            }
+        }
+        return -1;//超过5字节
+    }
+    static int DataLen(const VarintHeader& head) {
+        return head.datalen;
+    }
+    static bool HasTail(const VarintHeader&) {
+        return true;
+    }
+    //把datalen编码到buf(至少MAX_HEADLEN字节)，返回编码长度
+    static int Encode(int32_t datalen, unsigned char* buf) {
+        uint32_t value = (uint32_t)datalen;
+        int len = 0;
+        while (value >= 0x80) {
+            buf[len++] = (unsigned char)(value | 0x80);
+            value >>= 7;
+        }
+        buf[len++] = (unsigned char)value;
+        return len;
+    }
+};
+
+/***********************************************分帧模板***************************************************/
+template <class HeaderPolicy, class ChecksumPolicy, class DelimiterPolicy>
+class BasicFramer
+{
+public:
+    typedef typename HeaderPolicy::Header Header;
+    typedef void (*FrameCB)(const Header& head, const unsigned char* data, void* userdata);
+    //大包分段回调.chunk为本段包数据，offset为本段在包数据中的偏移，chunktype见PACKET_CHUNK_TYPE
+    typedef void (*FrameChunkCB)(const Header& head, const unsigned char* chunk, int chunklen, int offset, int chunktype, void* userdata);
+    enum {
+        LEADLEN = DelimiterPolicy::LEADLEN,
+        TAILLEN = DelimiterPolicy::TAILLEN,
+        MAXHEADLEN = DelimiterPolicy::LEADLEN + HeaderPolicy::MAX_HEADLEN,//包头加帧头的最大长度
+        BATCH_MAX = ChecksumPolicy::BATCH_MAX > 0 ? ChecksumPolicy::BATCH_MAX : 1
+    };
+
+    BasicFramer(): packet_cb_(NULL), packetcb_userdata_(NULL)
+        , chunk_cb_(NULL), chunkcb_userdata_(NULL)
+        , max_frame_size_(PACKET_MAX_FRAME_SIZE), stream_threshold_(0), streamoffset_(0)
+        , stageheadlen_(0), stagehashed_(0), batchcount_(0)
+        , diagstart_(0), diagcount_(0), diagsuppressed_(0) {
+        thread_readdata = uv_buf_init((char*)malloc(BUFFER_SIZE), BUFFER_SIZE); //缓存跨读的帧
+        truepacketlen = 0;//readdata有效数据长度
+        parsetype = PARSE_NOTHING;
+        batchlanes_ = (std::min)(ChecksumPolicy::BatchLanes(), (int)ChecksumPolicy::BATCH_MAX);
+    }
+    virtual ~BasicFramer() {
+        free(thread_readdata.base);
+    }
+
+    //最大帧长(包数据部分).超过的帧recvdata返回PACKET_ERR_OVERSIZE，不会为其申请内存
+    void SetMaxFrameSize(int maxsize) {
+        max_frame_size_ = maxsize;
+    }
+    int GetMaxFrameSize() const {
+        return max_frame_size_;
+    }
+
+    //包数据长度>=threshold的帧不再缓存整包，而是边接收边通过FrameChunkCB分段回调。threshold为0关闭
+    void SetStreamThreshold(int threshold) {
+        stream_threshold_ = threshold;
+    }
+
+    void SetPacketCB(FrameCB pfun, void* userdata) {
+        packet_cb_ = pfun;
+        packetcb_userdata_ = userdata;
+    }
+    void SetPacketChunkCB(FrameChunkCB pfun, void* userdata) {
+        chunk_cb_ = pfun;
+        chunkcb_userdata_ = userdata;
+    }
+
+    HeaderPolicy& GetHeaderPolicy() {
+        return header_policy_;
+    }
+    DelimiterPolicy& GetDelimiterPolicy() {
+        return delimiter_policy_;
+    }
+
+public:
+    //返回PACKET_OK或PACKET_ERR_OVERSIZE
+    //完整在data中的帧直接以data内的指针回调，不拷贝；只有跨越两次recvdata的帧才缓存到thread_readdata
+    int recvdata(const unsigned char* data, int len) {
+        int iret = 0;
+        while (iret < len) {
+            if (PARSE_STREAM == parsetype) {//分段接收大包,直接从data回调,不缓存
+                int takelen = (std::min)(HeaderPolicy::DataLen(theNexPacket) - streamoffset_, len - iret);
+                if (takelen > 0) {
+                    streamchunk(data + iret, takelen);
+                    iret += takelen;
+                }
+                if (streamoffset_ < HeaderPolicy::DataLen(theNexPacket) || (taillen() > 0 && iret >= len)) {
+                    return PACKET_OK;//等待下一轮的读取(包数据或包尾)
+                }
+                bool tailok = checktail(data + iret);//没有包尾时包数据收完即结束
+                iret += taillen();
+                streamfinish(tailok);
+                continue;
+            }
+            int ret;
+            if (truepacketlen > 0) {//thread_readdata中有上次未收完的帧，只补齐这一帧
+                ret = fillstage(data, len, &iret);
+            } else {
+                ret = parseinplace(data, len, &iret);
+            }
+            if (ret != PACKET_OK) {
+                return ret;
+            }
+        }
+        return PACKET_OK;
+    }
+
+protected:
+    HeaderPolicy header_policy_;
+    DelimiterPolicy delimiter_policy_;
+    //限速输出解析错误信息: 每PACKET_DIAG_INTERVAL毫秒最多PACKET_DIAG_BURST条，其余只计数
+    void diag(const char* fmt, ...) {
+        if (diagcount_ >= PACKET_DIAG_BURST) {
+            //超出限额后每256条才取一次时间，垃圾数据逐字节出错时也不拖慢解析
+            if ((++diagsuppressed_ & 0xff) != 1 || uv_hrtime() - diagstart_ < (uint64_t)PACKET_DIAG_INTERVAL * 1000000) {
+                return;
+            }
+            fprintf(stdout, "省略了%d条解析错误信息\n", diagsuppressed_ - 1);
+            diagcount_ = 0;
+            diagsuppressed_ = 0;
+        }
+        if (0 == diagcount_) {
+            diagstart_ = uv_hrtime();
+        }
+        ++diagcount_;
+        va_list args;
+        va_start(args, fmt);
+        vfprintf(stdout, fmt, args);
+        va_end(args);
+    }
+
+private:
+    enum {
+        HEAD_OK,
+        HEAD_MORE,//数据不够解析帧头
+        HEAD_INVALID,//帧头不合法，从包头的下一字节重新查找
+        HEAD_OVERSIZE,//超过最大帧长
+        HEAD_STREAM,//分段接收的大包
+    };
+    //解析data+*pos开始的帧，完整的帧直接回调data内的指针. 结尾不完整的帧缓存到thread_readdata
+    //帧头不合法时从下一字节重新查找；帧头合法而包尾或校验码不合法时跳过整帧，每字节最多校验一次，耗时与数据量成线性
+    //可成批校验的帧先放入batch_，在回调其他帧或返回前一起校验(flushbatch)
+    int parseinplace(const unsigned char* data, int len, int* pos) {
+        int iret = *pos;
+        while (iret < len) {
+            const unsigned char* lead = delimiter_policy_.FindLead(data + iret, len - iret);
+            if (!lead) {
+                diag("读取%d数据，找不到包头\n", len - iret);
+                iret = len;
+                break;
+            }
+            int headpos = (int)(lead - data);
+            int remainlen = len - headpos;
+            int headlen = 0;
+            int headtype = checkhead(lead, remainlen, &headlen);
+            if (HEAD_MORE == headtype) {//数据不够解析帧头，先缓存
+                stageappend(lead, remainlen);
+                iret = len;
+                break;
+            }
+            if (HEAD_INVALID == headtype) {
+                iret = headpos + 1;
+                continue;
+            }
+            if (HEAD_OVERSIZE == headtype) {
+                flushbatch();
+                *pos = len;
+                return PACKET_ERR_OVERSIZE;
+            }
+            if (HEAD_STREAM == headtype) {//包数据由recvdata分段回调
+                startstream();
+                iret = headpos + headlen;
+                break;
+            }
+            int datalen = HeaderPolicy::DataLen(theNexPacket);
+            int framelen = headlen + datalen + taillen();
+            if (remainlen < framelen) {//帧不完整，缓存等下一次读取
+                stagereserve(framelen);
+                stageappend(lead, remainlen);
+                startstagecheck(headlen);
+                iret = len;
+                break;
+            }
+            iret = headpos + framelen;
+            const unsigned char* packetdata = lead + headlen;
+            if (!checktail(packetdata + datalen)) {
+                continue;
+            }
+            if (ChecksumPolicy::BATCH_MAX > 0 && batchlanes_ > 0 && ChecksumPolicy::Batchable(theNexPacket)) {
+                BatchFrame& frame = batch_[batchcount_++];
+                frame.head = theNexPacket;
+                frame.packetdata = packetdata;
+                if (batchcount_ >= batchlanes_) {
+                    flushbatch();
+                }
+                continue;
+            }
+            flushbatch();
+            if (!ChecksumPolicy::Verify(theNexPacket, packetdata)) {
+                diag("包数据长%d, 校验码不合法\n", datalen);
+                continue;
+            }
+            if (this->packet_cb_) {//回调帧数据给用户
+                this->packet_cb_(theNexPacket, packetdata, this->packetcb_userdata_);
+            }
+        }
+        flushbatch();
+        *pos = iret;
+        return PACKET_OK;
+    }
+    //一起校验batch_中的帧，按顺序回调校验通过的帧
+    void flushbatch() {
+        if (ChecksumPolicy::BATCH_MAX == 0 || 0 == batchcount_) {
+            return;
+        }
+        int count = batchcount_;
+        batchcount_ = 0;
+        const Header* heads[BATCH_MAX];
+        const unsigned char* datas[BATCH_MAX];
+        bool checkok[BATCH_MAX];
+        for (int i = 0; i < count; ++i) {
+            heads[i] = &batch_[i].head;
+            datas[i] = batch_[i].packetdata;
+        }
+        ChecksumPolicy::VerifyBatch(heads, datas, checkok, count);
+        for (int i = 0; i < count; ++i) {
+            const BatchFrame& frame = batch_[i];
+            if (!checkok[i]) {
+                diag("包数据长%d, 校验码不合法\n", HeaderPolicy::DataLen(frame.head));
+                continue;
+            }
+            if (this->packet_cb_) {//回调帧数据给用户
+                this->packet_cb_(frame.head, frame.packetdata, this->packetcb_userdata_);
+            }
+        }
+    }
+    //补齐thread_readdata中缓存的帧: 先补齐帧头，再补齐整帧. 只从data中取这一帧需要的数据
+    int fillstage(const unsigned char* data, int len, int* pos) {
+        if (0 == stageheadlen_) {
+            return fillstagehead(data, len, pos);
+        }
+        int datalen = HeaderPolicy::DataLen(theNexPacket);
+        int needlen = stageheadlen_ + datalen + taillen();//缓存了帧头的，帧头已检查通过
+        int takelen = (std::min)(needlen - truepacketlen, len - *pos);
+        stageappend(data + *pos, takelen);
+        *pos += takelen;
+        stagehash();
+        if (truepacketlen < needlen) {
+            return PACKET_OK;//等待下一轮的读取
+        }
+        const unsigned char* packetdata = (const unsigned char*)thread_readdata.base + stageheadlen_;
+        truepacketlen = 0;//与parseinplace相同，出错时跳过整帧
+        stageheadlen_ = 0;
+        if (!checktail(packetdata + datalen)) {
+            return PACKET_OK;
+        }
+        if (!ChecksumPolicy::Final(stagecheck_, theNexPacket)) {//包数据已在stagehash中算完
+            diag("包数据长%d, 校验码不合法\n", datalen);
+            return PACKET_OK;
+        }
+        if (this->packet_cb_) {//回调帧数据给用户
+            this->packet_cb_(theNexPacket, packetdata, this->packetcb_userdata_);
+        }
+        return PACKET_OK;
+    }
+    //缓存的帧头不完整: 把缓存与data开头拼在一起，查找从缓存内开始的包头并先检查帧头，再决定缓存什么
+    //缓存内没有合法的帧头时清空缓存，不从data取数据，data由parseinplace原地解析
+    int fillstagehead(const unsigned char* data, int len, int* pos) {
+        unsigned char window[2 * MAXHEADLEN];
+        int stagelen = truepacketlen;
+        int takelen = (std::min)((int)MAXHEADLEN, len - *pos);
+        memcpy(window, thread_readdata.base, stagelen);
+        memcpy(window + stagelen, data + *pos, takelen);
+        int windowlen = stagelen + takelen;
+        truepacketlen = 0;
+        for (int headpos = 0; headpos < stagelen; ++headpos) {
+            if (!delimiter_policy_.IsLead(window[headpos])) {
+                continue;
+            }
+            int headlen = 0;
+            int headtype = checkhead(window + headpos, windowlen - headpos, &headlen);
+            if (HEAD_MORE == headtype) {//data已取完仍不够一个帧头，缓存等下一次读取
+                stageappend(window + headpos, windowlen - headpos);
+                *pos += takelen;
+                return PACKET_OK;
+            }
+            if (HEAD_INVALID == headtype) {
+                continue;
+            }
+            if (HEAD_OVERSIZE == headtype) {
+                return PACKET_ERR_OVERSIZE;
+            }
+            if (headpos + headlen <= stagelen) {//变长帧头完整地在缓存内: 重新解析缓存余下的数据(不超过一个帧头长)
+                std::string rescandata((const char*)window + headpos, stagelen - headpos);
+                return recvdata((const unsigned char*)rescandata.data(), (int)rescandata.size());
+            }
+            *pos += headpos + headlen - stagelen;//帧头在data中的部分
+            if (HEAD_STREAM == headtype) {
+                startstream();
+                return PACKET_OK;
+            }
+            stagereserve(headlen + HeaderPolicy::DataLen(theNexPacket) + taillen());
+            stageappend(window + headpos, headlen);
+            startstagecheck(headlen);
+            return fillstage(data, len, pos);//补齐整帧. 没有包数据与包尾的帧此时已完整，不能等到下一次读取
+        }
+        return PACKET_OK;
+    }
+    //缓存帧的帧头检查通过后开始计算校验码
+    void startstagecheck(int headlen) {
+        stageheadlen_ = headlen;
+        ChecksumPolicy::Init(stagecheck_, theNexPacket);
+        stagehashed_ = 0;
+        stagehash();
+    }
+    //对缓存中新到的包数据更新校验码，趁数据还在cache中
+    void stagehash() {
+        int payloadlen = (std::min)(truepacketlen - stageheadlen_, HeaderPolicy::DataLen(theNexPacket));
+        if (payloadlen > stagehashed_) {
+            ChecksumPolicy::Update(stagecheck_, (const unsigned char*)thread_readdata.base + stageheadlen_ + stagehashed_, payloadlen - stagehashed_);
+            stagehashed_ = payloadlen;
+        }
+    }
+    void stagereserve(size_t len) {
+        if (thread_readdata.len < len) {
+            thread_readdata.base = (char*)realloc(thread_readdata.base, len);
+            thread_readdata.len = len;
+        }
+    }
+    void stageappend(const unsigned char* data, int len) {
+        stagereserve(truepacketlen + len);
+        memcpy(thread_readdata.base + truepacketlen, data, len);
+        truepacketlen += len;
+    }
+    //解析lead(包头)开始的帧头到theNexPacket并检查. 返回HEAD_OK等，*headlen为包头加帧头的长度
+    int checkhead(const unsigned char* lead, int len, int* headlen) {
+        int ret = header_policy_.Parse(lead + LEADLEN, len - LEADLEN, theNexPacket);
+        if (0 == ret) {
+            return HEAD_MORE;
+        }
+        if (ret < 0) {
+            diag("帧头数据不合法\n");
+            return HEAD_INVALID;
+        }
+        if (!ChecksumPolicy::Accept(theNexPacket)) {
+            diag("不支持的校验方式\n");
+            return HEAD_INVALID;
+        }
+        *headlen = LEADLEN + ret;
+        int datalen = HeaderPolicy::DataLen(theNexPacket);
+        if (datalen > max_frame_size_) {//超过最大帧长,不申请内存,由调用者关闭连接
+            diag("包数据长%d, 超过最大帧长%d\n", datalen, max_frame_size_);
+            truepacketlen = 0;
+            parsetype = PARSE_NOTHING;
+            return HEAD_OVERSIZE;
+        }
+        if (chunk_cb_ && stream_threshold_ > 0 && datalen >= stream_threshold_) {
+            return HEAD_STREAM;
+        }
+        return HEAD_OK;
+    }
+    //theNexPacket的包尾长度
+    int taillen() const {
+        return (TAILLEN > 0 && HeaderPolicy::HasTail(theNexPacket)) ? (int)TAILLEN : 0;
+    }
+    bool checktail(const unsigned char* tail) {
+        if (taillen() > 0 && !delimiter_policy_.CheckTail(tail)) {
+            diag("包数据长%d, 包尾数据不合法(tail:%02x)\n", HeaderPolicy::DataLen(theNexPacket), *tail);
+            return false;
+        }
+        return true;
+    }
+    void startstream() {
+        ChecksumPolicy::Init(streamcheck_, theNexPacket);
+        streamoffset_ = 0;
+        parsetype = PARSE_STREAM;
+    }
+    void streamchunk(const unsigned char* chunk, int chunklen) {
+//回调一段包数据,同时更新校验码
+        ChecksumPolicy::Update(streamcheck_, chunk, chunklen);
+        chunk_cb_(theNexPacket, chunk, chunklen, streamoffset_, PACKET_CHUNK_DATA, chunkcb_userdata_);
+        streamoffset_ += chunklen;
+    }
+    void streamfinish(bool tailok) {//包数据接收完，检测包尾与校验码
+        int chunktype = PACKET_CHUNK_END;
+        if (!tailok) {
+            chunktype = PACKET_CHUNK_ERROR;
+        } else if (!ChecksumPolicy::Final(streamcheck_, theNexPacket)) {
+            diag("包数据长%d, 校验码不合法\n", streamoffset_);
+            chunktype = PACKET_CHUNK_ERROR;
+        }
+        parsetype = PARSE_NOTHING;//重头再来.分段已回调，出错也不能回退重新查找包头
+        chunk_cb_(theNexPacket, NULL, 0, streamoffset_, chunktype, chunkcb_userdata_);
+    }
+    FrameCB packet_cb_;//回调函数
+    void*   packetcb_userdata_;//回调函数所带的自定义数据
+    FrameChunkCB chunk_cb_;//大包分段回调函数
+    void*        chunkcb_userdata_;
+
+    enum {
+        PARSE_NOTHING,
+        PARSE_STREAM,//分段接收大包中
+    };
+    int max_frame_size_;//最大帧长
+    int stream_threshold_;//分段回调的帧长阈值
+    int streamoffset_;//已分段回调的包数据长度
+    typename ChecksumPolicy::State streamcheck_;//分段接收时的校验码
+    int parsetype;
+    uv_buf_t  thread_readdata;//缓存跨越两次recvdata的帧，从包头开始
+    int truepacketlen;//readdata有效数据长度
+    int stageheadlen_;//缓存帧的包头加帧头长度，0表示帧头还不完整
+    typename ChecksumPolicy::State stagecheck_;//缓存帧的校验码
+    int stagehashed_;//缓存帧已计算校验码的包数据长度
+    Header theNexPacket;
+
+    struct BatchFrame {//待成批校验的帧
+        Header head;
+        const unsigned char* packetdata;//在recvdata的data内
+    };
+    int batchlanes_;//一批的帧数，0表示不成批
+    int batchcount_;
+    BatchFrame batch_[BATCH_MAX];
+    uint64_t diagstart_;//本周期第一条解析错误信息的时间(ns)
+    int diagcount_;//本周期已输出的条数
+    int diagsuppressed_;//本周期省略的条数
+private:// no copy
+    BasicFramer(const BasicFramer&);
+    BasicFramer& operator = (const BasicFramer&);
+};
+
+#endif//BASIC_FRAMER_H
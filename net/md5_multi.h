@@ -0,0 +1,292 @@
+﻿/***************************************
+* @file     md5_multi.h
+* @brief    多路MD5: 一次计算多段数据的md5，每段数据占SIMD寄存器的一个32位通道，结果与openssl的MD5()一致
+* @details  MD5Multi: AVX-512 16路，AVX2 8路，运行时按CPU选择. 其他CPU/编译器(如MSVC)逐段调用openssl MD5()
+            SIMD版本用gcc/clang的向量扩展编写，由带target属性的函数实例化，不需要全局的-mavx2编译选项
+            某一通道算完即换入下一段数据；只剩一段未算完时转为标量计算，长短不一的数据不会拖慢整批
+* @author   phata, wqvbjhc@gmail.com
+* @date     2026-10-19
+****************************************/
+#ifndef MD5_MULTI_H
+#define MD5_MULTI_H
+#include <stdint.h>
+#include <string.h>
+#include <openssl/md5.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MD5_MULTI_SIMD 1
+#endif
+
+#define MD5_MULTI_MAX_LANES 16//最大SIMD通道数
+
+typedef struct _md5_job {
+    const unsigned char* data;
+    size_t len;
+    unsigned char* digest;//16字节
+} MD5Job;
+
+#ifdef MD5_MULTI_SIMD
+namespace MD5MultiImpl
+{
+#define MD5_ROUND_F(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define MD5_ROUND_G(b, c, d) ((c) ^ ((d) & ((b) ^ (c))))
+#define MD5_ROUND_H(b, c, d) ((b) ^ (c) ^ (d))
+#define MD5_ROUND_I(b, c, d) ((c) ^ ((b) | ~(d)))
+#define MD5_MULTI_STEP(f, a, b, c, d, x, k, s) \
+    a += f(b, c, d) + (x) + (uint32_t)(k); \
+    a = ((a << (s)) | (a >> (32 - (s)))) + (b);
+//一个64字节块的64步运算. a,b,c,d与x[16]可以是uint32_t，也可以是uint32_t的向量
+#define MD5_MULTI_ROUNDS(a, b, c, d, x) \
+    MD5_MULTI_STEP(MD5_ROUND_F, a, b, c, d, x[0], 0xd76aa478, 7) \
+    MD5_MULTI_STEP(MD5_ROUND_F, d, a, b, c, x[1], 0xe8c7b756, 12) \
+    MD5_MULTI_STEP(MD5_ROUND_F, c, d, a, b, x[2], 0x242070db, 17) \
+    MD5_MULTI_STEP(MD5_ROUND_F, b, c, d, a, x[3], 0xc1bdceee, 22) \
+    MD5_MULTI_STEP(MD5_ROUND_F, a, b, c, d, x[4], 0xf57c0faf, 7) \
+    MD5_MULTI_STEP(MD5_ROUND_F, d, a, b, c, x[5], 0x4787c62a, 12) \
+    MD5_MULTI_STEP(MD5_ROUND_F, c, d, a, b, x[6], 0xa8304613, 17) \
+    MD5_MULTI_STEP(MD5_ROUND_F, b, c, d, a, x[7], 0xfd469501, 22) \
+    MD5_MULTI_STEP(MD5_ROUND_F, a, b, c, d, x[8], 0x698098d8, 7) \
+    MD5_MULTI_STEP(MD5_ROUND_F, d, a, b, c, x[9], 0x8b44f7af, 12) \
+    MD5_MULTI_STEP(MD5_ROUND_F, c, d, a, b, x[10], 0xffff5bb1, 17) \
+    MD5_MULTI_STEP(MD5_ROUND_F, b, c, d, a, x[11], 0x895cd7be, 22) \
+    MD5_MULTI_STEP(MD5_ROUND_F, a, b, c, d, x[12], 0x6b901122, 7) \
+    MD5_MULTI_STEP(MD5_ROUND_F, d, a, b, c, x[13], 0xfd987193, 12) \
+    MD5_MULTI_STEP(MD5_ROUND_F, c, d, a, b, x[14], 0xa679438e, 17) \
+    MD5_MULTI_STEP(MD5_ROUND_F, b, c, d, a, x[15], 0x49b40821, 22) \
+    MD5_MULTI_STEP(MD5_ROUND_G, a, b, c, d, x[1], 0xf61e2562, 5) \
+    MD5_MULTI_STEP(MD5_ROUND_G, d, a, b, c, x[6], 0xc040b340, 9) \
+    MD5_MULTI_STEP(MD5_ROUND_G, c, d, a, b, x[11], 0x265e5a51, 14) \
+    MD5_MULTI_STEP(MD5_ROUND_G, b, c, d, a, x[0], 0xe9b6c7aa, 20) \
+    MD5_MULTI_STEP(MD5_ROUND_G, a, b, c, d, x[5], 0xd62f105d, 5) \
+    MD5_MULTI_STEP(MD5_ROUND_G, d, a, b, c, x[10], 0x02441453, 9) \
+    MD5_MULTI_STEP(MD5_ROUND_G, c, d, a, b, x[15], 0xd8a1e681, 14) \
+    MD5_MULTI_STEP(MD5_ROUND_G, b, c, d, a, x[4], 0xe7d3fbc8, 20) \
+    MD5_MULTI_STEP(MD5_ROUND_G, a, b, c, d, x[9], 0x21e1cde6, 5) \
+    MD5_MULTI_STEP(MD5_ROUND_G, d, a, b, c, x[14], 0xc33707d6, 9) \
+    MD5_MULTI_STEP(MD5_ROUND_G, c, d, a, b, x[3], 0xf4d50d87, 14) \
+    MD5_MULTI_STEP(MD5_ROUND_G, b, c, d, a, x[8], 0x455a14ed, 20) \
+    MD5_MULTI_STEP(MD5_ROUND_G, a, b, c, d, x[13], 0xa9e3e905, 5) \
+    MD5_MULTI_STEP(MD5_ROUND_G, d, a, b, c, x[2], 0xfcefa3f8, 9) \
+    MD5_MULTI_STEP(MD5_ROUND_G, c, d, a, b, x[7], 0x676f02d9, 14) \
+    MD5_MULTI_STEP(MD5_ROUND_G, b, c, d, a, x[12], 0x8d2a4c8a, 20) \
+    MD5_MULTI_STEP(MD5_ROUND_H, a, b, c, d, x[5], 0xfffa3942, 4) \
+    MD5_MULTI_STEP(MD5_ROUND_H, d, a, b, c, x[8], 0x8771f681, 11) \
+    MD5_MULTI_STEP(MD5_ROUND_H, c, d, a, b, x[11], 0x6d9d6122, 16) \
+    MD5_MULTI_STEP(MD5_ROUND_H, b, c, d, a, x[14], 0xfde5380c, 23) \
+    MD5_MULTI_STEP(MD5_ROUND_H, a, b, c, d, x[1], 0xa4beea44, 4) \
+    MD5_MULTI_STEP(MD5_ROUND_H, d, a, b, c, x[4], 0x4bdecfa9, 11) \
+    MD5_MULTI_STEP(MD5_ROUND_H, c, d, a, b, x[7], 0xf6bb4b60, 16) \
+    MD5_MULTI_STEP(MD5_ROUND_H, b, c, d, a, x[10], 0xbebfbc70, 23) \
+    MD5_MULTI_STEP(MD5_ROUND_H, a, b, c, d, x[13], 0x289b7ec6, 4) \
+    MD5_MULTI_STEP(MD5_ROUND_H, d, a, b, c, x[0], 0xeaa127fa, 11) \
+    MD5_MULTI_STEP(MD5_ROUND_H, c, d, a, b, x[3], 0xd4ef3085, 16) \
+    MD5_MULTI_STEP(MD5_ROUND_H, b, c, d, a, x[6], 0x04881d05, 23) \
+    MD5_MULTI_STEP(MD5_ROUND_H, a, b, c, d, x[9], 0xd9d4d039, 4) \
+    MD5_MULTI_STEP(MD5_ROUND_H, d, a, b, c, x[12], 0xe6db99e5, 11) \
+    MD5_MULTI_STEP(MD5_ROUND_H, c, d, a, b, x[15], 0x1fa27cf8, 16) \
+    MD5_MULTI_STEP(MD5_ROUND_H, b, c, d, a, x[2], 0xc4ac5665, 23) \
+    MD5_MULTI_STEP(MD5_ROUND_I, a, b, c, d, x[0], 0xf4292244, 6) \
+    MD5_MULTI_STEP(MD5_ROUND_I, d, a, b, c, x[7], 0x432aff97, 10) \
+    MD5_MULTI_STEP(MD5_ROUND_I, c, d, a, b, x[14], 0xab9423a7, 15) \
+    MD5_MULTI_STEP(MD5_ROUND_I, b, c, d, a, x[5], 0xfc93a039, 21) \
+    MD5_MULTI_STEP(MD5_ROUND_I, a, b, c, d, x[12], 0x655b59c3, 6) \
+    MD5_MULTI_STEP(MD5_ROUND_I, d, a, b, c, x[3], 0x8f0ccc92, 10) \
+    MD5_MULTI_STEP(MD5_ROUND_I, c, d, a, b, x[10], 0xffeff47d, 15) \
+    MD5_MULTI_STEP(MD5_ROUND_I, b, c, d, a, x[1], 0x85845dd1, 21) \
+    MD5_MULTI_STEP(MD5_ROUND_I, a, b, c, d, x[8], 0x6fa87e4f, 6) \
+    MD5_MULTI_STEP(MD5_ROUND_I, d, a, b, c, x[15], 0xfe2ce6e0, 10) \
+    MD5_MULTI_STEP(MD5_ROUND_I, c, d, a, b, x[6], 0xa3014314, 15) \
+    MD5_MULTI_STEP(MD5_ROUND_I, b, c, d, a, x[13], 0x4e0811a1, 21) \
+    MD5_MULTI_STEP(MD5_ROUND_I, a, b, c, d, x[4], 0xf7537e82, 6) \
+    MD5_MULTI_STEP(MD5_ROUND_I, d, a, b, c, x[11], 0xbd3af235, 10) \
+    MD5_MULTI_STEP(MD5_ROUND_I, c, d, a, b, x[2], 0x2ad7d2bb, 15) \
+    MD5_MULTI_STEP(MD5_ROUND_I, b, c, d, a, x[9], 0xeb86d391, 21)
+
+static const unsigned char zeroblock[64] = {0};
+
+//标量计算nblocks个块
+inline void Blocks(uint32_t state[4], const unsigned char* p, size_t nblocks)
+{
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (size_t block = 0; block < nblocks; ++block, p += 64) {
+        uint32_t x[16];
+        memcpy(x, p, 64);//x86为小端，与md5的字节序一致
+        uint32_t aa = a, bb = b, cc = c, dd = d;
+        MD5_MULTI_ROUNDS(a, b, c, d, x)
+        a += aa;
+        b += bb;
+        c += cc;
+        d += dd;
+    }
+    state[0] = a;
+    state[1] = b;
+    state[2] = c;
+    state[3] = d;
+}
+
+//一个通道正在计算的数据: 先是data中完整的块，再是tail中填充后的1或2个块
+struct Lane {
+    const MD5Job* job;//NULL表示空闲
+    size_t block;//已计算的块数
+    size_t fullblocks;
+    size_t totalblocks;
+    unsigned char tail[128];
+
+    void Start(const MD5Job* newjob) {
+        job = newjob;
+        block = 0;
+        size_t rem = job->len % 64;
+        size_t tailblocks = rem < 56 ? 1 : 2;
+        fullblocks = job->len / 64;
+        totalblocks = fullblocks + tailblocks;
+        memset(tail, 0, tailblocks * 64);
+        memcpy(tail, job->data + fullblocks * 64, rem);
+        tail[rem] = 0x80;
+        uint64_t bits = (uint64_t)job->len * 8;
+        for (int i = 0; i < 8; ++i) {//小端的位长度
+            tail[tailblocks * 64 - 8 + i] = (unsigned char)(bits >> (8 * i));
+        }
+    }
+    const unsigned char* Current() const {
+        if (!job) {
+            return zeroblock;//空闲通道用全0块占位
+        }
+        return block < fullblocks ? job->data + block * 64 : tail + (block - fullblocks) * 64;
+    }
+    void Finish(uint32_t state[4]) {//标量算完剩下的块
+        if (block < fullblocks) {
+            Blocks(state, job->data + block * 64, fullblocks - block);
+            block = fullblocks;
+        }
+        Blocks(state, tail + (block - fullblocks) * 64, totalblocks - block);
+        memcpy(job->digest, state, 16);
+        job = NULL;
+    }
+};
+
+//V为gcc向量类型，LANES个uint32通道. always_inline到target函数中，按该函数的指令集生成代码
+template <class V, int LANES>
+__attribute__((always_inline)) inline void Run(const MD5Job* jobs, int count)
+{
+    Lane lanes[LANES];
+    V a, b, c, d;
+    int next = 0;
+    for (int i = 0; i < LANES; ++i) {
+        lanes[i].job = NULL;
+        if (next < count) {
+            lanes[i].Start(&jobs[next++]);
+        }
+        a[i] = 0x67452301;
+        b[i] = 0xefcdab89;
+        c[i] = 0x98badcfe;
+        d[i] = 0x10325476;
+    }
+    for (;;) {
+        int active = 0, lastlane = 0;
+        for (int i = 0; i < LANES; ++i) {
+            if (lanes[i].job) {
+                ++active;
+                lastlane = i;
+            }
+        }
+        if (0 == active) {
+            break;
+        }
+        if (1 == active && next >= count) {//只剩一段，标量更快
+            uint32_t state[4] = {a[lastlane], b[lastlane], c[lastlane], d[lastlane]};
+            lanes[lastlane].Finish(state);
+            break;
+        }
+        //转置: x[j]的第i个通道是第i个通道当前块的第j个字
+        uint32_t words[16][LANES] __attribute__((aligned(64)));
+        for (int i = 0; i < LANES; ++i) {
+            const unsigned char* p = lanes[i].Current();
+            for (int j = 0; j < 16; ++j) {
+                memcpy(&words[j][i], p + j * 4, 4);
+            }
+        }
+        V x[16];
+        memcpy(x, words, sizeof(x));
+        V aa = a, bb = b, cc = c, dd = d;
+        MD5_MULTI_ROUNDS(a, b, c, d, x)
+        a += aa;
+        b += bb;
+        c += cc;
+        d += dd;
+        for (int i = 0; i < LANES; ++i) {
+            Lane& lane = lanes[i];
+            if (!lane.job || ++lane.block < lane.totalblocks) {
+                continue;
+            }
+            uint32_t state[4] = {a[i], b[i], c[i], d[i]};
+            memcpy(lane.job->digest, state, 16);
+            lane.job = NULL;
+            if (next < count) {//换入下一段数据
+                lane.Start(&jobs[next++]);
+                a[i] = 0x67452301;
+                b[i] = 0xefcdab89;
+                c[i] = 0x98badcfe;
+                d[i] = 0x10325476;
+            }
+        }
+    }
+}
+
+typedef uint32_t V8 __attribute__((vector_size(32)));
+typedef uint32_t V16 __attribute__((vector_size(64)));
+
+__attribute__((target("avx2"))) inline void RunAVX2(const MD5Job* jobs, int count)
+{
+    Run<V8, 8>(jobs, count);
+}
+__attribute__((target("avx512f"))) inline void RunAVX512(const MD5Job* jobs, int count)
+{
+    Run<V16, 16>(jobs, count);
+}
+
+inline int SIMDLanes()
+{
+    static const int lanes = __builtin_cpu_supports("avx512f") ? 16 : (__builtin_cpu_supports("avx2") ? 8 : 0);
+    return lanes;
+}
+#undef MD5_ROUND_F
+#undef MD5_ROUND_G
+#undef MD5_ROUND_H
+#undef MD5_ROUND_I
+#undef MD5_MULTI_STEP
+#undef MD5_MULTI_ROUNDS
+}//namespace MD5MultiImpl
+#endif
+
+//SIMD的通道数，0表示不支持(逐段计算)
+inline int MD5MultiLanes()
+{
+#ifdef MD5_MULTI_SIMD
+    return MD5MultiImpl::SIMDLanes();
+#else
+    return 0;
+#endif
+}
+
+/************************************************************************/
+/* 计算count个job的md5，写入各自的digest. 结果与MD5()相同               */
+/************************************************************************/
+inline void MD5Multi(const MD5Job* jobs, int count)
+{
+#ifdef MD5_MULTI_SIMD
+    int lanes = MD5MultiImpl::SIMDLanes();
+    if (count >= 2 && lanes > 0) {//只有一段时openssl的汇编实现更快
+        if (lanes >= 16 && count > 8) {
+            MD5MultiImpl::RunAVX512(jobs, count);
+        } else {
+            MD5MultiImpl::RunAVX2(jobs, count);
+        }
+        return;
+    }
+#endif
+    for (int i = 0; i < count; ++i) {
+        MD5(jobs[i].data, jobs[i].len, jobs[i].digest);
+    }
+}
+
+#endif//MD5_MULTI_H
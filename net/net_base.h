@@ -10,6 +10,10 @@
 * @author   phata, wqvbjhc@gmail.com
 * @date     2014-5-16
 * @mod      2014-5-21 phata 包定义添加了包头包尾版本和校验位信息
+            2026-10-19 phata version的8-11位为校验方式(MD5/CRC32C/XXH64/不校验)
+            2026-10-19 phata version的0-7位为帧格式，新增紧凑的v2格式(对齐的8字节帧头，可选校验码与关联id)
+            2026-10-19 phata version的12-15位为包数据的压缩方式(zlib)
+            2026-10-19 phata 校验方式新增AEAD加密(AES-128-GCM/ChaCha20-Poly1305)，check为认证标签
 ****************************************/
 #ifndef NET_BASE_H
 #define NET_BASE_H
@@ -165,6 +169,199 @@ typedef struct _NetPacket{//传输自定义数据包头结构
 
 #pragma pack()//将当前字节对齐值设为默认值(通常是4)
 
+//version的8-11位为check的计算方式，收发两端按包头中的方式计算与检验. 旧版本这几位为0，即MD5
+#define NET_CHECK_SHIFT 8
+#define NET_CHECK_MASK (0x0F << NET_CHECK_SHIFT)
+typedef enum {
+	NET_CHECK_MD5 = 0,   //16字节md5，兼容旧版本
+	NET_CHECK_CRC32C,    //crc32c，大端存于check[0-3]
+	NET_CHECK_XXH64,     //xxhash64，大端存于check[0-7]
+	NET_CHECK_NONE,      //不校验，check全0，用于可信链路
+	NET_CHECK_AES128GCM, //AES-128-GCM加密包数据，check为16字节认证标签(见packet_aead.h)
+	NET_CHECK_CHACHA20POLY1305 //ChaCha20-Poly1305加密包数据，同上
+} NET_CHECK_TYPE;
+
+inline int GetNetPacketCheckType(const NetPacket& package)
+{
+	return ((uint32_t)package.version & NET_CHECK_MASK) >> NET_CHECK_SHIFT;
+}
+
+inline void SetNetPacketCheckType(NetPacket& package, int checktype)
+{
+	package.version = (int32_t)(((uint32_t)package.version & ~(uint32_t)NET_CHECK_MASK) | (((uint32_t)checktype << NET_CHECK_SHIFT) & NET_CHECK_MASK));
+}
+
+//version的12-15位为包数据的压缩方式. 压缩后的包数据为[4字节小端的原长][压缩数据]，datalen与check都是压缩后的
+//收发两端见packet_compress.h. 旧版本这几位为0，即不压缩
+#define NET_COMPRESS_SHIFT 12
+#define NET_COMPRESS_MASK (0x0F << NET_COMPRESS_SHIFT)
+typedef enum {
+	NET_COMPRESS_NONE = 0,
+	NET_COMPRESS_ZLIB        //zlib(deflate)，需定义NET_WITH_ZLIB
+} NET_COMPRESS_TYPE;
+
+inline int GetNetPacketCompressType(const NetPacket& package)
+{
+	return ((uint32_t)package.version & NET_COMPRESS_MASK) >> NET_COMPRESS_SHIFT;
+}
+
+inline void SetNetPacketCompressType(NetPacket& package, int compresstype)
+{
+	package.version = (int32_t)(((uint32_t)package.version & ~(uint32_t)NET_COMPRESS_MASK) | (((uint32_t)compresstype << NET_COMPRESS_SHIFT) & NET_COMPRESS_MASK));
+}
+
+//各校验方式在check中的有效字节数
+inline int NetCheckLen(int checktype)
+{
+	switch (checktype) {
+	case NET_CHECK_MD5:
+		return 16;
+	case NET_CHECK_CRC32C:
+		return 4;
+	case NET_CHECK_XXH64:
+		return 8;
+	case NET_CHECK_AES128GCM:
+	case NET_CHECK_CHACHA20POLY1305:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+//校验方式是否为AEAD加密: 包数据为密文，check为认证标签
+inline bool NetCheckIsAEAD(int checktype)
+{
+	return NET_CHECK_AES128GCM == checktype || NET_CHECK_CHACHA20POLY1305 == checktype;
+}
+
+//小端读写. x86/ARM上编译为一次load/store
+inline uint16_t LoadLE16(const unsigned char* p)
+{
+	uint16_t v;
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap16(v);
+#endif
+	return v;
+}
+inline uint32_t LoadLE32(const unsigned char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+inline void StoreLE16(uint16_t v, unsigned char* p)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap16(v);
+#endif
+	memcpy(p, &v, sizeof(v));
+}
+inline void StoreLE32(uint32_t v, unsigned char* p)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	memcpy(p, &v, sizeof(v));
+}
+
+//version的0-7位为帧格式. NET_PACKAGE_VERSION_V2为紧凑格式，其他值为上面34字节的NetPacket格式(v1)
+//v2帧: 小端，帧头各字段在自然对齐的偏移上，各用一次load读取. 没有包尾，v1与v2的帧可以在同一连接上混合
+//|--包头1字节--|--[format:1][flags:1][type:2][datalen:4]--|--check(0/4/8/16字节)--|--correlation(0/4字节)--|--pack data--|
+//format为0x02(v1此处为version的最低字节0x01)；flags的0-3位为校验方式，第4位表示带correlation(即NetPacket.reserve，为0时省略)
+//flags的第5位表示包数据为zlib压缩(NET_COMPRESS_ZLIB)
+//check为NetPacket.check的前NetCheckLen字节. 解码时header/tail由接收方填入包头包尾，version为V2加校验方式
+#define NET_PACKAGE_VERSION_V2 0x02
+#define NET_FORMAT_MASK 0xFF
+#define NET_V2_HEADLEN 8                          //v2定长部分
+#define NET_V2_FLAG_CHECK_MASK 0x0F
+#define NET_V2_FLAG_CORRELATION 0x10
+#define NET_V2_FLAG_ZLIB 0x20
+#define NET_V2_MAX_HEADLEN (NET_V2_HEADLEN + 16 + 4)//v2帧头最大长度28字节
+
+inline int GetNetPacketFormat(const NetPacket& package)
+{
+	return (uint32_t)package.version & NET_FORMAT_MASK;
+}
+
+//v2能否表示该包: type须在0-65535内，压缩方式为不压缩或zlib
+inline bool NetPacketFitsV2(const NetPacket& package)
+{
+	int compresstype = GetNetPacketCompressType(package);
+	return package.type >= 0 && package.type <= 0xFFFF && (NET_COMPRESS_NONE == compresstype || NET_COMPRESS_ZLIB == compresstype);
+}
+
+//NetPacket编码为v2帧头(不含包头)，chardata须有NET_V2_MAX_HEADLEN字节. 返回帧头长度
+inline int NetPacketToCharV2(const NetPacket& package, unsigned char* chardata)
+{
+	int checktype = GetNetPacketCheckType(package);
+	int checklen = NetCheckLen(checktype);
+	unsigned char flags = (unsigned char)(checktype & NET_V2_FLAG_CHECK_MASK);
+	if (package.reserve != 0) {
+		flags |= NET_V2_FLAG_CORRELATION;
+	}
+	if (NET_COMPRESS_ZLIB == GetNetPacketCompressType(package)) {
+		flags |= NET_V2_FLAG_ZLIB;
+	}
+	chardata[0] = NET_PACKAGE_VERSION_V2;
+	chardata[1] = flags;
+	StoreLE16((uint16_t)package.type, chardata + 2);
+	StoreLE32((uint32_t)package.datalen, chardata + 4);
+	memcpy(chardata + NET_V2_HEADLEN, package.check, checklen);
+	int headlen = NET_V2_HEADLEN + checklen;
+	if (flags & NET_V2_FLAG_CORRELATION) {
+		StoreLE32((uint32_t)package.reserve, chardata + headlen);
+		headlen += 4;
+	}
+	return headlen;
+}
+
+//解码v2帧头(不含包头). 返回帧头长度，数据不够返回0，不合法返回-1. header/tail不修改
+inline int CharToNetPacketV2(const unsigned char* chardata, int len, NetPacket& package)
+{
+	if (len < NET_V2_HEADLEN) {
+		return 0;
+	}
+	unsigned char flags = chardata[1];
+	if (chardata[0] != NET_PACKAGE_VERSION_V2 || (flags & ~(NET_V2_FLAG_CHECK_MASK | NET_V2_FLAG_CORRELATION | NET_V2_FLAG_ZLIB))) {
+		return -1;
+	}
+	int checktype = flags & NET_V2_FLAG_CHECK_MASK;
+	if (checktype > NET_CHECK_CHACHA20POLY1305) {
+		return -1;
+	}
+	int checklen = NetCheckLen(checktype);
+	int headlen = NET_V2_HEADLEN + checklen + ((flags & NET_V2_FLAG_CORRELATION) ? 4 : 0);
+	if (len < headlen) {
+		return 0;
+	}
+	package.version = NET_PACKAGE_VERSION_V2 | (checktype << NET_CHECK_SHIFT);
+	if (flags & NET_V2_FLAG_ZLIB) {
+		package.version |= NET_COMPRESS_ZLIB << NET_COMPRESS_SHIFT;
+	}
+	package.type = LoadLE16(chardata + 2);
+	package.datalen = (int32_t)LoadLE32(chardata + 4);
+	memset(package.check, 0, sizeof(package.check));
+	switch (checklen) {//定长拷贝，不调用memcpy
+	case 16:
+		memcpy(package.check, chardata + NET_V2_HEADLEN, 16);
+		break;
+	case 8:
+		memcpy(package.check, chardata + NET_V2_HEADLEN, 8);
+		break;
+	case 4:
+		memcpy(package.check, chardata + NET_V2_HEADLEN, 4);
+		break;
+	default:
+		break;
+	}
+	package.reserve = (flags & NET_V2_FLAG_CORRELATION) ? (int32_t)LoadLE32(chardata + NET_V2_HEADLEN + checklen) : 0;
+	return headlen;
+}
+
 //NetPackage转为char*数据，chardata必须有38字节的空间
 inline bool NetPacketToChar(const NetPacket& package, unsigned char* chardata)
 {
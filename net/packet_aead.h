@@ -0,0 +1,386 @@
+﻿/***************************************
+* @file     packet_aead.h
+* @brief    包数据的认证加密(AEAD): 用预共享密钥加密包数据，16字节的认证标签代替check中的校验码
+            不需要TLS握手，频繁重连的客户端没有额外的握手开销
+* @details  校验方式(NetPacket.version的8-11位)为NET_CHECK_AES128GCM或NET_CHECK_CHACHA20POLY1305时，包数据为
+            [4字节小端的密钥id][12字节nonce][密文]，datalen为含前缀的长度，check为认证标签
+            附加认证数据(AAD)为前缀加校验方式、压缩方式、type与reserve，帧头被篡改同样认证失败
+            PacketKeyring: 预共享密钥，密钥id对应算法与密钥. 发送用当前的发送密钥，接收按帧中的密钥id查找，可平滑轮换
+            PacketSealer : 发送端，每个TCPClient/TCPServer一个. nonce为随机的96位基数与64位计数器异或(同TLS1.3)，可多线程调用
+            PacketOpener : 接收端，每个连接(PacketSync)一个，整帧或分段解密. 不检测重放，需要时用TLS(tls_stream.h)
+            先压缩再加密，接收端先解密再解压. 使用OpenSSL EVP，CPU支持时AES-GCM用AES-NI与PCLMULQDQ
+            ChaCha20-Poly1305需OpenSSL 1.1.0以上，用于没有AES指令的CPU
+* @author   phata, wqvbjhc@gmail.com
+* @date     2026-10-19
+****************************************/
+#ifndef PACKET_AEAD_H
+#define PACKET_AEAD_H
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include "net/net_base.h"
+
+#define PACKET_AEAD_PREFIX 16//包数据开头的密钥id与nonce
+#define PACKET_AEAD_NONCELEN 12
+#define PACKET_AEAD_TAGLEN 16
+#define PACKET_AEAD_AADLEN (PACKET_AEAD_PREFIX + 10)
+#define PACKET_AEAD_CHUNK (64 * 1024)//分段解密时每段输出的最大长度
+
+//一个预共享密钥
+typedef struct _packet_key {
+    int checktype;//NET_CHECK_AES128GCM或NET_CHECK_CHACHA20POLY1305
+    unsigned char key[32];
+    uint64_t serial;//每次AddKey不同，EVP上下文据此判断是否需要重新设置密钥
+} PacketKey;
+
+namespace PacketAEADImpl
+{
+inline uint64_t NextSerial()
+{
+    static std::atomic<uint64_t> serial(0);
+    return ++serial;
+}
+
+inline const EVP_CIPHER* Cipher(int checktype)
+{
+    switch (checktype) {
+    case NET_CHECK_AES128GCM:
+        return EVP_aes_128_gcm();
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_CHACHA) && !defined(OPENSSL_NO_POLY1305)
+    case NET_CHECK_CHACHA20POLY1305:
+        return EVP_chacha20_poly1305();
+#endif
+    default:
+        return NULL;
+    }
+}
+
+inline size_t KeyLen(int checktype)
+{
+    return NET_CHECK_AES128GCM == checktype ? 16 : 32;
+}
+
+//AAD: 前缀(密钥id与nonce)、校验方式、压缩方式、type、reserve. datalen由密文长度隐含
+inline void BuildAAD(const NetPacket& packet, const unsigned char* prefix, unsigned char* aad)
+{
+    memcpy(aad, prefix, PACKET_AEAD_PREFIX);
+    aad[PACKET_AEAD_PREFIX] = (unsigned char)GetNetPacketCheckType(packet);
+    aad[PACKET_AEAD_PREFIX + 1] = (unsigned char)GetNetPacketCompressType(packet);
+    StoreLE32((uint32_t)packet.type, aad + PACKET_AEAD_PREFIX + 2);
+    StoreLE32((uint32_t)packet.reserve, aad + PACKET_AEAD_PREFIX + 6);
+}
+
+//EVP上下文，记住已设置的密钥. 同一密钥的后续帧只设置nonce，不重新展开密钥
+class CipherCtx
+{
+public:
+    CipherCtx(): ctx_(EVP_CIPHER_CTX_new()), serial_(0), encrypt_(-1) {
+    }
+    ~CipherCtx() {
+        EVP_CIPHER_CTX_free(ctx_);
+    }
+    //开始一帧. encrypt为1加密，0解密
+    bool Begin(const PacketKey& key, const unsigned char* nonce, int encrypt, const unsigned char* aad) {
+        if (!ctx_) {
+            return false;
+        }
+        if (serial_ != key.serial || encrypt_ != encrypt) {
+            serial_ = 0;
+            if (EVP_CipherInit_ex(ctx_, Cipher(key.checktype), NULL, key.key, nonce, encrypt) != 1) {
+                return false;
+            }
+            serial_ = key.serial;
+            encrypt_ = encrypt;
+        } else if (EVP_CipherInit_ex(ctx_, NULL, NULL, NULL, nonce, encrypt) != 1) {
+            return false;
+        }
+        int outlen = 0;
+        return EVP_CipherUpdate(ctx_, NULL, &outlen, aad, PACKET_AEAD_AADLEN) == 1;
+    }
+    bool Update(const unsigned char* in, int inlen, unsigned char* out) {
+        int outlen = 0;
+        return inlen <= 0 || (EVP_CipherUpdate(ctx_, out, &outlen, in, inlen) == 1 && outlen == inlen);
+    }
+    //加密结束，取出认证标签
+    bool SealFinal(unsigned char* tag) {
+        unsigned char last[16];
+        int outlen = 0;
+        return EVP_CipherFinal_ex(ctx_, last, &outlen) == 1 && EVP_CIPHER_CTX_ctrl(ctx_, EVP_CTRL_GCM_GET_TAG, PACKET_AEAD_TAGLEN, tag) == 1;
+    }
+    //解密结束，认证标签一致返回true
+    bool OpenFinal(const unsigned char* tag) {
+        unsigned char last[16];
+        int outlen = 0;
+        return EVP_CIPHER_CTX_ctrl(ctx_, EVP_CTRL_GCM_SET_TAG, PACKET_AEAD_TAGLEN, (void*)tag) == 1
+               && EVP_CipherFinal_ex(ctx_, last, &outlen) == 1;
+    }
+private:
+    EVP_CIPHER_CTX* ctx_;
+    uint64_t serial_;//已设置的密钥，0为没有
+    int encrypt_;
+private:// no copy
+    CipherCtx(const CipherCtx&);
+    CipherCtx& operator = (const CipherCtx&);
+};
+}//namespace PacketAEADImpl
+
+//预共享密钥. 在Connect/Start之前设置好，之后只读
+class PacketKeyring
+{
+public:
+    PacketKeyring(): sendkeyid_(0), hassendkey_(false) {
+    }
+    ~PacketKeyring() {
+        Clear();
+    }
+    static bool IsSupported(int checktype) {
+        return PacketAEADImpl::Cipher(checktype) != NULL;
+    }
+    //添加或替换密钥. AES128GCM的密钥16字节，CHACHA20POLY1305为32字节. 第一个密钥同时作为发送密钥
+    bool AddKey(uint32_t keyid, int checktype, const unsigned char* key, size_t keylen) {
+        if (!IsSupported(checktype) || !key || keylen != PacketAEADImpl::KeyLen(checktype)) {
+            return false;
+        }
+        PacketKey& item = keys_[keyid];
+        memset(&item, 0, sizeof(item));
+        item.checktype = checktype;
+        memcpy(item.key, key, keylen);
+        item.serial = PacketAEADImpl::NextSerial();
+        if (!hassendkey_) {
+            SetSendKey(keyid);
+        }
+        return true;
+    }
+    //发送用的密钥. 轮换时先让对端AddKey新密钥，再切换发送密钥，最后删除旧密钥
+    bool SetSendKey(uint32_t keyid) {
+        if (keys_.find(keyid) == keys_.end()) {
+            return false;
+        }
+        sendkeyid_ = keyid;
+        hassendkey_ = true;
+        return true;
+    }
+    void RemoveKey(uint32_t keyid) {
+        std::map<uint32_t, PacketKey>::iterator itfind = keys_.find(keyid);
+        if (itfind == keys_.end()) {
+            return;
+        }
+        OPENSSL_cleanse(itfind->second.key, sizeof(itfind->second.key));
+        keys_.erase(itfind);
+        if (sendkeyid_ == keyid) {
+            hassendkey_ = false;
+        }
+    }
+    void Clear() {
+        for (std::map<uint32_t, PacketKey>::iterator it = keys_.begin(); it != keys_.end(); ++it) {
+            OPENSSL_cleanse(it->second.key, sizeof(it->second.key));
+        }
+        keys_.clear();
+        hassendkey_ = false;
+    }
+    bool Empty() const {
+        return keys_.empty();
+    }
+    const PacketKey* Find(uint32_t keyid) const {
+        std::map<uint32_t, PacketKey>::const_iterator itfind = keys_.find(keyid);
+        return itfind == keys_.end() ? NULL : &itfind->second;
+    }
+    //没有发送密钥返回NULL
+    const PacketKey* SendKey(uint32_t* keyid) const {
+        if (!hassendkey_) {
+            return NULL;
+        }
+        *keyid = sendkeyid_;
+        return Find(sendkeyid_);
+    }
+private:
+    std::map<uint32_t, PacketKey> keys_;
+    uint32_t sendkeyid_;
+    bool hassendkey_;
+};
+
+//发送端的加密. 各PacketSealer的nonce基数随机，同一密钥可用于任意多个连接而nonce不重复
+class PacketSealer
+{
+public:
+    PacketSealer(): noncebaseok_(false), counter_(0) {
+        noncebaseok_ = RAND_bytes(noncebase_, sizeof(noncebase_)) == 1;
+    }
+    //在发送之前调用，之后只读. 空的keyring关闭加密
+    void SetKeyring(const PacketKeyring& keyring) {
+        keyring_ = keyring;
+    }
+    const PacketKeyring& GetKeyring() const {
+        return keyring_;
+    }
+    bool IsEnabled() const {
+        uint32_t keyid;
+        return keyring_.SendKey(&keyid) != NULL;
+    }
+    /*****************************
+    * @brief   用发送密钥加密包数据，在PacketCompress之后、PacketData/PacketGather之前调用
+    * @param   packet --datalen须已赋值. 加密时校验方式设为密钥的算法，datalen改为含前缀的长度，check为认证标签
+               data   --包数据(可能已压缩)
+               out    --加密后的包数据存放处，可重复使用以免每帧申请内存
+    * @return  要发送的包数据: 加密了为out中的数据；没有发送密钥为data，packet不变；加密失败为NULL
+    ******************************/
+    const unsigned char* Seal(NetPacket& packet, const unsigned char* data, std::string& out) {
+        uint32_t keyid = 0;
+        const PacketKey* key = keyring_.SendKey(&keyid);
+        if (!key) {
+            return data;
+        }
+        if (!noncebaseok_ || packet.datalen < 0 || (packet.datalen > 0 && !data)) {
+            return NULL;
+        }
+        static thread_local PacketAEADImpl::CipherCtx ctx;//每个发送线程一个
+        out.resize(PACKET_AEAD_PREFIX + packet.datalen);
+        unsigned char* prefix = (unsigned char*)&out[0];
+        StoreLE32(keyid, prefix);
+        unsigned char* nonce = prefix + 4;
+        memcpy(nonce, noncebase_, PACKET_AEAD_NONCELEN);
+        uint64_t counter = counter_.fetch_add(1, std::memory_order_relaxed);
+        for (int i = 0; i < 8; ++i) {//计数器大端异或到nonce的后8字节
+            nonce[PACKET_AEAD_NONCELEN - 1 - i] ^= (unsigned char)(counter >> (8 * i));
+        }
+        SetNetPacketCheckType(packet, key->checktype);
+        unsigned char aad[PACKET_AEAD_AADLEN];
+        PacketAEADImpl::BuildAAD(packet, prefix, aad);
+        if (!ctx.Begin(*key, nonce, 1, aad) || !ctx.Update(data, packet.datalen, prefix + PACKET_AEAD_PREFIX)
+                || !ctx.SealFinal(packet.check)) {
+            return NULL;
+        }
+        packet.datalen += PACKET_AEAD_PREFIX;
+        return (const unsigned char*)out.data();
+    }
+private:
+    PacketKeyring keyring_;
+    unsigned char noncebase_[PACKET_AEAD_NONCELEN];
+    bool noncebaseok_;
+    std::atomic<uint64_t> counter_;
+private:// no copy
+    PacketSealer(const PacketSealer&);
+    PacketSealer& operator = (const PacketSealer&);
+};
+
+//分段解密时每解密出一段回调一次. offset为本段在明文中的偏移
+typedef void (*OpenOutCB)(const unsigned char* out, int outlen, int offset, void* userdata);
+
+//一个连接的解密器: 整帧解密用Open，分段接收的大包用StreamBegin/StreamChunk/StreamEnd
+class PacketOpener
+{
+public:
+    PacketOpener(): keyring_(NULL), plainlen_(0), produced_(0), prefixlen_(0), streamok_(false) {
+    }
+    //keyring由调用者保持有效. NULL不解密
+    void SetKeyring(const PacketKeyring* keyring) {
+        keyring_ = keyring;
+    }
+    const PacketKeyring* GetKeyring() const {
+        return keyring_;
+    }
+    //整帧解密. 成功返回明文(在内部缓冲区，下一次解密前有效)，*plainlen为明文长度；密钥未知或认证失败返回NULL
+    const unsigned char* Open(const NetPacket& packet, const unsigned char* data, int* plainlen) {
+        if (packet.datalen < PACKET_AEAD_PREFIX) {
+            return NULL;
+        }
+        const PacketKey* key = findkey(packet, data);
+        if (!key) {
+            return NULL;
+        }
+        int len = packet.datalen - PACKET_AEAD_PREFIX;
+        if (out_.size() < (size_t)len + 1) {//多1字节，明文长为0时也有合法的地址
+            out_.resize(len + 1);
+        }
+        unsigned char aad[PACKET_AEAD_AADLEN];
+        PacketAEADImpl::BuildAAD(packet, data, aad);
+        if (!ctx_.Begin(*key, data + 4, 0, aad) || !ctx_.Update(data + PACKET_AEAD_PREFIX, len, (unsigned char*)&out_[0])
+                || !ctx_.OpenFinal(packet.check)) {
+            return NULL;
+        }
+        *plainlen = len;
+        return (const unsigned char*)out_.data();
+    }
+
+    //开始分段解密一帧
+    void StreamBegin(const NetPacket& packet) {
+        head_ = packet;
+        plainlen_ = (std::max)(packet.datalen - PACKET_AEAD_PREFIX, 0);
+        produced_ = 0;
+        prefixlen_ = 0;
+        streamok_ = keyring_ && packet.datalen >= PACKET_AEAD_PREFIX;
+    }
+    //输入一段密文，解密出的明文按PACKET_AEAD_CHUNK分段回调. 明文在StreamEnd之前未经认证
+    //数据不合法后返回false，之后的输入都忽略
+    bool StreamChunk(const unsigned char* chunk, int chunklen, OpenOutCB cb, void* userdata) {
+        if (!streamok_) {
+            return false;
+        }
+        while (prefixlen_ < PACKET_AEAD_PREFIX && chunklen > 0) {//前缀可能被分在两段中
+            prefix_[prefixlen_++] = *chunk++;
+            --chunklen;
+            if (PACKET_AEAD_PREFIX == prefixlen_) {
+                const PacketKey* key = findkey(head_, prefix_);
+                unsigned char aad[PACKET_AEAD_AADLEN];
+                PacketAEADImpl::BuildAAD(head_, prefix_, aad);
+                if (!key || !ctx_.Begin(*key, prefix_ + 4, 0, aad)) {
+                    return streamok_ = false;
+                }
+            }
+        }
+        if (chunklen > 0 && out_.size() < PACKET_AEAD_CHUNK) {
+            out_.resize(PACKET_AEAD_CHUNK);
+        }
+        while (chunklen > 0) {
+            int inlen = (std::min)(chunklen, PACKET_AEAD_CHUNK);
+            if (produced_ + inlen > plainlen_ || !ctx_.Update(chunk, inlen, (unsigned char*)&out_[0])) {
+                return streamok_ = false;
+            }
+            cb((const unsigned char*)out_.data(), inlen, produced_, userdata);
+            produced_ += inlen;
+            chunk += inlen;
+            chunklen -= inlen;
+        }
+        return true;
+    }
+    //密文全部输入后调用，长度完整且认证标签一致返回true
+    bool StreamEnd() {
+        return streamok_ && PACKET_AEAD_PREFIX == prefixlen_ && produced_ == plainlen_ && ctx_.OpenFinal(head_.check);
+    }
+    int PlainLen() const {
+        return plainlen_;
+    }
+    int Produced() const {
+        return produced_;
+    }
+
+private:
+    //前缀中的密钥id须在keyring中，且算法与帧头的校验方式一致
+    const PacketKey* findkey(const NetPacket& packet, const unsigned char* prefix) const {
+        if (!keyring_) {
+            return NULL;
+        }
+        const PacketKey* key = keyring_->Find(LoadLE32(prefix));
+        return (key && key->checktype == GetNetPacketCheckType(packet)) ? key : NULL;
+    }
+    const PacketKeyring* keyring_;
+    PacketAEADImpl::CipherCtx ctx_;
+    std::string out_;//明文输出，一个连接重复使用
+    NetPacket head_;//分段解密的帧头
+    int plainlen_;//分段解密的明文长
+    int produced_;//分段解密已输出的长度
+    unsigned char prefix_[PACKET_AEAD_PREFIX];
+    int prefixlen_;
+    bool streamok_;
+private:// no copy
+    PacketOpener(const PacketOpener&);
+    PacketOpener& operator = (const PacketOpener&);
+};
+
+#endif//PACKET_AEAD_H
@@ -0,0 +1,320 @@
+﻿/***************************************
+* @file     packet_check.h
+* @brief    包数据校验码: MD5(兼容旧版本)、CRC32C、XXH64或不校验，由NetPacket.version的8-11位指定
+* @details  PacketCheck: 支持增量计算(Init/Update/Final)，结果写入NetPacket.check的16字节
+            包数据长度为0时各方式的check都为全0(与旧版本md5的处理一致)
+            MD5  : 16字节md5，使用openssl函数
+            CRC32C: check[0-3]为大端的crc32c，其余为0。CPU支持SSE4.2时用crc32指令，否则查表
+            XXH64: check[0-7]为大端的xxhash64(seed为0)，其余为0
+            NONE : 全0，用于可信链路
+* @author   phata, wqvbjhc@gmail.com
+* @date     2026-10-19
+****************************************/
+#ifndef PACKET_CHECK_H
+#define PACKET_CHECK_H
+#include <stdint.h>
+#include <string.h>
+#include <openssl/md5.h>
+#include "net/net_base.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <nmmintrin.h>
+#define PACKET_CHECK_HAS_SSE42 1
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define PACKET_CHECK_HAS_SSE42 1
+#endif
+
+#if defined(PACKET_CHECK_HAS_SSE42) && (defined(__GNUC__) || defined(__clang__))
+#define PACKET_CHECK_TARGET_SSE42 __attribute__((target("sse4.2")))
+#else
+#define PACKET_CHECK_TARGET_SSE42
+#endif
+
+/*****************************************CRC32C*************************************************************/
+namespace PacketCheckImpl
+{
+typedef struct _crc32c_table {
+    uint32_t table[256];
+    _crc32c_table() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; ++j) {
+                crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+            }
+            table[i] = crc;
+        }
+    }
+} CRC32CTable;
+
+//查表计算，crc为未取反的中间值
+inline uint32_t CRC32CSoft(uint32_t crc, const unsigned char* data, size_t len)
+{
+    static const CRC32CTable crctable;//c++11起局部静态变量的初始化是线程安全的
+    const uint32_t* table = crctable.table;
+    for (size_t i = 0; i < len; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef PACKET_CHECK_HAS_SSE42
+PACKET_CHECK_TARGET_SSE42 inline uint32_t CRC32CHard(uint32_t crc, const unsigned char* data, size_t len)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for (; len >= 4; len -= 4, data += 4) {
+        uint32_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; len > 0; --len, ++data) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+
+inline bool HasSSE42()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2) != 0;
+#endif
+}
+#endif
+
+inline uint32_t CRC32CUpdate(uint32_t crc, const unsigned char* data, size_t len)
+{
+#ifdef PACKET_CHECK_HAS_SSE42
+    static const bool hassse42 = HasSSE42();
+    if (hassse42) {
+        return CRC32CHard(crc, data, len);
+    }
+#endif
+    return CRC32CSoft(crc, data, len);
+}
+
+/*****************************************XXH64*************************************************************/
+static const uint64_t XXH_PRIME64_1 = 11400714785074694791ULL;
+static const uint64_t XXH_PRIME64_2 = 14029467366897019727ULL;
+static const uint64_t XXH_PRIME64_3 = 1609587929392839161ULL;
+static const uint64_t XXH_PRIME64_4 = 9650029242287828579ULL;
+static const uint64_t XXH_PRIME64_5 = 2870177450012600261ULL;
+
+inline uint64_t XXHRotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+inline uint64_t XXHRead64(const unsigned char* p)//小端读取
+{
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+           | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+inline uint32_t XXHRead32(const unsigned char* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+inline uint64_t XXHRound(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = XXHRotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+inline uint64_t XXHMergeRound(uint64_t acc, uint64_t val)
+{
+    acc ^= XXHRound(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+typedef struct _xxh64_state {
+    uint64_t v[4];
+    uint64_t totallen;
+    unsigned char mem[32];//不足32字节的数据
+    size_t memsize;
+} XXH64State;
+
+inline void XXH64Init(XXH64State& state)
+{
+    state.v[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+    state.v[1] = XXH_PRIME64_2;
+    state.v[2] = 0;
+    state.v[3] = 0 - XXH_PRIME64_1;
+    state.totallen = 0;
+    state.memsize = 0;
+}
+
+inline void XXH64Update(XXH64State& state, const unsigned char* data, size_t len)
+{
+    state.totallen += len;
+    if (state.memsize + len < 32) {
+        memcpy(state.mem + state.memsize, data, len);
+        state.memsize += len;
+        return;
+    }
+    if (state.memsize > 0) {//先补齐上次剩下的32字节
+        size_t filllen = 32 - state.memsize;
+        memcpy(state.mem + state.memsize, data, filllen);
+        for (int i = 0; i < 4; ++i) {
+            state.v[i] = XXHRound(state.v[i], XXHRead64(state.mem + i * 8));
+        }
+        data += filllen;
+        len -= filllen;
+        state.memsize = 0;
+    }
+    uint64_t v1 = state.v[0], v2 = state.v[1], v3 = state.v[2], v4 = state.v[3];
+    for (; len >= 32; len -= 32, data += 32) {
+        v1 = XXHRound(v1, XXHRead64(data));
+        v2 = XXHRound(v2, XXHRead64(data + 8));
+        v3 = XXHRound(v3, XXHRead64(data + 16));
+        v4 = XXHRound(v4, XXHRead64(data + 24));
+    }
+    state.v[0] = v1;
+    state.v[1] = v2;
+    state.v[2] = v3;
+    state.v[3] = v4;
+    memcpy(state.mem, data, len);
+    state.memsize = len;
+}
+
+inline uint64_t XXH64Final(const XXH64State& state)
+{
+    uint64_t h;
+    if (state.totallen >= 32) {
+        h = XXHRotl64(state.v[0], 1) + XXHRotl64(state.v[1], 7) + XXHRotl64(state.v[2], 12) + XXHRotl64(state.v[3], 18);
+        for (int i = 0; i < 4; ++i) {
+            h = XXHMergeRound(h, state.v[i]);
+        }
+    } else {
+        h = state.v[2] + XXH_PRIME64_5;//v[2]即seed
+    }
+    h += state.totallen;
+    const unsigned char* p = state.mem;
+    size_t len = state.memsize;
+    for (; len >= 8; len -= 8, p += 8) {
+        h ^= XXHRound(0, XXHRead64(p));
+        h = XXHRotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (len >= 4) {
+        h ^= (uint64_t)XXHRead32(p) * XXH_PRIME64_1;
+        h = XXHRotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        len -= 4;
+        p += 4;
+    }
+    for (; len > 0; --len, ++p) {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = XXHRotl64(h, 11) * XXH_PRIME64_1;
+    }
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+}//namespace PacketCheckImpl
+
+/*****************************************PacketCheck*************************************************************/
+class PacketCheck
+{
+public:
+    explicit PacketCheck(int checktype = NET_CHECK_MD5) {
+        Init(checktype);
+    }
+
+    static bool IsValid(int checktype) {
+        return checktype >= NET_CHECK_MD5 && checktype <= NET_CHECK_NONE;
+    }
+
+    void Init(int checktype) {
+        checktype_ = checktype;
+        len_ = 0;
+        switch (checktype_) {
+        case NET_CHECK_MD5:
+            MD5_Init(&md5_);
+            break;
+        case NET_CHECK_CRC32C:
+            crc_ = 0xFFFFFFFF;
+            break;
+        case NET_CHECK_XXH64:
+            PacketCheckImpl::XXH64Init(xxh64_);
+            break;
+        default:
+            break;
+        }
+    }
+    void Update(const unsigned char* data, size_t len) {
+        len_ += len;
+        switch (checktype_) {
+        case NET_CHECK_MD5:
+            MD5_Update(&md5_, data, len);
+            break;
+        case NET_CHECK_CRC32C:
+            crc_ = PacketCheckImpl::CRC32CUpdate(crc_, data, len);
+            break;
+        case NET_CHECK_XXH64:
+            PacketCheckImpl::XXH64Update(xxh64_, data, len);
+            break;
+        default:
+            break;
+        }
+    }
+    //结果写入check[16]
+    void Final(unsigned char* check) {
+        memset(check, 0, 16);
+        if (0 == len_) {//长度为0的md5为：d41d8cd98f00b204e9800998ecf8427e，改为全0. 其他方式同样处理
+            return;
+        }
+        switch (checktype_) {
+        case NET_CHECK_MD5:
+            MD5_Final(check, &md5_);
+            break;
+        case NET_CHECK_CRC32C:
+            storebigendian(crc_ ^ 0xFFFFFFFF, check, 4);
+            break;
+        case NET_CHECK_XXH64:
+            storebigendian(PacketCheckImpl::XXH64Final(xxh64_), check, 8);
+            break;
+        default:
+            break;
+        }
+    }
+
+    //一次计算data的校验码
+    static void Calc(int checktype, const unsigned char* data, size_t len, unsigned char* check) {
+        if (NET_CHECK_NONE == checktype || 0 == len || NULL == data) {
+            memset(check, 0, 16);
+            return;
+        }
+        PacketCheck packetcheck(checktype);
+        packetcheck.Update(data, len);
+        packetcheck.Final(check);
+    }
+
+private:
+    //与主机字节序无关，固定大端(Int32ToChar的结果依赖主机字节序)
+    static void storebigendian(uint64_t value, unsigned char* buf, int len) {
+        for (int i = len - 1; i >= 0; --i, value >>= 8) {
+            buf[i] = (unsigned char)(value & 0xFF);
+        }
+    }
+
+    int checktype_;
+    size_t len_;
+    MD5_CTX md5_;
+    uint32_t crc_;
+    PacketCheckImpl::XXH64State xxh64_;
+};
+
+#endif//PACKET_CHECK_H
@@ -0,0 +1,296 @@
+﻿/***************************************
+* @file     packet_compress.h
+* @brief    包数据压缩: 可选的zlib压缩，由NetPacket.version的12-15位标记(见net_base.h)
+* @details  发送: PacketCompress在包数据不小于阈值且压缩后变小时，把包数据换为[4字节小端原长][deflate数据]，
+                   并设置压缩方式与datalen. 校验码之后由PacketData/PacketGather对压缩后的数据计算，接收端校验不用解压
+            接收: PacketInflater整帧或分段解压. 输出缓冲区与z_stream属于一个连接(PacketSync)，重复使用，不按帧申请
+                   原长超过最大帧长的帧视为不合法，防止解压炸弹. 整帧解压的输出缓冲区随解压出的数据增长，
+                   不按对端声称的原长预先申请；超过PACKET_INFLATE_KEEP的在该帧回调后由Trim释放，不被一个大帧长期占用
+            需定义NET_WITH_ZLIB并链接zlib(CMake选项NET_WITH_ZLIB). 未定义时PacketCompress不压缩，收到的压缩帧被丢弃
+* @author   phata, wqvbjhc@gmail.com
+* @date     2026-10-19
+****************************************/
+#ifndef PACKET_COMPRESS_H
+#define PACKET_COMPRESS_H
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include "net/net_base.h"
+#ifdef NET_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#define PACKET_COMPRESS_PREFIX 4//压缩包数据开头的原长
+#define PACKET_INFLATE_CHUNK (64 * 1024)//分段解压时每段输出的最大长度，也是整帧解压输出缓冲区的初始长度
+#define PACKET_INFLATE_KEEP (1024 * 1024)//帧之间保留的解压输出缓冲区的最大长度
+
+#ifdef NET_WITH_ZLIB
+//deflate的z_stream，每个发送线程一个(见PacketCompress)，只在第一次或压缩级别变化时初始化
+class PacketDeflater
+{
+public:
+    PacketDeflater(): inited_(false), level_(0) {
+        memset(&zs_, 0, sizeof(zs_));
+    }
+    ~PacketDeflater() {
+        if (inited_) {
+            deflateEnd(&zs_);
+        }
+    }
+    //data压缩到out(含原长)，返回压缩后的总长，失败返回0
+    size_t Compress(const unsigned char* data, size_t len, int level, std::string& out) {
+        if (inited_ && level != level_) {
+            deflateEnd(&zs_);
+            inited_ = false;
+        }
+        if (!inited_) {
+            memset(&zs_, 0, sizeof(zs_));
+            if (deflateInit(&zs_, level) != Z_OK) {
+                return 0;
+            }
+            inited_ = true;
+            level_ = level;
+        } else {
+            deflateReset(&zs_);
+        }
+        out.resize(PACKET_COMPRESS_PREFIX + deflateBound(&zs_, (uLong)len));
+        StoreLE32((uint32_t)len, (unsigned char*)&out[0]);
+        zs_.next_in = (Bytef*)data;
+        zs_.avail_in = (uInt)len;
+        zs_.next_out = (Bytef*)&out[PACKET_COMPRESS_PREFIX];
+        zs_.avail_out = (uInt)(out.size() - PACKET_COMPRESS_PREFIX);
+        if (deflate(&zs_, Z_FINISH) != Z_STREAM_END) {
+            return 0;
+        }
+        out.resize(PACKET_COMPRESS_PREFIX + zs_.total_out);
+        return out.size();
+    }
+private:
+    z_stream zs_;
+    bool inited_;
+    int level_;
+private:// no copy
+    PacketDeflater(const PacketDeflater&);
+    PacketDeflater& operator = (const PacketDeflater&);
+};
+#endif
+
+/*****************************
+* @brief   按阈值压缩包数据，在PacketData/PacketGather之前调用
+* @param   packet    --datalen须已赋值. 压缩时设置压缩方式为NET_COMPRESS_ZLIB，datalen改为压缩后的长度
+           data      --原包数据
+           threshold --datalen不小于threshold时才压缩，<=0不压缩
+           level     --zlib压缩级别1-9，-1为默认(6)
+           out       --压缩后的包数据存放处，可重复使用以免每帧申请内存
+* @return  要发送的包数据: 压缩了为out中的数据，否则(未达阈值、没有变小、不支持)为data，packet不变
+******************************/
+inline const unsigned char* PacketCompress(NetPacket& packet, const unsigned char* data, int threshold, int level, std::string& out)
+{
+#ifdef NET_WITH_ZLIB
+    if (threshold <= 0 || packet.datalen < threshold || !data) {
+        return data;
+    }
+    static thread_local PacketDeflater deflater;
+    size_t len = deflater.Compress(data, packet.datalen, level, out);
+    if (0 == len || len >= (size_t)packet.datalen) {
+        return data;
+    }
+    packet.datalen = (int32_t)len;
+    SetNetPacketCompressType(packet, NET_COMPRESS_ZLIB);
+    return (const unsigned char*)out.data();
+#else
+    (void)packet;
+    (void)threshold;
+    (void)level;
+    (void)out;
+    return data;
+#endif
+}
+
+//分段解压时每解压出一段回调一次. offset为本段在原数据中的偏移
+typedef void (*InflateOutCB)(const unsigned char* out, int outlen, int offset, void* userdata);
+
+//一个连接的解压器: 整帧解压用Inflate，分段接收的大包用StreamBegin/StreamChunk/StreamEnd
+class PacketInflater
+{
+public:
+    PacketInflater(): inited_(false), maxlen_(0), rawlen_(0), produced_(0), prefixlen_(0), streamok_(false), streamend_(false) {
+#ifdef NET_WITH_ZLIB
+        memset(&zs_, 0, sizeof(zs_));
+#endif
+    }
+    ~PacketInflater() {
+#ifdef NET_WITH_ZLIB
+        if (inited_) {
+            inflateEnd(&zs_);
+        }
+#endif
+    }
+    static bool IsSupported(int compresstype) {
+#ifdef NET_WITH_ZLIB
+        return NET_COMPRESS_ZLIB == compresstype;
+#else
+        (void)compresstype;
+        return false;
+#endif
+    }
+    //整帧解压. 成功返回原数据(在内部缓冲区，下一次解压前有效)，*rawlen为原长；失败返回NULL
+    const unsigned char* Inflate(const unsigned char* data, int datalen, int maxlen, int* rawlen) {
+#ifdef NET_WITH_ZLIB
+        if (datalen < PACKET_COMPRESS_PREFIX || !reset()) {
+            return NULL;
+        }
+        uint32_t len = LoadLE32(data);
+        if (len > (uint32_t)maxlen) {
+            return NULL;
+        }
+        //输出缓冲区从PACKET_INFLATE_CHUNK开始，写满再加倍，最多到原长. 多1字节，原长为0时也有合法的地址
+        size_t outsize = (std::min)((size_t)len, (size_t)PACKET_INFLATE_CHUNK) + 1;
+        if (out_.size() < outsize) {
+            out_.resize(outsize);
+        }
+        zs_.next_in = (Bytef*)data + PACKET_COMPRESS_PREFIX;
+        zs_.avail_in = (uInt)(datalen - PACKET_COMPRESS_PREFIX);
+        int ret = Z_OK;
+        while (true) {
+            size_t produced = zs_.total_out;
+            zs_.next_out = (Bytef*)&out_[produced];
+            zs_.avail_out = (uInt)((std::min)(out_.size() - 1, (size_t)len) - produced);
+            ret = inflate(&zs_, Z_FINISH);
+            if ((ret != Z_OK && ret != Z_BUF_ERROR) || zs_.avail_out > 0 || zs_.total_out >= len) {//结束、出错或输入已用完
+                break;
+            }
+            out_.resize((std::min)(out_.size() * 2, (size_t)len + 1));
+        }
+        if (ret != Z_STREAM_END || zs_.total_out != len || zs_.avail_in != 0) {
+            return NULL;
+        }
+        *rawlen = (int)len;
+        return (const unsigned char*)out_.data();
+#else
+        (void)data;
+        (void)datalen;
+        (void)maxlen;
+        (void)rawlen;
+        return NULL;
+#endif
+    }
+
+    //释放超过PACKET_INFLATE_KEEP的输出缓冲区. Inflate返回的数据用完后调用
+    void Trim() {
+        if (out_.capacity() > PACKET_INFLATE_KEEP) {
+            std::string().swap(out_);
+        }
+    }
+
+    //开始分段解压一帧. maxlen为允许的最大原长
+    void StreamBegin(int maxlen) {
+        maxlen_ = maxlen;
+        rawlen_ = 0;
+        produced_ = 0;
+        prefixlen_ = 0;
+        streamend_ = false;
+        streamok_ = reset();
+    }
+    //输入一段压缩数据，解压出的数据按PACKET_INFLATE_CHUNK分段回调. 数据不合法后返回false，之后的输入都忽略
+    bool StreamChunk(const unsigned char* chunk, int chunklen, InflateOutCB cb, void* userdata) {
+#ifdef NET_WITH_ZLIB
+        if (!streamok_) {
+            return false;
+        }
+        while (prefixlen_ < PACKET_COMPRESS_PREFIX && chunklen > 0) {//原长可能被分在两段中
+            prefix_[prefixlen_++] = *chunk++;
+            --chunklen;
+            if (PACKET_COMPRESS_PREFIX == prefixlen_) {
+                uint32_t len = LoadLE32(prefix_);
+                if (len > (uint32_t)maxlen_) {
+                    return streamok_ = false;
+                }
+                rawlen_ = (int)len;
+            }
+        }
+        if (chunklen <= 0) {
+            return true;
+        }
+        if (out_.size() < PACKET_INFLATE_CHUNK) {
+            out_.resize(PACKET_INFLATE_CHUNK);
+        }
+        zs_.next_in = (Bytef*)chunk;
+        zs_.avail_in = (uInt)chunklen;
+        while (zs_.avail_in > 0) {
+            zs_.next_out = (Bytef*)&out_[0];
+            zs_.avail_out = PACKET_INFLATE_CHUNK;
+            int ret = inflate(&zs_, Z_NO_FLUSH);
+            int outlen = PACKET_INFLATE_CHUNK - (int)zs_.avail_out;
+            if ((ret != Z_OK && ret != Z_STREAM_END) || produced_ + outlen > rawlen_
+                    || (Z_STREAM_END == ret && zs_.avail_in > 0)) {//出错、超过原长或压缩数据之后还有数据
+                return streamok_ = false;
+            }
+            if (outlen > 0) {
+                cb((const unsigned char*)out_.data(), outlen, produced_, userdata);
+                produced_ += outlen;
+            }
+            if (Z_STREAM_END == ret) {
+                streamend_ = true;
+                break;
+            }
+        }
+        return true;
+#else
+        (void)chunk;
+        (void)chunklen;
+        (void)cb;
+        (void)userdata;
+        return false;
+#endif
+    }
+    //压缩数据全部输入后调用，解压完整且长度等于原长返回true
+    bool StreamEnd() {
+#ifdef NET_WITH_ZLIB
+        return streamok_ && streamend_ && produced_ == rawlen_;
+#else
+        return false;
+#endif
+    }
+    int RawLen() const {
+        return rawlen_;
+    }
+    int Produced() const {
+        return produced_;
+    }
+
+private:
+#ifdef NET_WITH_ZLIB
+    bool reset() {
+        if (!inited_) {
+            memset(&zs_, 0, sizeof(zs_));
+            if (inflateInit(&zs_) != Z_OK) {
+                return false;
+            }
+            inited_ = true;
+            return true;
+        }
+        return inflateReset(&zs_) == Z_OK;
+    }
+    z_stream zs_;
+#else
+    bool reset() {
+        return false;
+    }
+#endif
+    bool inited_;
+    std::string out_;//解压输出，一个连接重复使用
+    int maxlen_;
+    int rawlen_;//分段解压的原长
+    int produced_;//分段解压已输出的长度
+    unsigned char prefix_[PACKET_COMPRESS_PREFIX];
+    int prefixlen_;
+    bool streamok_;
+    bool streamend_;//已解压到压缩数据的结尾
+private:// no copy
+    PacketInflater(const PacketInflater&);
+    PacketInflater& operator = (const PacketInflater&);
+};
+
+#endif//PACKET_COMPRESS_H
@@ -1,9 +1,15 @@
 ﻿/***************************************
 * @file     packet_sync.h
 * @brief    TCP 数据包封装.依赖libuv,openssl.功能：接收数据，解析得到一帧后回调给用户。同步处理，接收到马上解析
-* @details  根据net_base.h中NetPacket的定义，对数据包进行封装。
-			md5校验码使用openssl函数
-			同一线程中实时解码
+* @details  根据net_base.h中NetPacket的定义，对数据包进行封装。PacketSync为BasicFramer(basic_framer.h)的NetPacket实例
+			校验码按NetPacket.version的8-11位计算(见packet_check.h)，默认md5，使用openssl函数
+			同一线程中实时解码. 完整在接收数据中的帧直接回调其指针，不拷贝；只缓存跨越两次接收的帧
+			一次recvdata解析出的多个md5帧先收集起来，用多路SIMD md5(md5_multi.h)一起校验，再按顺序回调
+			跨越多次接收的帧，每收到一段包数据就更新校验码，收到包尾时只需比较结果
+			重新同步: memchr查找包头，帧头合法而包尾/校验码错误时跳过整帧，垃圾数据上耗时与数据量成线性. 错误信息限速输出
+			帧格式由version的0-7位选择: v1为34字节的NetPacket加包尾，v2为8-28字节的对齐帧头、无包尾(见net_base.h). 接收端两种都解析
+			version的12-15位为压缩方式: 校验码针对压缩后的数据，校验通过后才解压，回调给用户的是原数据(datalen为原长，压缩方式为不压缩)
+			校验方式为AEAD时先解密，认证标签代替校验码，回调给用户的是明文(datalen为明文长，校验方式为不校验)
 			长度为0的md5为：d41d8cd98f00b204e9800998ecf8427e，改为全0. 编解码时修改。
 //调用方法
 Packet packet;
@@ -15,12 +21,27 @@ packet.Start(0x01,0x02);
 * @date     2014-05-21
 * @mod      2014-08-04 phata 修复解析一帧数据有误的bug
             2014-11-12 phata GetUVError冲突，改为使用thread_uv.h中的
+            2026-10-19 phata 单次拷贝解析: 帧在接收缓冲区内原地解码，去掉thread_packetdata与每帧的memmove
+            2026-10-19 phata 校验方式可选: MD5/CRC32C/XXH64/不校验
+            2026-10-19 phata md5帧成批校验(AVX2/AVX-512多路md5)
+            2026-10-19 phata 缓存的帧边接收边计算校验码
+            2026-10-19 phata 线性时间的重新同步，解析错误信息限速
+            2026-10-19 phata 解析逻辑移到BasicFramer模板，PacketSync改为NetPacket格式的策略实例
+            2026-10-19 phata 支持紧凑的v2帧格式(net_base.h)，由NetPacket.version选择，与v1帧可混合收发
+            2026-10-19 phata 新增PacketGather: 只编码帧头与包尾，包数据以uv_buf_t引用，配合聚集发送少一次拷贝
+            2026-10-19 phata 压缩的帧(packet_compress.h)校验通过后解压再回调，解压缓冲区每个PacketSync一个
+            2026-10-19 phata AEAD加密的帧(packet_aead.h)解密并认证后再解压、回调. 设置密钥后只接受加密的帧
+            2026-10-19 phata 分段接收的AEAD帧缓存明文，认证通过后才解压、分段回调
 ****************************************/
 #ifndef PACKET_SYNC_H
 #define PACKET_SYNC_H
-#include <algorithm>
 #include <openssl/md5.h>
 #include "net/net_base.h"
+#include "net/packet_check.h"
+#include "net/md5_multi.h"
+#include "net/basic_framer.h"
+#include "net/packet_compress.h"
+#include "net/packet_aead.h"
 #include "sys/thread_uv.h"//for GetUVError
 #if defined (WIN32) || defined(_WIN32)
 #include <windows.h>
@@ -39,217 +60,342 @@ packet.Start(0x01,0x02);
 #endif
 typedef void (*GetFullPacket)(const NetPacket& packethead, const unsigned char* packetdata, void* userdata);
 
-#ifndef BUFFER_SIZE
-#define BUFFER_SIZE (1024*10)
-#endif
+//大包分段回调.chunk为本段包数据，offset为本段在包数据中的偏移，chunktype见PACKET_CHUNK_TYPE(basic_framer.h)
+typedef void (*GetPacketChunk)(const NetPacket& packethead, const unsigned char* chunk, int chunklen, int offset, int chunktype, void* userdata);
 
-class PacketSync
+//NetPacket帧头: v1为34字节定长，header/tail字段须与包头包尾相同；v2为变长的紧凑帧头，没有包尾. 字段见net_base.h
+//包头后的第一个字节为0x02时按v2解析，否则按v1解析
+class NetPacketHeader
 {
 public:
-    PacketSync(): packet_cb_(NULL), packetcb_userdata_(NULL) {
-        thread_readdata = uv_buf_init((char*)malloc(BUFFER_SIZE), BUFFER_SIZE); //负责从circulebuffer_读取数据
-        thread_packetdata = uv_buf_init((char*)malloc(BUFFER_SIZE), BUFFER_SIZE); //负责从circulebuffer_读取packet 中data部分
-        truepacketlen = 0;//readdata有效数据长度
-        headpos = -1;//找到头位置
-        headpt = NULL;//找到头位置
-        parsetype = PARSE_NOTHING;
-        getdatalen = 0;
+    typedef NetPacket Header;
+    enum { MAX_HEADLEN = NET_PACKAGE_HEADLEN };
+    NetPacketHeader(): head_(0), tail_(0) {}
+    void SetMarkers(unsigned char head, unsigned char tail) {
+        head_ = head;
+        tail_ = tail;
     }
-    virtual ~PacketSync() {
-        free(thread_readdata.base);
-        free(thread_packetdata.base);
+    int Parse(const unsigned char* data, int len, NetPacket& packet) const {
+        if (len > 0 && NET_PACKAGE_VERSION_V2 == data[0]) {
+            int ret = CharToNetPacketV2(data, len, packet);
+            if (ret <= 0) {
+                return ret;
+            }
+            if (packet.datalen < 0) {
+                return -1;
+            }
+            packet.header = head_;
+            packet.tail = tail_;
+            return ret;
+        }
+        if (len < (int)NET_PACKAGE_HEADLEN) {
+            return 0;
+        }
+        CharToNetPacket(data, packet);
+        if (packet.header != head_ || packet.tail != tail_ || packet.datalen < 0) {//帧头数据不合法(帧长允许为0)
+            return -1;
+        }
+        return NET_PACKAGE_HEADLEN;
     }
+    static int DataLen(const NetPacket& packet) {
+        return packet.datalen;
+    }
+    static bool HasTail(const NetPacket& packet) {
+        return GetNetPacketFormat(packet) != NET_PACKAGE_VERSION_V2;
+    }
+private:
+    unsigned char head_;
+    unsigned char tail_;
+};
 
-    bool Start(char packhead, char packtail) {
-        HEAD = packhead;
-        TAIL = packtail;
-        return true;
+//NetPacket的校验: 方式由version的8-11位指定(PacketCheck)，结果与check比较
+//md5帧可成批校验: 一次recvdata解析出的多个md5帧用多路SIMD md5(md5_multi.h)一起计算
+//AEAD帧在这里不校验，由PacketSync解密时认证
+struct NetPacketChecksum {
+    enum { BATCH_MAX = MD5_MULTI_MAX_LANES };
+    typedef PacketCheck State;
+    static bool Accept(const NetPacket& packet) {
+        int checktype = GetNetPacketCheckType(packet);
+        return PacketCheck::IsValid(checktype) || NetCheckIsAEAD(checktype);
+    }
+    static void Init(State& state, const NetPacket& packet) {
+        state.Init(GetNetPacketCheckType(packet));
+    }
+    static void Update(State& state, const unsigned char* data, size_t len) {
+        state.Update(data, len);
     }
+    static bool Final(State& state, const NetPacket& packet) {
+        if (NetCheckIsAEAD(GetNetPacketCheckType(packet))) {
+            return true;
+        }
+        unsigned char checkstr[16];//与NetPacket.check同长
+        state.Final(checkstr);
+        return memcmp(packet.check, checkstr, sizeof(checkstr)) == 0;
+    }
+    static bool Verify(const NetPacket& packet, const unsigned char* packetdata) {
+        if (NetCheckIsAEAD(GetNetPacketCheckType(packet))) {
+            return true;
+        }
+        unsigned char checkstr[16];
+        PacketCheck::Calc(GetNetPacketCheckType(packet), packetdata, packet.datalen, checkstr);
+        return memcmp(packet.check, checkstr, sizeof(checkstr)) == 0;
+    }
+    static int BatchLanes() {
+        return MD5MultiLanes();
+    }
+    static bool Batchable(const NetPacket& packet) {//长度为0的md5为全0，不必计算
+        return packet.datalen > 0 && NET_CHECK_MD5 == GetNetPacketCheckType(packet);
+    }
+    static void VerifyBatch(const NetPacket* const* packets, const unsigned char* const* packetdatas, bool* checkok, int count) {
+        MD5Job jobs[BATCH_MAX];
+        unsigned char digests[BATCH_MAX][16];
+        for (int i = 0; i < count; ++i) {
+            jobs[i].data = packetdatas[i];
+            jobs[i].len = packets[i]->datalen;
+            jobs[i].digest = digests[i];
+        }
+        MD5Multi(jobs, count);
+        for (int i = 0; i < count; ++i) {
+            checkok[i] = memcmp(packets[i]->check, digests[i], sizeof(digests[i])) == 0;
+        }
+    }
+};
 
+//NetPacket格式的分帧解析
+//AEAD帧先由本连接的PacketOpener解密认证. 设置了密钥(SetKeyring)时不加密的帧被丢弃，没有密钥时加密的帧被丢弃
+//压缩的帧先按压缩后的数据校验，再由本连接的PacketInflater解压后回调. 解压失败或不支持的压缩方式丢弃该帧(分段回调为PACKET_CHUNK_ERROR)
+//分段接收的AEAD帧: 认证标签在帧尾，解密出的明文先缓存，认证通过后才解压并分段回调，认证失败只回调PACKET_CHUNK_ERROR.
+//未经认证的明文不会交给解压器与用户，代价是这种帧的明文整帧占用内存，分段接收只省去了密文的缓存
+class PacketSync : public BasicFramer<NetPacketHeader, NetPacketChecksum, ByteDelimiter>
+{
 public:
-    void recvdata(const unsigned char* data, int len) { //接收到数据，把数据保存在circulebuffer_
-        int iret = 0;
-        while (iret < len || truepacketlen >= NET_PACKAGE_HEADLEN + 2) {
-            if (PARSE_NOTHING == parsetype) {//未解析出head
-                if (thread_readdata.len - truepacketlen >= len - iret) {
-                    memcpy(thread_readdata.base + truepacketlen, data + iret, len - iret);
-                    truepacketlen += len - iret;
-                    iret  = len;
-                } else {
-                    memcpy(thread_readdata.base + truepacketlen, data + iret, thread_readdata.len - truepacketlen);
-                    iret += thread_readdata.len - truepacketlen;
-                    truepacketlen = thread_readdata.len;
-                }
-                headpt = (char*)memchr(thread_readdata.base, HEAD, truepacketlen);
-                if (!headpt) {//1
-                    fprintf(stdout, "读取%d数据，找不到包头\n", truepacketlen);
-                    truepacketlen = 0;//标记thread_readdata里的数据为无效
-                    continue;
-                }
-                headpos = headpt - thread_readdata.base;
-                if (truepacketlen - headpos - 1 < NET_PACKAGE_HEADLEN) { //2.2
-                    if (headpos != 0) {
-                        fprintf(stdout, "读取%d数据，找到包头,位于%d,数据不够解析帧头，先缓存\n", truepacketlen, headpos);
-                        memmove(thread_readdata.base, thread_readdata.base + headpos, truepacketlen - headpos);
-                        truepacketlen -= headpos;
-                    }
-                    continue;
-                }
-                //得帧头
-                headpt = &thread_readdata.base[headpos + 1];
-                //fprintf(stdout,"recv netpacketchar:\n");;
-                //for (int i=0; i<NET_PACKAGE_HEADLEN; ++i) {
-                //    fprintf(stdout,"%02X",(unsigned char)(headpt)[i]);
-                //}
-                //fprintf(stdout,"\n");
-                CharToNetPacket((const unsigned char*)(headpt), theNexPacket);
-                if (theNexPacket.header != HEAD || theNexPacket.tail != TAIL || theNexPacket.datalen < 0) {//帧头数据不合法(帧长允许为0)
-                    fprintf(stdout, "读取%d数据,包头位于%d. 帧数据不合法(head:%02x,tail:%02x,datalen:%d)\n",
-                            truepacketlen, headpos, theNexPacket.header, theNexPacket.tail, theNexPacket.datalen);
-                    memmove(thread_readdata.base, thread_readdata.base + headpos + 1, truepacketlen - headpos - 1); //2.4
-                    truepacketlen -= headpos + 1;
-                    continue;
-                }
-                parsetype = PARSE_HEAD;
-                //得帧数据
-                if (thread_packetdata.len < (size_t)theNexPacket.datalen + 1) { //包含最后的tail
-                    thread_packetdata.base = (char*)realloc(thread_packetdata.base, theNexPacket.datalen + 1);
-                    thread_packetdata.len = theNexPacket.datalen + 1;
-                }
-                getdatalen = (std::min)((int)(truepacketlen - headpos - 1 - NET_PACKAGE_HEADLEN), (int)(theNexPacket.datalen + 1));
-                //先从thread_readdata中取
-                if (getdatalen > 0) {
-                    memcpy(thread_packetdata.base, thread_readdata.base + headpos + 1 + NET_PACKAGE_HEADLEN, getdatalen);
-                }
-            }
+    typedef BasicFramer<NetPacketHeader, NetPacketChecksum, ByteDelimiter> Framer;
+    PacketSync(): packet_cb_(NULL), packetcb_userdata_(NULL), chunk_cb_(NULL), chunkcb_userdata_(NULL), chunkok_(false) {
+    }
+    bool Start(char packhead, char packtail) {
+        header_policy_.SetMarkers(packhead, packtail);
+        delimiter_policy_.SetMarkers(packhead, packtail);
+        return true;
+    }
+    void SetPacketCB(GetFullPacket pfun, void* userdata) {
+        packet_cb_ = pfun;
+        packetcb_userdata_ = userdata;
+        Framer::SetPacketCB(pfun ? OnPacket : NULL, this);
+    }
+    void SetPacketChunkCB(GetPacketChunk pfun, void* userdata) {
+        chunk_cb_ = pfun;
+        chunkcb_userdata_ = userdata;
+        Framer::SetPacketChunkCB(pfun ? OnChunk : NULL, this);//为NULL时不分段接收. AEAD帧认证通过后才回调分段
+    }
+    //AEAD帧的预共享密钥，由调用者保持有效(见packet_aead.h). 设置后只接受用其中的密钥加密的帧，NULL不解密
+    void SetKeyring(const PacketKeyring* keyring) {
+        opener_.SetKeyring(keyring);
+    }
 
-            //解析出head,在接收data
-            if (getdatalen < theNexPacket.datalen + 1) {
-                if (getdatalen + (len - iret) < theNexPacket.datalen + 1) {
-                    memcpy(thread_packetdata.base + getdatalen, data + iret, len - iret);
-                    getdatalen += len - iret;
-                    iret = len;
-                    return;//等待下一轮的读取
-                } else {
-                    memcpy(thread_packetdata.base + getdatalen, data + iret, theNexPacket.datalen + 1 - getdatalen);
-                    iret += theNexPacket.datalen + 1 - getdatalen;
-                    getdatalen = theNexPacket.datalen + 1;
-                }
+private:
+    static void OnPacket(const NetPacket& packethead, const unsigned char* packetdata, void* userdata) {
+        PacketSync* theclass = (PacketSync*)userdata;
+        if (!NetCheckIsAEAD(GetNetPacketCheckType(packethead))) {
+            if (theclass->opener_.GetKeyring()) {
+                theclass->diag("包数据长%d, 未加密的帧\n", packethead.datalen);
+                return;
             }
-            //检测校验码与最后一位
-            if (thread_packetdata.base[theNexPacket.datalen] != TAIL) {
-                fprintf(stdout, "包数据长%d, 包尾数据不合法(tail:%02x)\n", theNexPacket.datalen,
-                        (unsigned char)(thread_packetdata.base[theNexPacket.datalen]));
-                if (truepacketlen - headpos - 1 - NET_PACKAGE_HEADLEN >= theNexPacket.datalen + 1) {//thread_readdata数据足够
-                    memmove(thread_readdata.base, thread_readdata.base + headpos + 1, truepacketlen - headpos - 1); //2.4
-                    truepacketlen -= headpos + 1;
-                } else {//thread_readdata数据不足
-                    if (thread_readdata.len < NET_PACKAGE_HEADLEN + theNexPacket.datalen + 1) {//包含最后的tail
-                        thread_readdata.base = (char*)realloc(thread_readdata.base, NET_PACKAGE_HEADLEN + theNexPacket.datalen + 1);
-                        thread_readdata.len = NET_PACKAGE_HEADLEN + theNexPacket.datalen + 1;
-                    }
-                    memmove(thread_readdata.base, thread_readdata.base + headpos + 1, NET_PACKAGE_HEADLEN); //2.4
-                    truepacketlen = NET_PACKAGE_HEADLEN;
-                    memcpy(thread_readdata.base + truepacketlen, thread_packetdata.base, theNexPacket.datalen + 1);
-                    truepacketlen += theNexPacket.datalen + 1;
+            theclass->onplain(packethead, packetdata);
+            return;
+        }
+        int plainlen = 0;
+        const unsigned char* plaindata = theclass->opener_.Open(packethead, packetdata, &plainlen);
+        if (!plaindata) {
+            theclass->diag("包数据长%d, 解密失败\n", packethead.datalen);
+            return;
+        }
+        NetPacket plainhead = packethead;
+        plainhead.datalen = plainlen;
+        SetNetPacketCheckType(plainhead, NET_CHECK_NONE);
+        theclass->onplain(plainhead, plaindata);
+    }
+    static void OnChunk(const NetPacket& packethead, const unsigned char* chunk, int chunklen, int offset, int chunktype, void* userdata) {
+        PacketSync* theclass = (PacketSync*)userdata;
+        if (!NetCheckIsAEAD(GetNetPacketCheckType(packethead))) {
+            if (theclass->opener_.GetKeyring()) {//整帧丢弃，不回调任何分段
+                if (PACKET_CHUNK_DATA == chunktype && 0 == offset) {
+                    theclass->diag("包数据长%d, 未加密的帧\n", packethead.datalen);
                 }
-                parsetype = PARSE_NOTHING;//重头再来
-                continue;
+                return;
             }
-            if (0 == theNexPacket.datalen) { //长度为0的md5为：d41d8cd98f00b204e9800998ecf8427e，改为全0
-                memset(md5str, 0, sizeof(md5str));
-            } else {
-                MD5_CTX md5;
-                MD5_Init(&md5);
-                MD5_Update(&md5, thread_packetdata.base, theNexPacket.datalen); //包数据的校验值
-                MD5_Final(md5str, &md5);
+            theclass->onplainchunk(packethead, chunk, chunklen, offset, chunktype);
+            return;
+        }
+        if (PACKET_CHUNK_DATA == chunktype) {//解密出的明文先缓存到plainbuf_，认证之前不回调
+            if (0 == offset) {
+                theclass->opener_.StreamBegin(packethead);
+                theclass->plainhead_ = packethead;
+                theclass->plainhead_.datalen = theclass->opener_.PlainLen();
+                SetNetPacketCheckType(theclass->plainhead_, NET_CHECK_NONE);
+                theclass->chunkok_ = false;//明文为空时没有分段，不能沿用上一帧的解压结果
+                theclass->plainbuf_.clear();
             }
-            if (memcmp(theNexPacket.check, md5str, MD5_DIGEST_LENGTH) != 0) {
-                fprintf(stdout, "读取%zu数据, 校验码不合法\n", NET_PACKAGE_HEADLEN + theNexPacket.datalen + 2);
-                if (truepacketlen - headpos - 1 - NET_PACKAGE_HEADLEN >= theNexPacket.datalen + 1) {//thread_readdata数据足够
-                    memmove(thread_readdata.base, thread_readdata.base + headpos + 1, truepacketlen - headpos - 1); //2.4
-                    truepacketlen -= headpos + 1;
-                } else {//thread_readdata数据不足
-                    if (thread_readdata.len < NET_PACKAGE_HEADLEN + theNexPacket.datalen + 1) {//包含最后的tail
-                        thread_readdata.base = (char*)realloc(thread_readdata.base, NET_PACKAGE_HEADLEN + theNexPacket.datalen + 1);
-                        thread_readdata.len = NET_PACKAGE_HEADLEN + theNexPacket.datalen + 1;
-                    }
-                    memmove(thread_readdata.base, thread_readdata.base + headpos + 1, NET_PACKAGE_HEADLEN); //2.4
-                    truepacketlen = NET_PACKAGE_HEADLEN;
-                    memcpy(thread_readdata.base + truepacketlen, thread_packetdata.base, theNexPacket.datalen + 1);
-                    truepacketlen += theNexPacket.datalen + 1;
-                }
-                parsetype = PARSE_NOTHING;//重头再来
-                continue;
+            theclass->opener_.StreamChunk(chunk, chunklen, OnOpenOut, theclass);
+            return;
+        }
+        if (PACKET_CHUNK_END == chunktype && !theclass->opener_.StreamEnd()) {
+            theclass->diag("包数据长%d, 解密失败\n", packethead.datalen);
+            chunktype = PACKET_CHUNK_ERROR;
+        }
+        std::string& plainbuf = theclass->plainbuf_;
+        int plainlen = (int)plainbuf.size();
+        if (PACKET_CHUNK_END == chunktype) {//认证通过，按明文的偏移分段回调
+            for (int pos = 0; pos < plainlen; pos += PACKET_AEAD_CHUNK) {
+                int len = (std::min)(plainlen - pos, PACKET_AEAD_CHUNK);
+                theclass->onplainchunk(theclass->plainhead_, (const unsigned char*)plainbuf.data() + pos, len, pos, PACKET_CHUNK_DATA);
             }
-            if (truepacketlen - headpos - 1 - NET_PACKAGE_HEADLEN >= theNexPacket.datalen + 1) {//thread_readdata数据足够
-                memmove(thread_readdata.base, thread_readdata.base + headpos + NET_PACKAGE_HEADLEN + theNexPacket.datalen + 2,
-                        truepacketlen - (headpos + NET_PACKAGE_HEADLEN + theNexPacket.datalen + 2)); //2.4
-                truepacketlen -= headpos + NET_PACKAGE_HEADLEN + theNexPacket.datalen + 2;
-            } else {
-                truepacketlen = 0;//从新开始读取数据
+        }
+        if (plainbuf.capacity() > PACKET_INFLATE_KEEP) {//大帧的明文缓存不留到下一帧
+            std::string().swap(plainbuf);
+        } else {
+            plainbuf.clear();
+        }
+        theclass->onplainchunk(theclass->plainhead_, NULL, 0, plainlen, chunktype);
+    }
+    static void OnOpenOut(const unsigned char* out, int outlen, int /*offset*/, void* userdata) {
+        PacketSync* theclass = (PacketSync*)userdata;
+        theclass->plainbuf_.append((const char*)out, outlen);
+    }
+    //明文的帧(不加密或已解密): 解压后回调给用户
+    void onplain(const NetPacket& packethead, const unsigned char* packetdata) {
+        int compresstype = GetNetPacketCompressType(packethead);
+        if (NET_COMPRESS_NONE == compresstype) {
+            packet_cb_(packethead, packetdata, packetcb_userdata_);
+            return;
+        }
+        int rawlen = 0;
+        const unsigned char* rawdata = NULL;
+        if (!PacketInflater::IsSupported(compresstype)) {
+            diag("不支持的压缩方式%d\n", compresstype);
+            return;
+        }
+        rawdata = inflater_.Inflate(packetdata, packethead.datalen, GetMaxFrameSize(), &rawlen);
+        if (!rawdata) {
+            diag("包数据长%d, 解压失败\n", packethead.datalen);
+            return;
+        }
+        NetPacket rawhead = packethead;
+        rawhead.datalen = rawlen;
+        SetNetPacketCompressType(rawhead, NET_COMPRESS_NONE);
+        packet_cb_(rawhead, rawdata, packetcb_userdata_);
+        inflater_.Trim();//大帧的解压缓冲区不留到下一帧
+    }
+    void onplainchunk(const NetPacket& packethead, const unsigned char* chunk, int chunklen, int offset, int chunktype) {
+        int compresstype = GetNetPacketCompressType(packethead);
+        if (NET_COMPRESS_NONE == compresstype) {
+            chunk_cb_(packethead, chunk, chunklen, offset, chunktype, chunkcb_userdata_);
+            return;
+        }
+        chunkhead_ = packethead;
+        SetNetPacketCompressType(chunkhead_, NET_COMPRESS_NONE);
+        if (PACKET_CHUNK_DATA == chunktype) {//解压出的数据按原数据的偏移分段回调
+            if (0 == offset) {
+                chunkok_ = PacketInflater::IsSupported(compresstype);
+                inflater_.StreamBegin(GetMaxFrameSize());
             }
-            //回调帧数据给用户
-            if (this->packet_cb_) {
-                this->packet_cb_(theNexPacket, (const unsigned char*)thread_packetdata.base, this->packetcb_userdata_);
+            if (chunkok_) {
+                chunkok_ = inflater_.StreamChunk(chunk, chunklen, OnInflateOut, this);
             }
-            parsetype = PARSE_NOTHING;//重头再来
+            return;
+        }
+        if (PACKET_CHUNK_END == chunktype && !(chunkok_ && inflater_.StreamEnd())) {
+            diag("包数据长%d, 解压失败\n", packethead.datalen);
+            chunktype = PACKET_CHUNK_ERROR;
         }
+        chunkhead_.datalen = inflater_.RawLen();
+        chunk_cb_(chunkhead_, NULL, 0, inflater_.Produced(), chunktype, chunkcb_userdata_);
     }
-    void SetPacketCB(GetFullPacket pfun, void* userdata) {
-        packet_cb_ = pfun;
-        packetcb_userdata_ = userdata;
+    static void OnInflateOut(const unsigned char* out, int outlen, int offset, void* userdata) {
+        PacketSync* theclass = (PacketSync*)userdata;
+        theclass->chunkhead_.datalen = theclass->inflater_.RawLen();
+        theclass->chunk_cb_(theclass->chunkhead_, out, outlen, offset, PACKET_CHUNK_DATA, theclass->chunkcb_userdata_);
     }
-private:
-
-    GetFullPacket packet_cb_;//回调函数
-    void*         packetcb_userdata_;//回调函数所带的自定义数据
 
-    enum {
-        PARSE_HEAD,
-        PARSE_NOTHING,
-    };
-    int parsetype;
-    int getdatalen;
-    uv_buf_t  thread_readdata;//负责从circulebuffer_读取数据
-    uv_buf_t  thread_packetdata;//负责从circulebuffer_读取packet 中data部分
-    int truepacketlen;//readdata有效数据长度
-    int headpos;//找到头位置
-    char* headpt;//找到头位置
-    unsigned char HEAD;//包头
-    unsigned char TAIL;//包尾
-    NetPacket theNexPacket;
-    unsigned char md5str[MD5_DIGEST_LENGTH];
-private:// no copy
-    PacketSync(const PacketSync&);
-    PacketSync& operator = (const PacketSync&);
+    GetFullPacket packet_cb_;//用户的回调函数
+    void* packetcb_userdata_;
+    GetPacketChunk chunk_cb_;
+    void* chunkcb_userdata_;
+    PacketInflater inflater_;//本连接的解压器，缓冲区重复使用
+    PacketOpener opener_;//本连接的解密器
+    NetPacket plainhead_;//分段解密时回调的帧头(明文长，不校验)
+    std::string plainbuf_;//分段解密的明文，认证通过后才回调
+    NetPacket chunkhead_;//分段回调给用户的帧头(原长，不压缩)
+    bool chunkok_;//正在分段解压的帧还合法
 };
 
 /***********************************************辅助函数***************************************************/
+//PacketGather的结果: 包头、帧头与包尾编码在frame内，包数据引用调用者的内存
+typedef struct _packet_frame {
+    unsigned char head[1 + NET_PACKAGE_HEADLEN];//包头+帧头. v1为35字节，v2最多29字节
+    unsigned char tail[1];//包尾，v2没有
+    uv_buf_t bufs[3];//{包头+帧头, 包数据, 包尾}，长度为0的段已省略
+    int nbufs;
+    size_t len;//各段总长
+} PacketFrame;
+
+/*****************************
+* @brief   PacketData的分散/聚集版本: 只编码包头、帧头与包尾，不拷贝包数据。
+* @param   packet --同PacketData，按version中的校验方式计算check，按帧格式(v1/v2)编码. AEAD帧须先由PacketSealer::Seal加密
+	       data   --要发送的实际数据. frame.bufs引用它，frame使用完之前须保持有效且不被修改
+	       frame  --输出. frame.bufs/frame.nbufs可直接传给TCPClient::Send等聚集发送的函数，它们在返回前把数据拷入发送缓冲区
+* @return  size_t --帧的总长
+******************************/
+inline size_t PacketGather(NetPacket& packet, const unsigned char* data, PacketFrame& frame)
+{
+    int checktype = GetNetPacketCheckType(packet);
+    if (!NetCheckIsAEAD(checktype)) {//AEAD的check为PacketSealer::Seal写入的认证标签
+        PacketCheck::Calc(checktype, data, packet.datalen, packet.check);//长度为0时全0
+    }
+    size_t headlen;
+    bool hastail = true;
+    frame.head[0] = packet.header;
+    if (NET_PACKAGE_VERSION_V2 == GetNetPacketFormat(packet) && NetPacketFitsV2(packet)) {
+        headlen = 1 + NetPacketToCharV2(packet, frame.head + 1);
+        hastail = false;
+    } else if (NET_PACKAGE_VERSION_V2 == GetNetPacketFormat(packet)) {//v2表示不了的包退回v1，帧格式须改为v1，否则接收方按v2解析
+        NetPacket v1packet = packet;
+        v1packet.version = (int32_t)(((uint32_t)packet.version & ~(uint32_t)NET_FORMAT_MASK) | NET_PACKAGE_VERSION);
+        NetPacketToChar(v1packet, frame.head + 1);
+        headlen = 1 + NET_PACKAGE_HEADLEN;
+    } else {
+        NetPacketToChar(packet, frame.head + 1);
+        headlen = 1 + NET_PACKAGE_HEADLEN;
+    }
+    frame.tail[0] = packet.tail;
+    frame.nbufs = 0;
+    frame.bufs[frame.nbufs++] = uv_buf_init((char*)frame.head, (unsigned int)headlen);
+    if (packet.datalen > 0) {
+        frame.bufs[frame.nbufs++] = uv_buf_init((char*)data, (unsigned int)packet.datalen);
+    }
+    if (hastail) {
+        frame.bufs[frame.nbufs++] = uv_buf_init((char*)frame.tail, 1);
+    }
+    frame.len = headlen + packet.datalen + (hastail ? 1 : 0);
+    return frame.len;
+}
+
 /*****************************
 * @brief   把数据组合成NetPacket格式的二进制流，可直接发送。
-* @param   packet --NetPacket包，里面的version,header,tail,type,datalen,reserve必须提前赋值，该函数会计算check的值。然后组合成二进制流返回
+* @param   packet --NetPacket包，里面的version,header,tail,type,datalen,reserve必须提前赋值，该函数按version中的校验方式计算check的值。然后组合成二进制流返回
+	               version的0-7位为NET_PACKAGE_VERSION_V2且type在0-65535内时组合为v2帧，否则为v1帧
 	       data   --要发送的实际数据
 * @return  std::string --返回的二进制流。地址：&string[0],长度：string.length()
+* @note    会把包数据拷贝到返回的string中. 发送大包时用PacketGather与聚集发送的函数可少一次拷贝
 ******************************/
 inline std::string PacketData(NetPacket& packet, const unsigned char* data)
 {
-    if (packet.datalen == 0 || data == NULL) {//长度为0的md5为：d41d8cd98f00b204e9800998ecf8427e，改为全0
-        memset(packet.check, 0, sizeof(packet.check));
-    } else {
-        MD5_CTX md5;
-        MD5_Init(&md5);
-        MD5_Update(&md5, data, packet.datalen);
-        MD5_Final(packet.check, &md5);
-    }
-    unsigned char packchar[NET_PACKAGE_HEADLEN];
-    NetPacketToChar(packet, packchar);
-
+    PacketFrame frame;
+    PacketGather(packet, data, frame);
     std::string retstr;
-    retstr.append(1, packet.header);
-    retstr.append((const char*)packchar, NET_PACKAGE_HEADLEN);
-    retstr.append((const char*)data, packet.datalen);
-    retstr.append(1, packet.tail);
+    retstr.reserve(frame.len);
+    for (int i = 0; i < frame.nbufs; ++i) {
+        retstr.append(frame.bufs[i].base, frame.bufs[i].len);
+    }
     return retstr;
 }
 
@@ -267,6 +413,19 @@ typedef void (*ServerRecvCB)(int clientid, const NetPacket& packethead, const un
 //TCPClient接收到服务器数据回调给用户
 typedef void (*ClientRecvCB)(const NetPacket& packethead, const unsigned char* buf, void* userdata);
 
+//TCPClient分段接收到服务器大包时回调给用户，参数含义同GetPacketChunk
+typedef void (*ClientRecvChunkCB)(const NetPacket& packethead, const unsigned char* chunk, int chunklen, int offset, int chunktype, void* userdata);
+
+//TCPClient::ConnectAsync连接结果回调给用户.status为0表示连接成功，否则为libuv错误码
+typedef void (*ConnectCB)(int status, void* userdata);
+
+//TCPClient::SendAsync的数据全部写入内核后回调给用户.status为0表示成功，否则为libuv错误码(如UV_ECANCELED)
+typedef void (*SendCB)(int status, void* userdata);
+
+//TCPClient::Call的结果回调给用户
+//status为0时packethead与buf为服务器的回复；超时为UV_ETIMEDOUT，断线或关闭为UV_ECANCELED，此时packethead与buf无效
+typedef void (*ClientCallCB)(int status, const NetPacket& packethead, const unsigned char* buf, void* userdata);
+
 //网络事件类型
 typedef enum {
     NET_EVENT_TYPE_RECONNECT = 0,  //与服务器自动重连成功事件
@@ -0,0 +1,347 @@
+﻿/***************************************
+* @file     tls_stream.h
+* @brief    基于OpenSSL内存BIO的TLS: 收到的密文由AfterRecv喂给TLSStream，解出的明文再给PacketSync；
+            发送的明文加密后从输出BIO取出，再由uv_write发送. 不占用socket，libuv的读写方式不变
+* @details  TLSContext: 一个SSL_CTX，证书、私钥、校验方式与会话恢复的设置，多个连接共用
+            TLSStream : 一个连接的SSL与两个内存BIO. 客户端保存服务器发来的会话(session ticket)，
+                        断线重连时用它恢复会话，省去完整握手的非对称运算
+            需定义NET_WITH_TLS并链接OpenSSL 1.1.1以上(CMake选项NET_WITH_TLS). 未定义时Init/Start返回false
+            内核TLS(kTLS)卸载未实现: OpenSSL只在socket BIO上开启kTLS，与内存BIO的方式不兼容
+* @author   phata, wqvbjhc@gmail.com
+* @date     2026-10-19
+****************************************/
+#ifndef TLS_STREAM_H
+#define TLS_STREAM_H
+#include <stddef.h>
+#include <string>
+#ifdef NET_WITH_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+#define TLS_READ_CHUNK (16 * 1024)//一次SSL_read的最大长度，一个TLS记录
+
+//解密出的明文回调. 返回false则停止解密，Feed返回false(如明文中有超长的包)
+typedef bool (*TLSPlainCB)(const char* data, size_t len, void* userdata);
+
+class TLSContext
+{
+public:
+    TLSContext(): ctx_(NULL) {
+    }
+    virtual ~TLSContext() {
+#ifdef NET_WITH_TLS
+        if (ctx_) {
+            SSL_CTX_free(ctx_);
+        }
+#endif
+    }
+    //服务器: certfile为PEM格式的证书(链)，keyfile为PEM格式的私钥. 默认开启会话票据
+    bool InitServer(const char* certfile, const char* keyfile) {
+#ifdef NET_WITH_TLS
+        if (!init(TLS_server_method())) {
+            return false;
+        }
+        if (SSL_CTX_use_certificate_chain_file(ctx_, certfile) != 1) {
+            return seterror("load cert file failure");
+        }
+        if (SSL_CTX_use_PrivateKey_file(ctx_, keyfile, SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx_) != 1) {
+            return seterror("load key file failure");
+        }
+        return true;
+#else
+        (void)certfile;
+        (void)keyfile;
+        errmsg_ = "build without NET_WITH_TLS";
+        return false;
+#endif
+    }
+    //客户端: cafile为校验服务器证书的CA(PEM格式)，NULL不校验服务器证书(只用于测试)
+    bool InitClient(const char* cafile);
+#ifdef NET_WITH_TLS
+    SSL_CTX* Get() {
+        return ctx_;
+    }
+#endif
+    const char* GetLastErrMsg() const {
+        return errmsg_.c_str();
+    }
+private:
+#ifdef NET_WITH_TLS
+    bool init(const SSL_METHOD* method) {
+        if (ctx_) {
+            SSL_CTX_free(ctx_);
+        }
+        ctx_ = SSL_CTX_new(method);
+        if (!ctx_) {
+            return seterror("SSL_CTX_new failure");
+        }
+        SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+        SSL_CTX_set_mode(ctx_, SSL_MODE_RELEASE_BUFFERS);
+        return true;
+    }
+    bool seterror(const char* what) {
+        char err[256];
+        ERR_error_string_n(ERR_get_error(), err, sizeof(err));
+        errmsg_ = std::string(what) + ": " + err;
+        ERR_clear_error();
+        return false;
+    }
+    SSL_CTX* ctx_;
+#else
+    void* ctx_;
+#endif
+    std::string errmsg_;
+private:// no copy
+    TLSContext(const TLSContext&);
+    TLSContext& operator = (const TLSContext&);
+};
+
+class TLSStream
+{
+public:
+    TLSStream(): ssl_(NULL), session_(NULL), handshakedone_(false) {
+    }
+    virtual ~TLSStream() {
+        Reset();
+#ifdef NET_WITH_TLS
+        if (session_) {
+            SSL_SESSION_free(session_);
+        }
+#endif
+    }
+    //开始一个连接的TLS，之前的连接先Reset. 客户端用上次连接保存的会话，servername(可为NULL)用于SNI与证书的主机名校验
+    //客户端的ClientHello在返回前写入输出，调用者随后发送
+    bool Start(TLSContext& ctx, bool isserver, const char* servername) {
+        Reset();
+#ifdef NET_WITH_TLS
+        ssl_ = SSL_new(ctx.Get());
+        if (!ssl_) {
+            return seterror("SSL_new failure");
+        }
+        SSL_set_bio(ssl_, BIO_new(BIO_s_mem()), BIO_new(BIO_s_mem()));
+        SSL_set_app_data(ssl_, this);
+        if (isserver) {
+            SSL_set_accept_state(ssl_);
+            return true;
+        }
+        if (servername && servername[0]) {
+            SSL_set_tlsext_host_name(ssl_, servername);
+            if (SSL_get_verify_mode(ssl_) & SSL_VERIFY_PEER) {
+                SSL_set1_host(ssl_, servername);
+            }
+        }
+        if (session_) {
+            SSL_set_session(ssl_, session_);
+        }
+        SSL_set_connect_state(ssl_);
+        return handshake();
+#else
+        (void)ctx;
+        (void)isserver;
+        (void)servername;
+        errmsg_ = "build without NET_WITH_TLS";
+        return false;
+#endif
+    }
+    //释放本连接的SSL，保留会话供下次Start恢复
+    void Reset() {
+#ifdef NET_WITH_TLS
+        if (ssl_) {
+            //连接断开时通常没有close_notify，SSL_free会把会话标记为不可恢复. 握手完成且没有TLS错误的会话仍可以恢复
+            SSL_set_shutdown(ssl_, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+            SSL_free(ssl_);//BIO随SSL释放
+            ssl_ = NULL;
+        }
+        ERR_clear_error();
+#endif
+        handshakedone_ = false;
+    }
+    //收到的密文. 握手未完成时推进握手，之后解密出的明文回调cb. 握手与会话票据等要发给对端的数据写入输出
+    //返回false为TLS错误(证书不合法、数据被篡改、对端关闭TLS等)或cb返回false，连接应关闭. 发生错误时输出中可能有告警(alert)
+    bool Feed(const char* data, size_t len, TLSPlainCB cb, void* userdata) {
+#ifdef NET_WITH_TLS
+        if (!ssl_) {
+            errmsg_ = "tls not start";
+            return false;
+        }
+        if (BIO_write(SSL_get_rbio(ssl_), data, (int)len) != (int)len) {
+            return fail("BIO_write failure");
+        }
+        if (!handshakedone_) {
+            if (!handshake()) {
+                return false;
+            }
+            if (!handshakedone_) {//等对端的下一批握手数据
+                return true;
+            }
+        }
+        char plain[TLS_READ_CHUNK];
+        while (true) {
+            int iret = SSL_read(ssl_, plain, sizeof(plain));
+            if (iret > 0) {
+                if (!cb(plain, iret, userdata)) {
+                    errmsg_ = "stop by the plaintext cb";
+                    return false;
+                }
+                continue;
+            }
+            int err = SSL_get_error(ssl_, iret);
+            if (SSL_ERROR_WANT_READ == err) {
+                return true;
+            }
+            if (SSL_ERROR_ZERO_RETURN == err) {
+                errmsg_ = "peer close the tls";
+                return false;
+            }
+            return fail("SSL_read failure");
+        }
+#else
+        (void)data;
+        (void)len;
+        (void)cb;
+        (void)userdata;
+        return false;
+#endif
+    }
+    //加密明文，密文之后由TakeOutput取出. 握手完成后才能调用
+    bool Write(const char* data, size_t len) {
+#ifdef NET_WITH_TLS
+        if (!ssl_ || !handshakedone_) {
+            errmsg_ = "tls handshake not finish";
+            return false;
+        }
+        size_t written = 0;
+        if (SSL_write_ex(ssl_, data, len, &written) != 1 || written != len) {//内存BIO不会满，一次写完
+            return fail("SSL_write failure");
+        }
+        return true;
+#else
+        (void)data;
+        (void)len;
+        return false;
+#endif
+    }
+    //要发给对端的密文长度
+    size_t OutputSize() const {
+#ifdef NET_WITH_TLS
+        return ssl_ ? BIO_ctrl_pending(SSL_get_wbio(ssl_)) : 0;
+#else
+        return 0;
+#endif
+    }
+    //取出至多len字节的密文到buf，返回取出的长度
+    size_t TakeOutput(char* buf, size_t len) {
+#ifdef NET_WITH_TLS
+        int iret = ssl_ ? BIO_read(SSL_get_wbio(ssl_), buf, (int)len) : 0;
+        return iret > 0 ? (size_t)iret : 0;
+#else
+        (void)buf;
+        (void)len;
+        return 0;
+#endif
+    }
+    bool IsStarted() const {
+        return ssl_ != NULL;
+    }
+    bool IsHandshakeDone() const {
+        return handshakedone_;
+    }
+    //本连接的握手恢复了之前的会话
+    bool IsResumed() const {
+#ifdef NET_WITH_TLS
+        return ssl_ && handshakedone_ && SSL_session_reused(ssl_);
+#else
+        return false;
+#endif
+    }
+    const char* GetLastErrMsg() const {
+        return errmsg_.c_str();
+    }
+
+private:
+#ifdef NET_WITH_TLS
+    //推进握手. 返回false为握手失败；握手未完成返回true，handshakedone_不变
+    bool handshake() {
+        errmsg_.clear();
+        int iret = SSL_do_handshake(ssl_);
+        if (1 == iret) {
+            handshakedone_ = true;
+            return true;
+        }
+        if (SSL_ERROR_WANT_READ == SSL_get_error(ssl_, iret)) {
+            return true;
+        }
+        long verify = SSL_get_verify_result(ssl_);
+        if (verify != X509_V_OK) {
+            fail("tls handshake failure");
+            errmsg_ = std::string("tls handshake failure: ") + X509_verify_cert_error_string(verify);
+            return false;
+        }
+        return fail("tls handshake failure");
+    }
+    bool seterror(const char* what) {
+        char err[256];
+        ERR_error_string_n(ERR_get_error(), err, sizeof(err));
+        errmsg_ = std::string(what) + ": " + err;
+        ERR_clear_error();
+        return false;
+    }
+    //TLS错误: 之前保存的会话不再用于恢复
+    bool fail(const char* what) {
+        if (session_) {
+            SSL_SESSION_free(session_);
+            session_ = NULL;
+        }
+        return seterror(what);
+    }
+    //客户端收到新的会话(TLS1.3在握手之后由会话票据送来)，保存供重连时恢复
+    static int NewSessionCB(SSL* ssl, SSL_SESSION* session) {
+        TLSStream* theclass = (TLSStream*)SSL_get_app_data(ssl);
+        if (!theclass) {
+            return 0;
+        }
+        if (theclass->session_) {
+            SSL_SESSION_free(theclass->session_);
+        }
+        theclass->session_ = session;
+        return 1;//session的引用归theclass
+    }
+    SSL* ssl_;
+    SSL_SESSION* session_;//上次连接的会话，客户端才有
+#else
+    void* ssl_;
+    void* session_;
+#endif
+    bool handshakedone_;
+    std::string errmsg_;
+private:// no copy
+    TLSStream(const TLSStream&);
+    TLSStream& operator = (const TLSStream&);
+    friend class TLSContext;
+};
+
+inline bool TLSContext::InitClient(const char* cafile)
+{
+#ifdef NET_WITH_TLS
+    if (!init(TLS_client_method())) {
+        return false;
+    }
+    if (cafile) {
+        if (SSL_CTX_load_verify_locations(ctx_, cafile, NULL) != 1) {
+            return seterror("load ca file failure");
+        }
+        SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, NULL);
+    }
+    //会话不进SSL_CTX的缓存，由各连接的TLSStream保存(见NewSessionCB)，重连时恢复自己的会话
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx_, TLSStream::NewSessionCB);
+    return true;
+#else
+    (void)cafile;
+    errmsg_ = "build without NET_WITH_TLS";
+    return false;
+#endif
+}
+
+#endif//TLS_STREAM_H
@@ -1,6 +1,13 @@
 ﻿#include "tcpclient.h"
+#include <algorithm>
 #include "log4z.h"
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
 #define MAXLISTSIZE 20
+#define CONNECT_WAIT_TIME 10000//ms, the blocking Connect give up after it
+#define SPOOL_SEGMENT_SIZE (4 * 1024 * 1024)
+#define RACE_ATTEMPT_DELAY 250//ms, Happy Eyeballs connection attempt delay(RFC 8305)
 
 namespace uv
 {
@@ -8,6 +15,7 @@ TcpClientCtx* AllocTcpClientCtx(void* parentserver)
 {
     TcpClientCtx* ctx = (TcpClientCtx*)malloc(sizeof(*ctx));
     ctx->packet_ = new PacketSync;
+    ctx->tls_ = NULL;
     ctx->read_buf_.base = (char*)malloc(BUFFER_SIZE);
     ctx->read_buf_.len = BUFFER_SIZE;
     ctx->write_req.data = ctx;//store self
@@ -18,6 +26,7 @@ TcpClientCtx* AllocTcpClientCtx(void* parentserver)
 void FreeTcpClientCtx(TcpClientCtx* ctx)
 {
     delete ctx->packet_;
+    delete ctx->tls_;
     free(ctx->read_buf_.base);
     free(ctx);
 }
@@ -26,54 +35,272 @@ void FreeTcpClientCtx(TcpClientCtx* ctx)
 write_param* AllocWriteParam(void)
 {
     write_param* param = (write_param*)malloc(sizeof(*param));
-    param->buf_.base = (char*)malloc(BUFFER_SIZE);
-    param->buf_.len = BUFFER_SIZE;
-    param->buf_truelen_ = BUFFER_SIZE;
+    param->bufcount_ = 0;
+    param->len_ = 0;
+    param->tlsbuf_ = NULL;
+    param->tlscap_ = 0;
     return param;
 }
 
 void FreeWriteParam(write_param* param)
 {
-    free(param->buf_.base);
+    free(param->tlsbuf_);
     free(param);
 }
 
+/*****************************************DNS Cache*************************************************************/
+//hostname->addresses(port is 0), shared by all TCPClient. the first address is the preferred one
+typedef struct _dns_entry {
+    std::vector<sockaddr_storage> addrs;
+    uint64_t expire;//ms of uv_hrtime
+} DNSEntry;
+static uv_once_t dnscache_once = UV_ONCE_INIT;
+static uv_mutex_t dnscache_mutex;
+static std::map<std::string, DNSEntry> dnscache;
+static int64_t dnscache_ttl = 60000;
+
+static void DNSCacheInit(void)
+{
+    uv_mutex_init(&dnscache_mutex);
+}
+
+static bool DNSCacheGet(const std::string& host, std::vector<sockaddr_storage>& addrs)
+{
+    uv_once(&dnscache_once, DNSCacheInit);
+    uv_mutex_lock(&dnscache_mutex);
+    auto itfind = dnscache.find(host);
+    bool iret = itfind != dnscache.end() && itfind->second.expire > uv_hrtime() / 1000000;
+    if (iret) {
+        addrs = itfind->second.addrs;
+    } else if (itfind != dnscache.end()) {
+        dnscache.erase(itfind);
+    }
+    uv_mutex_unlock(&dnscache_mutex);
+    return iret;
+}
+
+static void DNSCachePut(const std::string& host, const std::vector<sockaddr_storage>& addrs)
+{
+    uv_once(&dnscache_once, DNSCacheInit);
+    uv_mutex_lock(&dnscache_mutex);
+    if (dnscache_ttl > 0 && !addrs.empty()) {
+        DNSEntry& entry = dnscache[host];
+        entry.addrs = addrs;
+        entry.expire = uv_hrtime() / 1000000 + dnscache_ttl;
+    }
+    uv_mutex_unlock(&dnscache_mutex);
+}
+
+static void DNSCacheErase(const std::string& host)
+{
+    uv_once(&dnscache_once, DNSCacheInit);
+    uv_mutex_lock(&dnscache_mutex);
+    dnscache.erase(host);
+    uv_mutex_unlock(&dnscache_mutex);
+}
+
+static bool SameAddr(const sockaddr_storage& addr1, const sockaddr_storage& addr2)
+{
+    if (addr1.ss_family != addr2.ss_family) {
+        return false;
+    }
+    if (AF_INET6 == addr1.ss_family) {
+        return 0 == memcmp(&((const sockaddr_in6*)&addr1)->sin6_addr, &((const sockaddr_in6*)&addr2)->sin6_addr, sizeof(in6_addr));
+    }
+    return 0 == memcmp(&((const sockaddr_in*)&addr1)->sin_addr, &((const sockaddr_in*)&addr2)->sin_addr, sizeof(in_addr));
+}
+
+//the address win the race, connect to it first next time
+static void DNSCachePrefer(const std::string& host, const sockaddr_storage& addr)
+{
+    uv_once(&dnscache_once, DNSCacheInit);
+    uv_mutex_lock(&dnscache_mutex);
+    auto itfind = dnscache.find(host);
+    if (itfind != dnscache.end()) {
+        std::vector<sockaddr_storage>& addrs = itfind->second.addrs;
+        for (size_t i = 1; i < addrs.size(); ++i) {
+            if (SameAddr(addrs[i], addr)) {
+                std::rotate(addrs.begin(), addrs.begin() + i, addrs.begin() + i + 1);
+                break;
+            }
+        }
+    }
+    uv_mutex_unlock(&dnscache_mutex);
+}
+
+static void SetAddrPort(sockaddr_storage& addr, int port)
+{
+    if (AF_INET6 == addr.ss_family) {
+        ((sockaddr_in6*)&addr)->sin6_port = htons((uint16_t)port);
+    } else {
+        ((sockaddr_in*)&addr)->sin_port = htons((uint16_t)port);
+    }
+}
+
+//resolve the hostname, then connect to the addresses one by one every RACE_ATTEMPT_DELAY
+//without waiting for the previous attempt, the first connected one wins. free itself when all handles closed
+struct TCPClient::ConnectRace {
+    typedef struct _attempt {
+        uv_tcp_t handle;//data is this
+        uv_connect_t req;//data is this
+        ConnectRace* race;
+        size_t index;//of addrs
+    } Attempt;
+
+    TCPClient* client;//NULL when the race finish or cancel
+    std::string host;
+    int port;
+    uv_getaddrinfo_t resolve_req;//data is this
+    bool resolving;
+    std::vector<sockaddr_storage> addrs;//interleave ipv6 and ipv4
+    size_t next;//next index of addrs to attempt
+    uv_timer_t timer;//start the next attempt. data is this
+    bool timeropen;
+    std::list<Attempt*> attempts;//connecting
+    int closinghandles;
+    int lasterror;
+
+    void closeattempt(Attempt* attempt) {
+        ++closinghandles;
+        uv_close((uv_handle_t*)&attempt->handle, AttemptCloseCB);
+    }
+    void closeall() {
+        for (auto it = attempts.begin(); it != attempts.end(); ++it) {
+            closeattempt(*it);
+        }
+        attempts.clear();
+        if (timeropen) {
+            ++closinghandles;
+            uv_close((uv_handle_t*)&timer, TimerCloseCB);
+        }
+    }
+    static void tryfree(ConnectRace* race) {
+        if (!race->client && !race->resolving && race->closinghandles == 0 && race->attempts.empty()) {
+            delete race;
+        }
+    }
+    static void AttemptCloseCB(uv_handle_t* handle) {
+        Attempt* attempt = (Attempt*)handle->data;
+        ConnectRace* race = attempt->race;
+        delete attempt;
+        --race->closinghandles;
+        tryfree(race);
+    }
+    static void TimerCloseCB(uv_handle_t* handle) {
+        ConnectRace* race = (ConnectRace*)handle->data;
+        race->timeropen = false;
+        --race->closinghandles;
+        tryfree(race);
+    }
+};
+
 /*****************************************TCP Client*************************************************************/
 TCPClient::TCPClient(char packhead, char packtail)
-    : PACKET_HEAD(packhead), PACKET_TAIL(packtail)
-    , recvcb_(nullptr), recvcb_userdata_(nullptr), closedcb_(nullptr), closedcb_userdata_(nullptr)
-    , connectstatus_(CONNECT_DIS), write_circularbuf_(BUFFER_SIZE)
-    , isclosed_(true), isuseraskforclosed_(false)
-    , reconnectcb_(nullptr), reconnect_userdata_(nullptr)
-    , isIPv6_(false), isreconnecting_(false)
+    : TCPClient(packhead, packtail, NULL)
+{
+}
+
+TCPClient::TCPClient(char packhead, char packtail, TCPClientLoop* loop)
+    : loop_(loop ? loop->GetLoop() : &ownloop_), sharedloop_(loop)
+    , isclosed_(true), isuseraskforclosed_(false), closinghandles_(0), tcpclosing_(false), isconnectpending_(false)
+    , connectcancel_(false), isreleased_(true)
+    , connectcb_(nullptr), connectcb_userdata_(nullptr), race_(NULL), iscachedconnect_(false)
+    , connectstatus_(CONNECT_DIS)
+    , sendwaiters_(0), write_circularbuf_(BUFFER_SIZE, true), inflight_(0), sent_seq_(0)
+    , spool_(NULL), spool_threshold_(0), spool_offset_(0), tls_ctx_(NULL), sendfail_seq_(0), sendfail_status_(0)
+    , recvcb_(nullptr), recvcb_userdata_(nullptr), call_id_(0)
+    , recvchunkcb_(nullptr), recvchunkcb_userdata_(nullptr), oversize_count_(0)
+    , compress_threshold_(0), compress_level_(-1)
+    , closedcb_(nullptr), closedcb_userdata_(nullptr)
+    , reconnectcb_(nullptr), reconnect_userdata_(nullptr), isreconnecting_(false), repeat_time_(1000)
+    , endpoint_pos_(0), reconnect_attempts_(0), disconnect_time_(0), reconnect_stats_()
+    , reconnect_rng_((uint32_t)(uv_hrtime() ^ (uintptr_t)this))
+    , connectport_(0), isIPv6_(false)
+    , PACKET_HEAD(packhead), PACKET_TAIL(packtail)
 {
     client_handle_ = AllocTcpClientCtx(this);
-    int iret = uv_loop_init(&loop_);
+    int iret;
+    if (sharedloop_) {
+        free(client_handle_->read_buf_.base);//use the read buffer of the shared loop
+        client_handle_->read_buf_ = uv_buf_init(NULL, 0);
+    } else {
+        iret = uv_loop_init(&ownloop_);
+        if (iret) {
+            errmsg_ = GetUVError(iret);
+            LOGE(errmsg_);
+            fprintf(stdout, "init loop error: %s\n", errmsg_.c_str());
+        }
+    }
+    iret = uv_mutex_init(&mutex_writebuf_);
     if (iret) {
         errmsg_ = GetUVError(iret);
         LOGE(errmsg_);
-        fprintf(stdout, "init loop error: %s\n", errmsg_.c_str());
     }
-    iret = uv_mutex_init(&mutex_writebuf_);
+    iret = uv_cond_init(&cond_writebuf_);
+    if (iret) {
+        errmsg_ = GetUVError(iret);
+        LOGE(errmsg_);
+    }
+    iret = uv_mutex_init(&mutex_spool_);
+    if (iret) {
+        errmsg_ = GetUVError(iret);
+        LOGE(errmsg_);
+    }
+    iret = uv_mutex_init(&mutex_calls_);
+    if (iret) {
+        errmsg_ = GetUVError(iret);
+        LOGE(errmsg_);
+    }
+    iret = uv_mutex_init(&mutex_connect_);
+    if (iret) {
+        errmsg_ = GetUVError(iret);
+        LOGE(errmsg_);
+    }
+    iret = uv_cond_init(&cond_connect_);
+    if (iret) {
+        errmsg_ = GetUVError(iret);
+        LOGE(errmsg_);
+    }
+    iret = uv_cond_init(&cond_released_);
     if (iret) {
         errmsg_ = GetUVError(iret);
         LOGE(errmsg_);
     }
     connect_req_.data = this;
+    reconnect_policy_.initial_delay = 1000;
+    reconnect_policy_.max_delay = 60000;
+    reconnect_policy_.jitter = RECONNECT_JITTER_NONE;
+    reconnect_policy_.random_endpoints = false;
 }
 
-
 TCPClient::~TCPClient()
 {
     Close();
-    uv_thread_join(&connect_threadhandle_);
+    if (sharedloop_) {
+        //the shared loop keep running, wait for all handles of this client closed and the ConnectTask finish
+        uv_mutex_lock(&mutex_connect_);
+        while (!isreleased_ || isconnectpending_) {
+            uv_cond_wait(&cond_released_, &mutex_connect_);
+        }
+        uv_mutex_unlock(&mutex_connect_);
+    } else {
+        uv_thread_join(&connect_threadhandle_);
+        uv_loop_close(&ownloop_);
+    }
     FreeTcpClientCtx(client_handle_);
-    uv_loop_close(&loop_);
     uv_mutex_destroy(&mutex_writebuf_);
+    uv_cond_destroy(&cond_writebuf_);
+    uv_mutex_destroy(&mutex_spool_);
+    uv_mutex_destroy(&mutex_calls_);
+    uv_mutex_destroy(&mutex_connect_);
+    uv_cond_destroy(&cond_connect_);
+    uv_cond_destroy(&cond_released_);
     for (auto it = writeparam_list_.begin(); it != writeparam_list_.end(); ++it) {
         FreeWriteParam(*it);
     }
     writeparam_list_.clear();
+    delete spool_;
+    delete tls_ctx_;
 
     LOGI("client(" << this << ")exit");
 }
@@ -83,7 +310,7 @@ bool TCPClient::init()
     if (!isclosed_) {
         return true;
     }
-    int iret = uv_async_init(&loop_, &async_handle_, AsyncCB);
+    int iret = uv_async_init(loop_, &async_handle_, AsyncCB);
     if (iret) {
         errmsg_ = GetUVError(iret);
         LOGE(errmsg_);
@@ -91,7 +318,7 @@ bool TCPClient::init()
     }
     async_handle_.data = this;
 
-    iret = uv_tcp_init(&loop_, &client_handle_->tcphandle);
+    iret = uv_tcp_init(loop_, &client_handle_->tcphandle);
     if (iret) {
         errmsg_ = GetUVError(iret);
         LOGE(errmsg_);
@@ -101,33 +328,68 @@ bool TCPClient::init()
     client_handle_->parent_server = this;
 
     client_handle_->packet_->SetPacketCB(GetPacket, client_handle_);
+    client_handle_->packet_->SetPacketChunkCB(recvchunkcb_ ? GetChunk : NULL, client_handle_);//no chunk cb, deliver the whole packet
     client_handle_->packet_->Start(PACKET_HEAD, PACKET_TAIL);
 
-    iret = uv_timer_init(&loop_, &reconnect_timer_);
+    if (!sharedloop_) {//the shared loop has one timer for all clients
+        iret = uv_timer_init(loop_, &reconnect_timer_);
+        if (iret) {
+            errmsg_ = GetUVError(iret);
+            LOGE(errmsg_);
+            return false;
+        }
+        reconnect_timer_.data = this;
+    }
+
+    iret = uv_timer_init(loop_, &call_timer_);
     if (iret) {
         errmsg_ = GetUVError(iret);
         LOGE(errmsg_);
         return false;
     }
-    reconnect_timer_.data = this;
+    call_timer_.data = this;
     LOGI("client(" << this << ")Init");
+    if (sharedloop_) {
+        uv_mutex_lock(&mutex_connect_);
+        isreleased_ = false;
+        uv_mutex_unlock(&mutex_connect_);
+    }
     isclosed_ = false;
+    isuseraskforclosed_ = false;
     return true;
 }
 
 void TCPClient::closeinl()
 {
-    if (isclosed_) {
+    if (isclosed_ || closinghandles_ > 0) {//closed or closing on the shared loop
         return;
     }
     StopReconnect();
-    uv_walk(&loop_, CloseWalkCB, this);
+    cancelrace();//before uv_walk, the race close its own handles
+    failcalls(UV_ECANCELED);
+    finishsends(UV_ECANCELED);
+    uv_mutex_lock(&mutex_writebuf_);
+    uv_cond_broadcast(&cond_writebuf_);//wake up the blocking Send
+    uv_mutex_unlock(&mutex_writebuf_);
+    client_handle_->tcphandle.data = this;//AfterClientClose get this
+    if (sharedloop_) {//only close the handles of this client
+        uv_handle_t* handles[] = {(uv_handle_t*)&client_handle_->tcphandle, (uv_handle_t*)&async_handle_, (uv_handle_t*)&call_timer_};
+        closinghandles_ = tcpclosing_ ? 1 : 0;//tcphandle is closing for reconnect, wait its AfterClientClose too
+        for (size_t i = 0; i < sizeof(handles) / sizeof(handles[0]); ++i) {
+            if (!uv_is_closing(handles[i])) {
+                ++closinghandles_;
+                uv_close(handles[i], AfterClientClose);
+            }
+        }
+    } else {
+        uv_walk(loop_, CloseWalkCB, this);
+    }
     LOGI("client(" << this << ")close");
 }
 
 bool TCPClient::run(int status)
 {
-    int iret = uv_run(&loop_, (uv_run_mode)status);
+    int iret = uv_run(loop_, (uv_run_mode)status);
     isclosed_ = true;
     LOGI("client had closed.");
     if (closedcb_) {//trigger close cb to user
@@ -166,21 +428,80 @@ bool TCPClient::SetKeepAlive(int enable, unsigned int delay)
 
 bool TCPClient::Connect(const char* ip, int port)
 {
-    closeinl();
-    if (!init()) {
+    if (!connectinl(ip, port, false, NULL, NULL)) {
         return false;
     }
-    connectip_ = ip;
-    connectport_ = port;
-    isIPv6_ = false;
-    struct sockaddr_in bind_addr;
-    int iret = uv_ip4_addr(connectip_.c_str(), connectport_, &bind_addr);
+    return waitconnect();
+}
+
+bool TCPClient::Connect6(const char* ip, int port)
+{
+    if (!connectinl(ip, port, true, NULL, NULL)) {
+        return false;
+    }
+    return waitconnect();
+}
+
+bool TCPClient::ConnectAsync(const char* ip, int port, ConnectCB cb, void* userdata)
+{
+    return connectinl(ip, port, false, cb, userdata);
+}
+
+bool TCPClient::ConnectAsync6(const char* ip, int port, ConnectCB cb, void* userdata)
+{
+    return connectinl(ip, port, true, cb, userdata);
+}
+
+bool TCPClient::ConnectAsync(const struct sockaddr* addr, ConnectCB cb, void* userdata)
+{
+    char ip[64];
+    int iret;
+    if (AF_INET6 == addr->sa_family) {
+        iret = uv_ip6_name((const struct sockaddr_in6*)addr, ip, sizeof(ip));
+    } else if (AF_INET == addr->sa_family) {
+        iret = uv_ip4_name((const struct sockaddr_in*)addr, ip, sizeof(ip));
+    } else {
+        iret = UV_EAFNOSUPPORT;
+    }
     if (iret) {
         errmsg_ = GetUVError(iret);
         LOGE(errmsg_);
         return false;
     }
-    iret = uv_tcp_connect(&connect_req_, &client_handle_->tcphandle, (const sockaddr*)&bind_addr, AfterConnect);
+    int port = ntohs(AF_INET6 == addr->sa_family ? ((const struct sockaddr_in6*)addr)->sin6_port : ((const struct sockaddr_in*)addr)->sin_port);
+    return connectinl(ip, port, AF_INET6 == addr->sa_family, cb, userdata);
+}
+
+bool TCPClient::connectinl(const char* ip, int port, bool isipv6, ConnectCB cb, void* userdata)
+{
+    connectip_ = ip;
+    connectport_ = port;
+    isIPv6_ = isipv6;
+    if (endpoints_.empty()) {
+        endpoints_.resize(1);
+    }
+    endpoints_[0].ip = ip;
+    endpoints_[0].port = port;
+    endpoints_[0].isipv6 = isipv6;
+    connectcb_ = cb;
+    connectcb_userdata_ = userdata;
+    uv_mutex_lock(&mutex_connect_);
+    connectstatus_ = CONNECT_DIS;
+    if (sharedloop_) {
+        isconnectpending_ = true;
+    }
+    uv_mutex_unlock(&mutex_connect_);
+    if (sharedloop_) {//libuv operations must run on the shared loop thread
+        connectcancel_ = false;
+        sharedloop_->Post(ConnectTask, this);
+        LOGI("client(" << this << ")start connect to server(" << ip << ":" << port << ")");
+        return true;
+    }
+    closeinl();
+    if (!init()) {
+        return false;
+    }
+    int iret = startconnect();
     if (iret) {
         errmsg_ = GetUVError(iret);
         LOGE(errmsg_);
@@ -194,132 +515,811 @@ bool TCPClient::Connect(const char* ip, int port)
         LOGE(errmsg_);
         return false;
     }
-    int wait_count = 0;
-    while (connectstatus_ == CONNECT_DIS) {
-        ThreadSleep(100);
-        if (++wait_count > 100) {
-            connectstatus_ = CONNECT_TIMEOUT;
-            break;
+    return true;
+}
+
+int TCPClient::startconnect()
+{
+    struct sockaddr_storage bind_addr;
+    int iret;
+    iscachedconnect_ = false;
+    if (isIPv6_) {
+        iret = uv_ip6_addr(connectip_.c_str(), connectport_, (struct sockaddr_in6*)&bind_addr);
+    } else {
+        iret = uv_ip4_addr(connectip_.c_str(), connectport_, (struct sockaddr_in*)&bind_addr);
+        if (iret) {//not ipv4, take it as hostname
+            return startresolve();
         }
     }
-    if (CONNECT_FINISH != connectstatus_) {
-        errmsg_ = "connect time out";
-        return false;
-    } else {
-        return true;
+    if (iret) {
+        return iret;
     }
+    return uv_tcp_connect(&connect_req_, &client_handle_->tcphandle, (const sockaddr*)&bind_addr, AfterConnect);
 }
 
-bool TCPClient::Connect6(const char* ip, int port)
+void TCPClient::SetDNSCacheTTL(int64_t ttl)
 {
-    closeinl();
-    if (!init()) {
-        return false;
+    uv_once(&dnscache_once, DNSCacheInit);
+    uv_mutex_lock(&dnscache_mutex);
+    dnscache_ttl = ttl;
+    if (ttl <= 0) {
+        dnscache.clear();
     }
-    connectip_ = ip;
-    connectport_ = port;
-    isIPv6_ = true;
-    struct sockaddr_in6 bind_addr;
-    int iret = uv_ip6_addr(connectip_.c_str(), connectport_, &bind_addr);
-    if (iret) {
-        errmsg_ = GetUVError(iret);
-        LOGE(errmsg_);
-        return false;
+    uv_mutex_unlock(&dnscache_mutex);
+}
+
+int TCPClient::startresolve()
+{
+    std::vector<sockaddr_storage> addrs;
+    if (DNSCacheGet(connectip_, addrs)) {//connect to the preferred address
+        iscachedconnect_ = true;
+        SetAddrPort(addrs[0], connectport_);
+        return uv_tcp_connect(&connect_req_, &client_handle_->tcphandle, (const sockaddr*)&addrs[0], AfterConnect);
     }
-    iret = uv_tcp_connect(&connect_req_, &client_handle_->tcphandle, (const sockaddr*)&bind_addr, AfterConnect);
+    ConnectRace* race = new ConnectRace;
+    race->client = this;
+    race->host = connectip_;
+    race->port = connectport_;
+    race->resolve_req.data = race;
+    race->resolving = false;
+    race->next = 0;
+    race->timer.data = race;
+    race->timeropen = false;
+    race->closinghandles = 0;
+    race->lasterror = UV_EAI_NODATA;
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    int iret = uv_getaddrinfo(loop_, &race->resolve_req, AfterResolve, connectip_.c_str(), NULL, &hints);
     if (iret) {
-        errmsg_ = GetUVError(iret);
-        LOGE(errmsg_);
-        return false;
+        delete race;
+        return iret;
     }
+    race->resolving = true;
+    race_ = race;
+    return 0;
+}
 
-    LOGI("client(" << this << ")start connect to server(" << ip << ":" << port << ")");
-    iret = uv_thread_create(&connect_threadhandle_, ConnectThread, this);//thread to wait for succeed connect.
+void TCPClient::AfterResolve(uv_getaddrinfo_t* req, int status, struct addrinfo* res)
+{
+    ConnectRace* race = (ConnectRace*)req->data;
+    race->resolving = false;
+    TCPClient* parent = race->client;
+    if (!parent) {//cancel
+        uv_freeaddrinfo(res);
+        ConnectRace::tryfree(race);
+        return;
+    }
+    //RFC 8305: interleave the address families, start with the first family of getaddrinfo
+    std::vector<sockaddr_storage> addrs[2];
+    int firstfamily = 0;
+    for (struct addrinfo* ai = status ? NULL : res; ai; ai = ai->ai_next) {
+        if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6) {
+            continue;
+        }
+        if (0 == firstfamily) {
+            firstfamily = ai->ai_family;
+        }
+        sockaddr_storage addr;
+        memset(&addr, 0, sizeof(addr));
+        memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
+        std::vector<sockaddr_storage>& familyaddrs = addrs[ai->ai_family == firstfamily ? 0 : 1];
+        bool isexist = false;
+        for (size_t i = 0; i < familyaddrs.size() && !isexist; ++i) {
+            isexist = SameAddr(familyaddrs[i], addr);
+        }
+        if (!isexist) {
+            familyaddrs.push_back(addr);
+        }
+    }
+    uv_freeaddrinfo(res);
+    for (size_t i = 0; i < addrs[0].size() || i < addrs[1].size(); ++i) {
+        for (int family = 0; family < 2; ++family) {
+            if (i < addrs[family].size()) {
+                race->addrs.push_back(addrs[family][i]);
+            }
+        }
+    }
+    if (race->addrs.empty()) {
+        parent->finishrace(status ? status : UV_EAI_NODATA);
+        return;
+    }
+    DNSCachePut(race->host, race->addrs);
+#if defined(_WIN32)
+    //no fd handover on windows, connect to the first address directly
+    sockaddr_storage addr = race->addrs[0];
+    SetAddrPort(addr, race->port);
+    parent->race_ = NULL;
+    race->client = NULL;
+    ConnectRace::tryfree(race);
+    int iret = uv_tcp_connect(&parent->connect_req_, &parent->client_handle_->tcphandle, (const sockaddr*)&addr, AfterConnect);
     if (iret) {
-        errmsg_ = GetUVError(iret);
-        LOGE(errmsg_);
-        return false;
+        parent->connectresult(iret);
+    }
+#else
+    int iret = uv_timer_init(parent->loop_, &race->timer);
+    if (iret) {
+        parent->finishrace(iret);
+        return;
+    }
+    race->timeropen = true;
+    startattempt(race);
+#endif
+}
+
+void TCPClient::startattempt(ConnectRace* race)
+{
+    TCPClient* parent = race->client;
+    while (race->next < race->addrs.size()) {
+        ConnectRace::Attempt* attempt = new ConnectRace::Attempt;
+        attempt->race = race;
+        attempt->index = race->next++;
+        int iret = uv_tcp_init(parent->loop_, &attempt->handle);
+        if (iret) {
+            delete attempt;
+            race->lasterror = iret;
+            continue;
+        }
+        attempt->handle.data = attempt;
+        attempt->req.data = attempt;
+        sockaddr_storage addr = race->addrs[attempt->index];
+        SetAddrPort(addr, race->port);
+        iret = uv_tcp_connect(&attempt->req, &attempt->handle, (const sockaddr*)&addr, RaceConnectCB);
+        if (iret) {//try the next at once
+            race->lasterror = iret;
+            race->closeattempt(attempt);
+            continue;
+        }
+        race->attempts.push_back(attempt);
+        uv_timer_start(&race->timer, RaceTimerCB, RACE_ATTEMPT_DELAY, 0);
+        return;
+    }
+    if (race->attempts.empty()) {//all failure
+        parent->finishrace(race->lasterror);
+    }
+}
+
+void TCPClient::RaceTimerCB(uv_timer_t* handle)
+{
+    ConnectRace* race = (ConnectRace*)handle->data;
+    if (race->client) {
+        startattempt(race);
+    }
+}
+
+void TCPClient::RaceConnectCB(uv_connect_t* req, int status)
+{
+    ConnectRace::Attempt* attempt = (ConnectRace::Attempt*)req->data;
+    ConnectRace* race = attempt->race;
+    TCPClient* parent = race->client;
+    if (!parent) {//the race finish or cancel, the handle is closing
+        return;
+    }
+    race->attempts.remove(attempt);
+    if (status) {
+        race->lasterror = status;
+        race->closeattempt(attempt);
+        if (race->attempts.empty()) {//not wait for the timer
+            uv_timer_stop(&race->timer);
+            startattempt(race);
+        }
+        return;
+    }
+    //the winner. hand the socket over to tcphandle, then close the attempt handle
+    int iret = UV_ENOTSUP;
+#if !defined(_WIN32)
+    uv_os_fd_t fd;
+    iret = uv_fileno((uv_handle_t*)&attempt->handle, &fd);
+    if (0 == iret) {
+        int dupfd = dup(fd);
+        iret = dupfd < 0 ? uv_translate_sys_error(errno) : uv_tcp_open(&parent->client_handle_->tcphandle, dupfd);
+        if (iret && dupfd >= 0) {
+            close(dupfd);
+        }
+    }
+#endif
+    if (0 == iret) {
+        DNSCachePrefer(race->host, race->addrs[attempt->index]);
+    }
+    race->closeattempt(attempt);
+    parent->finishrace(iret);
+}
+
+void TCPClient::finishrace(int status)
+{
+    ConnectRace* race = race_;
+    race_ = NULL;
+    race->client = NULL;
+    race->closeall();
+    ConnectRace::tryfree(race);
+    connectresult(status);
+}
+
+void TCPClient::cancelrace()
+{
+    if (!race_) {
+        return;
+    }
+    ConnectRace* race = race_;
+    race_ = NULL;
+    race->client = NULL;
+    if (race->resolving) {
+        uv_cancel((uv_req_t*)&race->resolve_req);
     }
-    int wait_count = 0;
+    race->closeall();
+    ConnectRace::tryfree(race);
+}
+
+bool TCPClient::waitconnect()
+{
+    uint64_t deadline = uv_hrtime() + (uint64_t)CONNECT_WAIT_TIME * 1000000;
+    uv_mutex_lock(&mutex_connect_);
     while (connectstatus_ == CONNECT_DIS) {
-        ThreadSleep(100);
-        if (++wait_count > 100) {
-            connectstatus_ = CONNECT_TIMEOUT;
+        uint64_t now = uv_hrtime();
+        if (now >= deadline || uv_cond_timedwait(&cond_connect_, &mutex_connect_, deadline - now) == UV_ETIMEDOUT) {
+            if (connectstatus_ == CONNECT_DIS) {
+                connectstatus_ = CONNECT_TIMEOUT;
+            }
             break;
         }
     }
-    if (CONNECT_FINISH != connectstatus_) {
-        errmsg_ = "connect time out";
-        return false;
-    } else {
+    int status = connectstatus_;
+    uv_mutex_unlock(&mutex_connect_);
+    if (CONNECT_FINISH == status) {
         return true;
     }
+    if (CONNECT_TIMEOUT == status) {
+        errmsg_ = "connect time out";
+    }
+    return false;
+}
+
+void TCPClient::finishconnect(int status)
+{
+    uv_mutex_lock(&mutex_connect_);//connectstatus_ is set already, wake up the blocking Connect
+    uv_cond_broadcast(&cond_connect_);
+    uv_mutex_unlock(&mutex_connect_);
+    ConnectCB cb = connectcb_;
+    connectcb_ = NULL;//only the first result after ConnectAsync, not the reconnect
+    if (cb) {
+        cb(status, connectcb_userdata_);
+    }
+}
+
+void TCPClient::ConnectTask(void* arg)
+{
+    TCPClient* theclass = (TCPClient*)arg;
+    int iret = UV_ECANCELED;
+    if (!theclass->connectcancel_) {
+        if (!theclass->isclosed_) {//close the last connection first
+            theclass->closeinl();
+            theclass->sharedloop_->Post(ConnectTask, theclass);
+            return;
+        }
+        if (!theclass->init()) {
+            iret = UV_EINVAL;
+        } else {
+            iret = theclass->startconnect();
+            if (0 == iret && theclass->connectcancel_) {//Close saw isclosed_ before init, it is up to here to close
+                iret = UV_ECANCELED;
+            }
+            if (iret) {
+                theclass->errmsg_ = GetUVError(iret);
+                theclass->closeinl();
+            }
+        }
+    }
+    if (iret) {
+        LOGE("client(" << theclass << ") connect error:" << theclass->errmsg_);
+        theclass->connectstatus_ = CONNECT_ERROR;
+        theclass->finishconnect(iret);
+    }
+    uv_mutex_lock(&theclass->mutex_connect_);//the destructor may run as soon as it is clear
+    theclass->isconnectpending_ = false;
+    uv_cond_broadcast(&theclass->cond_released_);
+    uv_mutex_unlock(&theclass->mutex_connect_);
 }
 
 void TCPClient::ConnectThread(void* arg)
 {
     TCPClient* pclient = (TCPClient*)arg;
     pclient->run();
+    uv_mutex_lock(&pclient->mutex_connect_);//the loop exit before connect finish
+    if (CONNECT_DIS == pclient->connectstatus_) {
+        pclient->connectstatus_ = CONNECT_ERROR;
+    }
+    uv_cond_broadcast(&pclient->cond_connect_);
+    uv_mutex_unlock(&pclient->mutex_connect_);
 }
 
 void TCPClient::AfterConnect(uv_connect_t* handle, int status)
 {
-    TcpClientCtx* theclass = (TcpClientCtx*)handle->handle->data;
-    TCPClient* parent = (TCPClient*)theclass->parent_server;
+    TCPClient* parent = (TCPClient*)handle->data;//connect_req_
+    parent->connectresult(status);
+}
+
+void TCPClient::connectresult(int status)
+{
+    TCPClient* parent = this;
     if (status) {
+        if (iscachedconnect_) {//the cached address may be out of date, resolve and race next time
+            DNSCacheErase(connectip_);
+        }
         parent->connectstatus_ = CONNECT_ERROR;
         parent->errmsg_ = GetUVError(status);
         LOGE("client(" << parent << ") connect error:" << parent->errmsg_);
         fprintf(stdout, "connect error:%s\n", parent->errmsg_.c_str());
-        if (parent->isreconnecting_) {//reconnect failure, restart timer to trigger reconnect.
-            uv_timer_stop(&parent->reconnect_timer_);
-            parent->repeat_time_ *= 2;
-            uv_timer_start(&parent->reconnect_timer_, TCPClient::ReconnectTimer, parent->repeat_time_, parent->repeat_time_);
+        if (parent->isreconnecting_) {//reconnect failure, close the handle then AfterClientClose restart timer.
+            parent->repeat_time_ = parent->nextreconnectdelay();
+            parent->client_handle_->tcphandle.data = parent;
+            parent->tcpclosing_ = true;
+            uv_close((uv_handle_t*)&parent->client_handle_->tcphandle, AfterClientClose);
+        } else if (parent->sharedloop_) {//release the handles, the shared loop keep running
+            parent->closeinl();
         }
+        parent->finishconnect(status);
         return;
     }
 
-    int iret = uv_read_start(handle->handle, AllocBufferForRecv, AfterRecv);
+    int iret = uv_read_start((uv_stream_t*)&client_handle_->tcphandle, AllocBufferForRecv, AfterRecv);
     if (iret) {
-        parent->errmsg_ = GetUVError(status);
+        parent->errmsg_ = GetUVError(iret);
         LOGE("client(" << parent << ") uv_read_start error:" << parent->errmsg_);
         fprintf(stdout, "uv_read_start error:%s\n", parent->errmsg_.c_str());
+    } else if (client_handle_->tls_) {//the connect finish after the handshake, see AfterRecv
+        if (client_handle_->tls_->Start(*tls_ctx_, false, tls_servername_.c_str())) {
+            send_inl(NULL);//ClientHello
+            return;
+        }
+        parent->errmsg_ = client_handle_->tls_->GetLastErrMsg();
+        LOGE("client(" << parent << ") tls start error:" << parent->errmsg_);
+        uv_read_stop((uv_stream_t*)&client_handle_->tcphandle);
+        iret = UV_EPROTO;
+    }
+    connectdone(iret);
+}
+
+void TCPClient::connectdone(int iret)
+{
+    TCPClient* parent = this;
+    if (iret) {
         parent->connectstatus_ = CONNECT_ERROR;
     } else {
         parent->connectstatus_ = CONNECT_FINISH;
         LOGI("client(" << parent << ")run");
     }
+    parent->finishconnect(iret);
     if (parent->isreconnecting_) {
+        int64_t last_ms = (int64_t)((uv_hrtime() - parent->disconnect_time_) / 1000000);
+        uv_mutex_lock(&parent->mutex_connect_);//GetReconnectStats read it from other threads
+        ReconnectStats& stats = parent->reconnect_stats_;
+        stats.last_ms = last_ms;
+        stats.max_ms = (std::max)(stats.max_ms, stats.last_ms);
+        stats.total_ms += stats.last_ms;
+        stats.last_attempts = parent->reconnect_attempts_;
+        ++stats.count;
+        uv_mutex_unlock(&parent->mutex_connect_);
         fprintf(stdout, "reconnect succeed\n");
+        LOGI("client(" << parent << ") reconnect succeed after " << last_ms << "ms, " << parent->reconnect_attempts_ << " attempts");
         parent->StopReconnect();//reconnect succeed.
         if (parent->reconnectcb_) {
             parent->reconnectcb_(NET_EVENT_TYPE_RECONNECT, parent->reconnect_userdata_);
         }
     }
+    if (0 == iret) {//the data kept in write_circularbuf_ and the spool during disconnect
+        parent->send_inl(NULL);
+    }
 }
 
 int TCPClient::Send(const char* data, std::size_t len)
 {
-    if (!data || len <= 0) {
+    return Send(data, len, -1);
+}
+
+int TCPClient::Send(const char* data, std::size_t len, int64_t timeout)
+{
+    uv_buf_t buf;
+    buf.base = (char*)data;
+    buf.len = data ? len : 0;
+    return Send(&buf, 1, timeout);
+}
+
+int TCPClient::TrySend(const char* data, std::size_t len)
+{
+    uv_buf_t buf;
+    buf.base = (char*)data;
+    buf.len = data ? len : 0;
+    return TrySend(&buf, 1);
+}
+
+bool TCPClient::SendAsync(const char* data, std::size_t len, SendCB cb, void* userdata)
+{
+    uv_buf_t buf;
+    buf.base = (char*)data;
+    buf.len = data ? len : 0;
+    return SendAsync(&buf, 1, cb, userdata);
+}
+
+//total len of the spans, 0 when any span is invalid
+static std::size_t SpansLen(const uv_buf_t* bufs, int nbufs)
+{
+    if (!bufs || nbufs <= 0) {
+        return 0;
+    }
+    std::size_t len = 0;
+    for (int i = 0; i < nbufs; ++i) {
+        if (!bufs[i].base && bufs[i].len > 0) {
+            return 0;
+        }
+        len += bufs[i].len;
+    }
+    return len;
+}
+
+int TCPClient::Send(const uv_buf_t* bufs, int nbufs, int64_t timeout)
+{
+    std::size_t len = SpansLen(bufs, nbufs);
+    if (len <= 0) {
         errmsg_ = "send data is null or len less than zero.";
         LOGE(errmsg_);
         return 0;
     }
-    uv_async_send(&async_handle_);
+    int spooled = spoolinl(bufs, nbufs, len);
+    if (spooled != 0) {
+        return spooled > 0 ? (int)len : 0;
+    }
+    uint64_t deadline = timeout < 0 ? 0 : uv_hrtime() + (uint64_t)timeout * 1000000;
+    //the data not bigger than the buffer is written as a whole, not mix with the data of other Send threads
+    bool iswhole = len <= write_circularbuf_.capacity();
     size_t iret = 0;
+    bool istimeout = false;
+    bool needwakeup = false;
     while (!isuseraskforclosed_) {
+        iret += write_circularbuf_.writev(bufs, nbufs, iret, iswhole, NULL, &needwakeup);
+        if (needwakeup) {
+            uv_async_send(&async_handle_);
+        }
+        if (iret >= len || istimeout) {
+            break;
+        }
+        //wait for the loop thread drain the buffer
         uv_mutex_lock(&mutex_writebuf_);
-        iret += write_circularbuf_.write(data + iret, len - iret);
+        ++sendwaiters_;
+        if (!isuseraskforclosed_ && write_circularbuf_.freesize() < (iswhole ? len - iret : 1)) {
+            if (timeout < 0) {
+                uv_cond_wait(&cond_writebuf_, &mutex_writebuf_);
+            } else {
+                uint64_t now = uv_hrtime();
+                istimeout = now >= deadline || uv_cond_timedwait(&cond_writebuf_, &mutex_writebuf_, deadline - now) != 0;
+            }
+        }
+        --sendwaiters_;
         uv_mutex_unlock(&mutex_writebuf_);
-        if (iret < len) {
-            ThreadSleep(100);
-            continue;
-        } else {
+    }
+    if (iret < len) {
+        errmsg_ = "send buffer is full.";
+    }
+    return iret;
+}
+
+int TCPClient::TrySend(const uv_buf_t* bufs, int nbufs)
+{
+    std::size_t len = SpansLen(bufs, nbufs);
+    if (len <= 0) {
+        errmsg_ = "send data is null or len less than zero.";
+        LOGE(errmsg_);
+        return 0;
+    }
+    int spooled = spoolinl(bufs, nbufs, len);
+    if (spooled != 0) {
+        return spooled > 0 ? (int)len : 0;
+    }
+    bool needwakeup = false;
+    size_t iret = write_circularbuf_.writev(bufs, nbufs, 0, false, NULL, &needwakeup);
+    if (iret < len) {
+        errmsg_ = "send buffer is full.";
+    }
+    if (needwakeup) {
+        uv_async_send(&async_handle_);
+    }
+    return iret;
+}
+
+bool TCPClient::SendAsync(const uv_buf_t* bufs, int nbufs, SendCB cb, void* userdata)
+{
+    std::size_t len = SpansLen(bufs, nbufs);
+    if (len <= 0) {
+        errmsg_ = "send data is null or len less than zero.";
+        LOGE(errmsg_);
+        return false;
+    }
+    if (isuseraskforclosed_) {
+        errmsg_ = "client is closing.";
+        return false;
+    }
+    if (spool_ && !spool_->empty()) {//the cb can't follow the data to disk
+        errmsg_ = "send is spooling.";
+        return false;
+    }
+    uint64_t startseq = 0;
+    bool needwakeup = false;
+    if (write_circularbuf_.writev(bufs, nbufs, 0, true, &startseq, &needwakeup) != len) {
+        errmsg_ = "send buffer is full.";
+        return false;
+    }
+    if (cb) {
+        SendCBParam param;
+        param.startseq = startseq;
+        param.endseq = startseq + len;
+        param.cb = cb;
+        param.userdata = userdata;
+        uv_mutex_lock(&mutex_writebuf_);
+        sendcbs_[param.endseq] = param;
+        uv_mutex_unlock(&mutex_writebuf_);
+        needwakeup = true;//the data may had sent before the cb add, AsyncCB check it
+    }
+    if (needwakeup) {
+        uv_async_send(&async_handle_);
+    }
+    return true;
+}
+
+bool TCPClient::SetSpool(const char* dir, size_t threshold, uint64_t maxbytes)
+{
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "tcpclient_%d_%p", (int)uv_os_getpid(), this);
+    DiskSpool* spool = new DiskSpool;
+    if (!spool->open(dir, prefix, SPOOL_SEGMENT_SIZE, maxbytes)) {
+        delete spool;
+        errmsg_ = "spool dir is invalid.";
+        LOGE(errmsg_);
+        return false;
+    }
+    delete spool_;
+    spool_ = spool;
+    spool_offset_ = 0;
+    spool_threshold_ = write_circularbuf_.capacity();
+    if (threshold > 0 && threshold < spool_threshold_) {
+        spool_threshold_ = threshold;
+    }
+    return true;
+}
+
+bool TCPClient::SetTLS(const char* cafile, const char* servername)
+{
+    TLSContext* ctx = new TLSContext;
+    if (!ctx->InitClient(cafile)) {
+        errmsg_ = ctx->GetLastErrMsg();
+        LOGE(errmsg_);
+        delete ctx;
+        return false;
+    }
+    delete tls_ctx_;
+    tls_ctx_ = ctx;
+    tls_servername_ = servername ? servername : "";
+    if (!client_handle_->tls_) {
+        client_handle_->tls_ = new TLSStream;
+    }
+    return true;
+}
+
+uint64_t TCPClient::GetSpoolSize() const
+{
+    return spool_ ? spool_->size() : 0;
+}
+
+int TCPClient::spoolinl(const uv_buf_t* bufs, int nbufs, std::size_t len)
+{
+    if (!spool_) {
+        return 0;
+    }
+    //keep the order: once the spool has data, the later data go to the spool too until it is drained.
+    //drainspool can't move or pop a record between the check and the append
+    uv_mutex_lock(&mutex_spool_);
+    if (spool_->empty() && !isreconnecting_ && CONNECT_FINISH == connectstatus_
+            && write_circularbuf_.size() + len <= spool_threshold_) {
+        uv_mutex_unlock(&mutex_spool_);
+        return 0;
+    }
+    bool isappend = spool_->appendv(bufs, nbufs);
+    uv_mutex_unlock(&mutex_spool_);
+    if (!isappend) {
+        errmsg_ = "send spool is full.";
+        return -1;
+    }
+    if (CONNECT_FINISH == connectstatus_) {
+        uv_async_send(&async_handle_);
+    }
+    return 1;
+}
+
+void TCPClient::drainspool()
+{
+    if (!spool_) {
+        return;
+    }
+    uv_mutex_lock(&mutex_spool_);
+    const char* data;
+    size_t len;
+    while (!isreconnecting_ && CONNECT_FINISH == connectstatus_ && spool_->front(&data, &len)) {
+        //a record not bigger than the buffer is written as a whole, like Send
+        bool iswhole = len <= write_circularbuf_.capacity();
+        size_t iret = write_circularbuf_.write(data + spool_offset_, len - spool_offset_, iswhole);
+        spool_offset_ += iret;
+        if (spool_offset_ < len) {//the buffer is full, go on after AfterSend
             break;
         }
+        spool_offset_ = 0;
+        spool_->pop();
+    }
+    uv_mutex_unlock(&mutex_spool_);
+}
+
+void TCPClient::finishsends(int status)
+{
+    std::list<SendCBParam> finished;
+    uv_mutex_lock(&mutex_writebuf_);
+    while (!sendcbs_.empty() && (status || sendcbs_.begin()->first <= sent_seq_)) {
+        finished.push_back(sendcbs_.begin()->second);
+        sendcbs_.erase(sendcbs_.begin());
+    }
+    uv_mutex_unlock(&mutex_writebuf_);
+    for (auto it = finished.begin(); it != finished.end(); ++it) {//cb out of lock, user may send in cb
+        int cbstatus = status;
+        if (!cbstatus && it->startseq < sendfail_seq_) {//part of the data lost in the failure write
+            cbstatus = sendfail_status_;
+        }
+        it->cb(cbstatus, it->userdata);
+    }
+}
+
+bool TCPClient::Call(NetPacket& packet, const unsigned char* payload, uint64_t timeout, ClientCallCB cb, void* userdata)
+{
+    if (!cb) {
+        errmsg_ = "call cb is null.";
+        LOGE(errmsg_);
+        return false;
+    }
+    //register before send, the response may arrive before Send return
+    uv_mutex_lock(&mutex_calls_);
+    do {
+        if (++call_id_ <= 0) {//0 means no correlation
+            call_id_ = 1;
+        }
+    } while (calls_.find(call_id_) != calls_.end());
+    int32_t callid = call_id_;
+    uint64_t deadline = uv_hrtime() / 1000000 + timeout;
+    PendingCall& pending = calls_[callid];
+    pending.cb = cb;
+    pending.userdata = userdata;
+    pending.deadline = call_deadlines_.insert(std::make_pair(deadline, callid));
+    bool isearliest = pending.deadline == call_deadlines_.begin();
+    uv_mutex_unlock(&mutex_calls_);
+    if (isearliest) {//arm call_timer_ on the loop thread. Send may not wake it, eg. the data is spooled
+        uv_async_send(&async_handle_);
+    }
+
+    packet.reserve = callid;
+    //the compressed and encrypted data are in zbuf and sbuf, which live until Send copy it
+    std::string zbuf, sbuf;
+    const unsigned char* body = sealer_.Seal(packet, PacketCompress(packet, payload, compress_threshold_, compress_level_, zbuf), sbuf);
+    PacketFrame frame;
+    int sent = 0;
+    bool istoobig = false;
+    if (body) {
+        PacketGather(packet, body, frame);
+        //the frame must be queued as a whole: the server skip the length a cut frame claims, and lose the next frames with it.
+        //Send write a frame not bigger than the send buffer as a whole or not at all, a bigger one can only go to the spool whole
+        istoobig = !spool_ && frame.len > write_circularbuf_.capacity();
+    }
+    if (body && !istoobig) {
+        //the frame must be queued before the deadline too, Send wait at most the rest of the timeout.
+        uint64_t now = uv_hrtime() / 1000000;
+        sent = Send(frame.bufs, frame.nbufs, (int64_t)(deadline > now ? deadline - now : 0));
+    }
+    if (!body || sent < (int)frame.len) {
+        uv_mutex_lock(&mutex_calls_);
+        auto itfind = calls_.find(callid);
+        bool ispending = itfind != calls_.end();
+        if (ispending) {
+            call_deadlines_.erase(itfind->second.deadline);
+            calls_.erase(itfind);
+        }
+        uv_mutex_unlock(&mutex_calls_);
+        if (!ispending) {//finish by CallTimer or Close already, cb is called
+            return true;
+        }
+        if (body && !istoobig && uv_hrtime() / 1000000 >= deadline) {
+            errmsg_ = "call timeout before sent.";
+            LOGE(errmsg_);
+            NetPacket emptyhead;
+            memset(&emptyhead, 0, sizeof(emptyhead));
+            cb(UV_ETIMEDOUT, emptyhead, NULL, userdata);
+            return true;
+        }
+        errmsg_ = istoobig ? "call frame is bigger than the send buffer." : "send call failure.";
+        LOGE(errmsg_);
+        return false;
+    }
+    return true;
+}
+
+std::future<CallResult> TCPClient::Call(NetPacket& packet, const unsigned char* payload, uint64_t timeout)
+{
+    std::promise<CallResult>* promise = new std::promise<CallResult>;//delete on FutureCallCB
+    std::future<CallResult> result = promise->get_future();
+    if (!Call(packet, payload, timeout, FutureCallCB, promise)) {
+        NetPacket emptyhead;
+        memset(&emptyhead, 0, sizeof(emptyhead));
+        FutureCallCB(UV_ECANCELED, emptyhead, NULL, promise);
+    }
+    return result;
+}
+
+void TCPClient::FutureCallCB(int status, const NetPacket& packethead, const unsigned char* buf, void* userdata)
+{
+    std::promise<CallResult>* promise = (std::promise<CallResult>*)userdata;
+    CallResult result;
+    result.status = status;
+    result.packethead = packethead;
+    if (0 == status && buf) {
+        result.data.assign((const char*)buf, packethead.datalen);
+    }
+    promise->set_value(result);
+    delete promise;
+}
+
+void TCPClient::startcalltimer()
+{
+    uint64_t deadline;
+    uv_mutex_lock(&mutex_calls_);
+    if (call_deadlines_.empty()) {
+        uv_mutex_unlock(&mutex_calls_);
+        uv_timer_stop(&call_timer_);
+        return;
+    }
+    deadline = call_deadlines_.begin()->first;
+    uv_mutex_unlock(&mutex_calls_);
+    uint64_t now = uv_hrtime() / 1000000;
+    uv_timer_start(&call_timer_, TCPClient::CallTimer, deadline > now ? deadline - now : 0, 0);
+}
+
+void TCPClient::CallTimer(uv_timer_t* handle)
+{
+    TCPClient* theclass = (TCPClient*)handle->data;
+    std::list<PendingCall> expired;
+    uint64_t now = uv_hrtime() / 1000000;
+    uv_mutex_lock(&theclass->mutex_calls_);
+    auto it = theclass->call_deadlines_.begin();
+    while (it != theclass->call_deadlines_.end() && it->first <= now) {
+        auto itfind = theclass->calls_.find(it->second);
+        expired.push_back(itfind->second);
+        theclass->calls_.erase(itfind);
+        it = theclass->call_deadlines_.erase(it);
+    }
+    uv_mutex_unlock(&theclass->mutex_calls_);
+    NetPacket emptyhead;
+    memset(&emptyhead, 0, sizeof(emptyhead));
+    for (auto itexp = expired.begin(); itexp != expired.end(); ++itexp) {//cb out of lock, user may call Call in cb
+        itexp->cb(UV_ETIMEDOUT, emptyhead, NULL, itexp->userdata);
+    }
+    theclass->startcalltimer();
+}
+
+void TCPClient::failcalls(int status)
+{
+    std::unordered_map<int32_t, PendingCall> failed;
+    uv_mutex_lock(&mutex_calls_);
+    failed.swap(calls_);
+    call_deadlines_.clear();
+    uv_mutex_unlock(&mutex_calls_);
+    NetPacket emptyhead;
+    memset(&emptyhead, 0, sizeof(emptyhead));
+    for (auto it = failed.begin(); it != failed.end(); ++it) {
+        it->second.cb(status, emptyhead, NULL, it->second.userdata);
     }
-    uv_async_send(&async_handle_);
-    return iret;
 }
 
 void TCPClient::SetRecvCB(ClientRecvCB pfun, void* userdata)
@@ -328,6 +1328,35 @@ void TCPClient::SetRecvCB(ClientRecvCB pfun, void* userdata)
     recvcb_userdata_ = userdata;
 }
 
+void TCPClient::SetRecvChunkCB(ClientRecvChunkCB pfun, void* userdata)
+{
+    recvchunkcb_ = pfun;
+    recvchunkcb_userdata_ = userdata;
+    client_handle_->packet_->SetPacketChunkCB(recvchunkcb_ ? GetChunk : NULL, client_handle_);
+}
+
+void TCPClient::SetMaxFrameSize(int maxsize)
+{
+    client_handle_->packet_->SetMaxFrameSize(maxsize);
+}
+
+void TCPClient::SetStreamThreshold(int threshold)
+{
+    client_handle_->packet_->SetStreamThreshold(threshold);
+}
+
+void TCPClient::SetCompression(int threshold, int level)
+{
+    compress_threshold_ = threshold;
+    compress_level_ = level;
+}
+
+void TCPClient::SetEncryption(const PacketKeyring& keyring)
+{
+    sealer_.SetKeyring(keyring);
+    client_handle_->packet_->SetKeyring(keyring.Empty() ? NULL : &sealer_.GetKeyring());
+}
+
 void TCPClient::SetClosedCB(TcpCloseCB pfun, void* userdata)
 {
     closedcb_ = pfun;
@@ -344,7 +1373,12 @@ void TCPClient::AllocBufferForRecv(uv_handle_t* handle, size_t suggested_size, u
 {
     TcpClientCtx* theclass = (TcpClientCtx*)handle->data;
     assert(theclass);
-    *buf = theclass->read_buf_;
+    TCPClient* parent = (TCPClient*)theclass->parent_server;
+    if (parent->sharedloop_) {
+        *buf = *parent->sharedloop_->GetReadBuf();
+    } else {
+        *buf = theclass->read_buf_;
+    }
 }
 
 void TCPClient::AfterRecv(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf)
@@ -352,7 +1386,36 @@ void TCPClient::AfterRecv(uv_stream_t* handle, ssize_t nread, const uv_buf_t* bu
     TcpClientCtx* theclass = (TcpClientCtx*)handle->data;
     assert(theclass);
     TCPClient* parent = (TCPClient*)theclass->parent_server;
+    bool ishandshake = theclass->tls_ && !theclass->tls_->IsHandshakeDone();
+    if (nread > 0 && theclass->tls_) {
+        if (!theclass->tls_->Feed(buf->base, nread, TLSPlainData, theclass)) {
+            LOGW("client(" << parent << ")tls error: " << theclass->tls_->GetLastErrMsg());
+            nread = UV_EPROTO;
+        }
+        parent->send_inl(NULL);//the handshake records, or the alert on error
+        if (nread > 0) {
+            if (ishandshake && theclass->tls_->IsHandshakeDone()) {
+                LOGI("client(" << parent << ")tls handshake finish" << (theclass->tls_->IsResumed() ? ", session resumed" : ""));
+                parent->connectdone(0);
+            }
+            return;
+        }
+    } else if (nread > 0 && PACKET_ERR_OVERSIZE == theclass->packet_->recvdata((const unsigned char*)buf->base, nread)) {
+        ++parent->oversize_count_;
+        LOGW("client(" << parent << ")recv oversize packet, close the connection");
+        nread = UV_EPROTO;//close and reconnect as server close
+    }
+    if (nread < 0 && ishandshake) {//the handshake failure is a connect failure
+        theclass->tls_->Reset();
+        uv_read_stop(handle);
+        parent->connectresult(nread);
+        return;
+    }
     if (nread < 0) {
+        if (theclass->tls_) {//handshake again after reconnect
+            theclass->tls_->Reset();
+        }
+        parent->failcalls(UV_ECANCELED);
         if (parent->reconnectcb_) {
             parent->reconnectcb_(NET_EVENT_TYPE_DISCONNECT, parent->reconnect_userdata_);
         }
@@ -370,18 +1433,29 @@ void TCPClient::AfterRecv(uv_stream_t* handle, ssize_t nread, const uv_buf_t* bu
             fprintf(stdout, "Server close,Client %p:%s\n", handle, GetUVError(nread).c_str());
             LOGW("Server close" << GetUVError(nread));
         }
+        parent->tcpclosing_ = true;
         uv_close((uv_handle_t*)handle, AfterClientClose);//close before reconnect
         return;
     }
     parent->send_inl(NULL);
-    if (nread > 0) {
-        theclass->packet_->recvdata((const unsigned char*)buf->base, nread);
+}
+
+bool TCPClient::TLSPlainData(const char* data, size_t len, void* userdata)
+{
+    TcpClientCtx* theclass = (TcpClientCtx*)userdata;
+    TCPClient* parent = (TCPClient*)theclass->parent_server;
+    if (PACKET_ERR_OVERSIZE == theclass->packet_->recvdata((const unsigned char*)data, len)) {
+        ++parent->oversize_count_;
+        LOGW("client(" << parent << ")recv oversize packet, close the connection");
+        return false;
     }
+    return true;
 }
 
 void TCPClient::AfterSend(uv_write_t* req, int status)
 {
     TCPClient* theclass = (TCPClient*)req->data;
+    theclass->releasesend((write_param*)req, status);
     if (status < 0) {
         if (theclass->writeparam_list_.size() > MAXLISTSIZE) {
             FreeWriteParam((write_param*)req);
@@ -395,6 +1469,24 @@ void TCPClient::AfterSend(uv_write_t* req, int status)
     theclass->send_inl(req);
 }
 
+void TCPClient::releasesend(write_param* writep, int status)
+{
+    //uv_write finish in order, so the data is at the read position of write_circularbuf_
+    write_circularbuf_.release(writep->len_);
+    inflight_ -= writep->len_;
+    sent_seq_ += writep->len_;
+    if (status < 0) {//the data is lost
+        sendfail_seq_ = sent_seq_;
+        sendfail_status_ = status;
+    }
+    if (sendwaiters_ > 0) {//space for the blocking Send
+        uv_mutex_lock(&mutex_writebuf_);
+        uv_cond_broadcast(&cond_writebuf_);
+        uv_mutex_unlock(&mutex_writebuf_);
+    }
+    finishsends(0);
+}
+
 /* Fully close a loop */
 void TCPClient::CloseWalkCB(uv_handle_t* handle, void* arg)
 {
@@ -408,16 +1500,23 @@ void TCPClient::AfterClientClose(uv_handle_t* handle)
 {
     TCPClient* theclass = (TCPClient*)handle->data;
     fprintf(stdout, "Close CB handle %p\n", handle);
-    if (handle == (uv_handle_t*)&theclass->client_handle_->tcphandle && theclass->isreconnecting_) {
-        //closed, start reconnect timer
-        int iret = 0;
-        iret = uv_timer_start(&theclass->reconnect_timer_, TCPClient::ReconnectTimer, theclass->repeat_time_, theclass->repeat_time_);
-        if (iret) {
-            uv_close((uv_handle_t*)&theclass->reconnect_timer_, TCPClient::AfterClientClose);
-            LOGE(GetUVError(iret));
-            return;
+    if (handle == (uv_handle_t*)&theclass->client_handle_->tcphandle) {
+        theclass->tcpclosing_ = false;
+        if (theclass->isreconnecting_) {//closed, start reconnect timer
+            theclass->startreconnecttimer();
         }
     }
+    if (theclass->closinghandles_ > 0 && --theclass->closinghandles_ == 0) {//all handles on the shared loop closed
+        theclass->isclosed_ = true;
+        LOGI("client had closed.");
+        if (theclass->closedcb_) {//trigger close cb to user
+            theclass->closedcb_(-1, theclass->closedcb_userdata_); //client id is -1.
+        }
+        uv_mutex_lock(&theclass->mutex_connect_);//the destructor may run as soon as it is set
+        theclass->isreleased_ = true;
+        uv_cond_broadcast(&theclass->cond_released_);
+        uv_mutex_unlock(&theclass->mutex_connect_);
+    }
 }
 
 void TCPClient::StartLog(const char* logpath /*= nullptr*/)
@@ -442,11 +1541,34 @@ void TCPClient::GetPacket(const NetPacket& packethead, const unsigned char* pack
     assert(userdata);
     TcpClientCtx* theclass = (TcpClientCtx*)userdata;
     TCPClient* parent = (TCPClient*)theclass->parent_server;
+    if (packethead.reserve != 0) {//response of Call
+        uv_mutex_lock(&parent->mutex_calls_);
+        auto itfind = parent->calls_.find(packethead.reserve);
+        if (itfind != parent->calls_.end()) {
+            PendingCall pending = itfind->second;
+            parent->call_deadlines_.erase(pending.deadline);
+            parent->calls_.erase(itfind);
+            uv_mutex_unlock(&parent->mutex_calls_);
+            pending.cb(0, packethead, packetdata, pending.userdata);
+            return;
+        }
+        uv_mutex_unlock(&parent->mutex_calls_);
+    }
     if (parent->recvcb_) {//cb the data to user
         parent->recvcb_(packethead, packetdata, parent->recvcb_userdata_);
     }
 }
 
+void TCPClient::GetChunk(const NetPacket& packethead, const unsigned char* chunk, int chunklen, int offset, int chunktype, void* userdata)
+{
+    assert(userdata);
+    TcpClientCtx* theclass = (TcpClientCtx*)userdata;
+    TCPClient* parent = (TCPClient*)theclass->parent_server;
+    if (parent->recvchunkcb_) {//cb the chunk to user
+        parent->recvchunkcb_(packethead, chunk, chunklen, offset, chunktype, parent->recvchunkcb_userdata_);
+    }
+}
+
 void TCPClient::AsyncCB(uv_async_t* handle)
 {
     TCPClient* theclass = (TCPClient*)handle->data;
@@ -456,6 +1578,9 @@ void TCPClient::AsyncCB(uv_async_t* handle)
     }
     //check data to send
     theclass->send_inl(NULL);
+    theclass->finishsends(0);
+    //check the pending calls timeout
+    theclass->startcalltimer();
 }
 
 void TCPClient::send_inl(uv_write_t* req /*= NULL*/)
@@ -468,32 +1593,100 @@ void TCPClient::send_inl(uv_write_t* req /*= NULL*/)
             writeparam_list_.push_back(writep);
         }
     }
+    drainspool();
+    if (client_handle_->tls_ && !client_handle_->tls_->IsHandshakeDone()) {//the data wait for the handshake
+        writetls(NULL, 0, NULL, 0);
+        write_circularbuf_.clearwakeup();//the data stay, let the next Send wake up the loop again
+        return;
+    }
     while (true) {
-        uv_mutex_lock(&mutex_writebuf_);
-        if (write_circularbuf_.empty()) {
-            uv_mutex_unlock(&mutex_writebuf_);
-            break;
+        //write the data of write_circularbuf_ directly, it keep in write_circularbuf_ until AfterSend.
+        //so the ring is also the limit of the data wait for the kernel, the blocking Send waits when it is full
+        const char* span1, *span2;
+        size_t len1, len2;
+        if (0 == write_circularbuf_.peek(inflight_, &span1, &len1, &span2, &len2)) {
+            write_circularbuf_.clearwakeup();//Send will wake up the loop on next data
+            if (0 == write_circularbuf_.peek(inflight_, &span1, &len1, &span2, &len2)) {
+                break;
+            }
         }
-        if (writeparam_list_.empty()) {
-            writep = AllocWriteParam();
-            writep->write_req_.data = this;
-        } else {
-            writep = writeparam_list_.front();
-            writeparam_list_.pop_front();
+        if (client_handle_->tls_) {
+            if (!writetls(span1, len1, span2, len2)) {
+                write_circularbuf_.clearwakeup();
+                break;
+            }
+            continue;
         }
-        writep->buf_.len = write_circularbuf_.read(writep->buf_.base, writep->buf_truelen_); 
-        uv_mutex_unlock(&mutex_writebuf_);
-        int iret = uv_write((uv_write_t*)&writep->write_req_, (uv_stream_t*)&client_handle_->tcphandle, &writep->buf_, 1, AfterSend);
+        writep = getwriteparam();
+        writep->buf_[0] = uv_buf_init((char*)span1, len1);
+        writep->buf_[1] = uv_buf_init((char*)span2, len2);
+        writep->bufcount_ = len2 > 0 ? 2 : 1;
+        writep->len_ = len1 + len2;
+        inflight_ += writep->len_;
+        int iret = uv_write((uv_write_t*)&writep->write_req_, (uv_stream_t*)&client_handle_->tcphandle, writep->buf_, writep->bufcount_, AfterSend);
         if (iret) {
+            inflight_ -= writep->len_;//keep the data in write_circularbuf_, send it after reconnect
             writeparam_list_.push_back(writep);//failure not call AfterSend. so recycle req
             LOGE("client(" << this << ") send error:" << GetUVError(iret));
             fprintf(stdout, "send error. %s-%s\n", uv_err_name(iret), uv_strerror(iret));
+            write_circularbuf_.clearwakeup();
+            break;
         }
     }
+    if (client_handle_->tls_) {//the records tls_ make itself, eg. the key update
+        writetls(NULL, 0, NULL, 0);
+    }
+}
+
+write_param* TCPClient::getwriteparam()
+{
+    write_param* writep = NULL;
+    if (writeparam_list_.empty()) {
+        writep = AllocWriteParam();
+        writep->write_req_.data = this;
+    } else {
+        writep = writeparam_list_.front();
+        writeparam_list_.pop_front();
+    }
+    return writep;
+}
+
+bool TCPClient::writetls(const char* span1, size_t len1, const char* span2, size_t len2)
+{
+    TLSStream* tls = client_handle_->tls_;
+    if ((len1 > 0 && !tls->Write(span1, len1)) || (len2 > 0 && !tls->Write(span2, len2))) {
+        LOGE("client(" << this << ") tls send error:" << tls->GetLastErrMsg());
+        return false;
+    }
+    size_t outlen = tls->OutputSize();
+    if (0 == outlen) {
+        return true;
+    }
+    //the records are written from the tlsbuf_ of writep. len_ is still the len of the spans,
+    //AfterSend release them from write_circularbuf_ as the plaintext write
+    write_param* writep = getwriteparam();
+    if (writep->tlscap_ < outlen) {
+        writep->tlsbuf_ = (char*)realloc(writep->tlsbuf_, outlen);
+        writep->tlscap_ = outlen;
+    }
+    writep->buf_[0] = uv_buf_init(writep->tlsbuf_, tls->TakeOutput(writep->tlsbuf_, outlen));
+    writep->bufcount_ = 1;
+    writep->len_ = len1 + len2;
+    inflight_ += writep->len_;
+    int iret = uv_write((uv_write_t*)&writep->write_req_, (uv_stream_t*)&client_handle_->tcphandle, writep->buf_, writep->bufcount_, AfterSend);
+    if (iret) {
+        inflight_ -= writep->len_;
+        writeparam_list_.push_back(writep);
+        LOGE("client(" << this << ") send error:" << GetUVError(iret));
+        fprintf(stdout, "send error. %s-%s\n", uv_err_name(iret), uv_strerror(iret));
+        return false;
+    }
+    return true;
 }
 
 void TCPClient::Close()
 {
+    connectcancel_ = true;//cancel the ConnectTask not run yet
     if (isclosed_) {
         return;
     }
@@ -505,7 +1698,12 @@ bool TCPClient::StartReconnect(void)
 {
     isreconnecting_ = true;
     client_handle_->tcphandle.data = this;
-    repeat_time_ = 1e3;//1 sec
+    reconnect_attempts_ = 0;
+    disconnect_time_ = uv_hrtime();
+    endpoint_order_.clear();//start a new round from the first endpoint
+    endpoint_pos_ = 0;
+    repeat_time_ = reconnect_policy_.initial_delay;
+    repeat_time_ = nextreconnectdelay();
     return true;
 }
 
@@ -513,56 +1711,347 @@ void TCPClient::StopReconnect(void)
 {
     isreconnecting_ = false;
     client_handle_->tcphandle.data = client_handle_;
-    repeat_time_ = 1e3;//1 sec
-    uv_timer_stop(&reconnect_timer_);
+    repeat_time_ = reconnect_policy_.initial_delay;
+    stopreconnecttimer();
+}
+
+void TCPClient::SetReconnectPolicy(const ReconnectPolicy& policy)
+{
+    reconnect_policy_ = policy;
+    if (reconnect_policy_.initial_delay < 1) {//the backoff double it, 0 would retry a refused peer in a busy loop
+        reconnect_policy_.initial_delay = 1;
+    }
+    if (reconnect_policy_.max_delay < reconnect_policy_.initial_delay) {
+        reconnect_policy_.max_delay = reconnect_policy_.initial_delay;
+    }
+}
+
+void TCPClient::AddReconnectEndpoint(const char* ip, int port, bool isipv6 /*= false*/)
+{
+    if (endpoints_.empty()) {
+        endpoints_.resize(1);//for the endpoint of Connect
+    }
+    Endpoint endpoint;
+    endpoint.ip = ip;
+    endpoint.port = port;
+    endpoint.isipv6 = isipv6;
+    endpoints_.push_back(endpoint);
+}
+
+ReconnectStats TCPClient::GetReconnectStats()
+{
+    uv_mutex_lock(&mutex_connect_);
+    ReconnectStats stats = reconnect_stats_;
+    uv_mutex_unlock(&mutex_connect_);
+    return stats;
+}
+
+int64_t TCPClient::nextreconnectdelay()
+{
+    const int64_t initial = reconnect_policy_.initial_delay;
+    const int64_t maxdelay = reconnect_policy_.max_delay;
+    int64_t delay = initial;
+    switch (reconnect_policy_.jitter) {
+    case RECONNECT_JITTER_DECORRELATED: {
+        int64_t upper = (std::max)(initial, (std::min)(maxdelay, repeat_time_ * 3));
+        delay = std::uniform_int_distribution<int64_t>(initial, upper)(reconnect_rng_);
+        break;
+    }
+    case RECONNECT_JITTER_FULL:
+    default: {
+        for (int i = 0; i < reconnect_attempts_ && delay > 0 && delay < maxdelay; ++i) {
+            delay *= 2;
+        }
+        delay = (std::min)(delay, maxdelay);
+        if (RECONNECT_JITTER_FULL == reconnect_policy_.jitter) {
+            delay = std::uniform_int_distribution<int64_t>(0, delay)(reconnect_rng_);
+        }
+        break;
+    }
+    }
+    ++reconnect_attempts_;
+    return delay;
+}
+
+void TCPClient::nextendpoint()
+{
+    if (endpoints_.size() <= 1) {//only the endpoint of Connect
+        return;
+    }
+    if (endpoint_pos_ >= endpoint_order_.size()) {//new round
+        endpoint_order_.resize(endpoints_.size());
+        for (size_t i = 0; i < endpoint_order_.size(); ++i) {
+            endpoint_order_[i] = i;
+        }
+        if (reconnect_policy_.random_endpoints) {
+            std::shuffle(endpoint_order_.begin(), endpoint_order_.end(), reconnect_rng_);
+        }
+        endpoint_pos_ = 0;
+    }
+    const Endpoint& endpoint = endpoints_[endpoint_order_[endpoint_pos_++]];
+    connectip_ = endpoint.ip;
+    connectport_ = endpoint.port;
+    isIPv6_ = endpoint.isipv6;
+}
+
+void TCPClient::startreconnecttimer()
+{
+    if (sharedloop_) {
+        sharedloop_->StartTimer(this, repeat_time_);
+        return;
+    }
+    int iret = uv_timer_start(&reconnect_timer_, TCPClient::ReconnectTimer, repeat_time_, 0);
+    if (iret) {
+        LOGE(GetUVError(iret));
+    }
+}
+
+void TCPClient::stopreconnecttimer()
+{
+    if (sharedloop_) {
+        sharedloop_->StopTimer(this);
+    } else {
+        uv_timer_stop(&reconnect_timer_);
+    }
 }
 
 void TCPClient::ReconnectTimer(uv_timer_t* handle)
 {
     TCPClient* theclass = (TCPClient*)handle->data;
-    if (!theclass->isreconnecting_) {
+    theclass->reconnectinl();
+}
+
+void TCPClient::reconnectinl()
+{
+    if (!isreconnecting_) {
         return;
     }
-    LOGI("start reconnect...\n");
-    do {
-        int iret = uv_tcp_init(&theclass->loop_, &theclass->client_handle_->tcphandle);
-        if (iret) {
-            LOGE(GetUVError(iret));
-            break;
+    nextendpoint();
+    LOGI("start reconnect to " << connectip_ << ":" << connectport_ << "...\n");
+    int iret = uv_tcp_init(loop_, &client_handle_->tcphandle);
+    if (iret) {
+        LOGE(GetUVError(iret));
+        //reconnect failure, restart timer to trigger reconnect.
+        repeat_time_ = nextreconnectdelay();
+        startreconnecttimer();
+        return;
+    }
+    client_handle_->tcphandle.data = client_handle_;
+    client_handle_->parent_server = this;
+    iret = startconnect();
+    if (iret) {
+        LOGE(GetUVError(iret));
+        //reconnect failure, close the handle then AfterClientClose restart timer.
+        repeat_time_ = nextreconnectdelay();
+        client_handle_->tcphandle.data = this;
+        tcpclosing_ = true;
+        uv_close((uv_handle_t*)&client_handle_->tcphandle, AfterClientClose);
+    }
+}
+
+/*****************************************TCP Client Loop*************************************************************/
+TCPClientLoop::TCPClientLoop()
+    : isrunning_(false), isuseraskforclosed_(false)
+{
+    read_buf_ = uv_buf_init((char*)malloc(BUFFER_SIZE), BUFFER_SIZE);
+    int iret = uv_loop_init(&loop_);
+    if (iret) {
+        errmsg_ = GetUVError(iret);
+        LOGE(errmsg_);
+        fprintf(stdout, "init loop error: %s\n", errmsg_.c_str());
+    }
+    iret = uv_mutex_init(&mutex_tasks_);
+    if (iret) {
+        errmsg_ = GetUVError(iret);
+        LOGE(errmsg_);
+    }
+}
+
+TCPClientLoop::~TCPClientLoop()
+{
+    Close();
+    uv_loop_close(&loop_);
+    uv_mutex_destroy(&mutex_tasks_);
+    free(read_buf_.base);
+}
+
+bool TCPClientLoop::Start()
+{
+    if (isrunning_) {
+        return true;
+    }
+    int iret = uv_async_init(&loop_, &async_handle_, AsyncCB);
+    if (iret) {
+        errmsg_ = GetUVError(iret);
+        LOGE(errmsg_);
+        return false;
+    }
+    async_handle_.data = this;
+    iret = uv_timer_init(&loop_, &timer_);
+    if (iret) {
+        errmsg_ = GetUVError(iret);
+        LOGE(errmsg_);
+        return false;
+    }
+    timer_.data = this;
+    isuseraskforclosed_ = false;
+    iret = uv_thread_create(&threadhandle_, LoopThread, this);
+    if (iret) {
+        errmsg_ = GetUVError(iret);
+        LOGE(errmsg_);
+        return false;
+    }
+    isrunning_ = true;
+    return true;
+}
+
+void TCPClientLoop::Close()
+{
+    if (!isrunning_) {
+        return;
+    }
+    isuseraskforclosed_ = true;
+    uv_async_send(&async_handle_);
+    uv_thread_join(&threadhandle_);
+    isrunning_ = false;
+}
+
+void TCPClientLoop::Post(void (*fun)(void*), void* arg)
+{
+    uv_mutex_lock(&mutex_tasks_);
+    tasks_.push_back(std::make_pair(fun, arg));
+    uv_mutex_unlock(&mutex_tasks_);
+    uv_async_send(&async_handle_);
+}
+
+void TCPClientLoop::LoopThread(void* arg)
+{
+    TCPClientLoop* theclass = (TCPClientLoop*)arg;
+    int iret = uv_run(&theclass->loop_, UV_RUN_DEFAULT);
+    if (iret) {
+        theclass->errmsg_ = GetUVError(iret);
+        LOGE(theclass->errmsg_);
+    }
+    LOGI("client loop(" << theclass << ") had closed.");
+}
+
+void TCPClientLoop::AsyncCB(uv_async_t* handle)
+{
+    TCPClientLoop* theclass = (TCPClientLoop*)handle->data;
+    std::list<std::pair<void (*)(void*), void*> > tasks;
+    uv_mutex_lock(&theclass->mutex_tasks_);
+    tasks.swap(theclass->tasks_);
+    uv_mutex_unlock(&theclass->mutex_tasks_);
+    for (auto it = tasks.begin(); it != tasks.end(); ++it) {
+        it->first(it->second);
+    }
+    if (theclass->isuseraskforclosed_) {
+        uv_walk(&theclass->loop_, CloseWalkCB, theclass);
+    }
+}
+
+void TCPClientLoop::CloseWalkCB(uv_handle_t* handle, void* /*arg*/)
+{
+    if (!uv_is_closing(handle)) {
+        uv_close(handle, NULL);
+    }
+}
+
+void TCPClientLoop::StartTimer(TCPClient* client, uint64_t timeout)
+{
+    StopTimer(client);
+    timer_index_[client] = timers_.insert(std::make_pair(uv_now(&loop_) + timeout, client));
+    starttimer();
+}
+
+void TCPClientLoop::StopTimer(TCPClient* client)
+{
+    auto itfind = timer_index_.find(client);
+    if (itfind == timer_index_.end()) {
+        return;
+    }
+    timers_.erase(itfind->second);
+    timer_index_.erase(itfind);
+}
+
+void TCPClientLoop::starttimer()
+{
+    if (timers_.empty()) {
+        uv_timer_stop(&timer_);
+        return;
+    }
+    uint64_t deadline = timers_.begin()->first;
+    uint64_t now = uv_now(&loop_);
+    uv_timer_start(&timer_, TCPClientLoop::TimerCB, deadline > now ? deadline - now : 0, 0);
+}
+
+void TCPClientLoop::TimerCB(uv_timer_t* handle)
+{
+    TCPClientLoop* theclass = (TCPClientLoop*)handle->data;
+    uint64_t now = uv_now(&theclass->loop_);
+    while (!theclass->timers_.empty() && theclass->timers_.begin()->first <= now) {
+        TCPClient* client = theclass->timers_.begin()->second;
+        theclass->timer_index_.erase(client);
+        theclass->timers_.erase(theclass->timers_.begin());
+        client->reconnectinl();//may StartTimer again
+    }
+    theclass->starttimer();
+}
+
+/*****************************************TCP Client Manager*************************************************************/
+TCPClientManager::TCPClientManager()
+    : next_loop_(0)
+{
+}
+
+TCPClientManager::~TCPClientManager()
+{
+    Close();
+}
+
+bool TCPClientManager::Start(int loopcount /*= 0*/)
+{
+    if (!loops_.empty()) {
+        return true;
+    }
+    if (loopcount <= 0) {
+        uv_cpu_info_t* cpu_infos = NULL;
+        if (0 == uv_cpu_info(&cpu_infos, &loopcount)) {
+            uv_free_cpu_info(cpu_infos, loopcount);
         }
-        theclass->client_handle_->tcphandle.data = theclass->client_handle_;
-        theclass->client_handle_->parent_server = theclass;
-        struct sockaddr* pAddr;
-        if (theclass->isIPv6_) {
-            struct sockaddr_in6 bind_addr;
-            int iret = uv_ip6_addr(theclass->connectip_.c_str(), theclass->connectport_, &bind_addr);
-            if (iret) {
-                LOGE(GetUVError(iret));
-                uv_close((uv_handle_t*)&theclass->client_handle_->tcphandle, NULL);
-                break;
-            }
-            pAddr = (struct sockaddr*)&bind_addr;
-        } else {
-            struct sockaddr_in bind_addr;
-            int iret = uv_ip4_addr(theclass->connectip_.c_str(), theclass->connectport_, &bind_addr);
-            if (iret) {
-                LOGE(GetUVError(iret));
-                uv_close((uv_handle_t*)&theclass->client_handle_->tcphandle, NULL);
-                break;
-            }
-            pAddr = (struct sockaddr*)&bind_addr;
+        if (loopcount <= 0) {
+            loopcount = 1;
         }
-        iret = uv_tcp_connect(&theclass->connect_req_, &theclass->client_handle_->tcphandle, (const sockaddr*)pAddr, AfterConnect);
-        if (iret) {
-            LOGE(GetUVError(iret));
-            uv_close((uv_handle_t*)&theclass->client_handle_->tcphandle, NULL);
-            break;
+    }
+    for (int i = 0; i < loopcount; ++i) {
+        TCPClientLoop* loop = new TCPClientLoop;
+        if (!loop->Start()) {
+            errmsg_ = loop->GetLastErrMsg();
+            delete loop;
+            Close();
+            return false;
         }
-        return;
-    } while (0);
-    //reconnect failure, restart timer to trigger reconnect.
-    uv_timer_stop(handle);
-    theclass->repeat_time_ *= 2;
-    uv_timer_start(handle, TCPClient::ReconnectTimer, theclass->repeat_time_, theclass->repeat_time_);
+        loops_.push_back(loop);
+    }
+    LOGI("client manager start " << loopcount << " loops");
+    return true;
+}
+
+void TCPClientManager::Close()
+{
+    for (auto it = loops_.begin(); it != loops_.end(); ++it) {
+        delete *it;
+    }
+    loops_.clear();
+}
+
+TCPClient* TCPClientManager::CreateClient(char packhead, char packtail)
+{
+    if (loops_.empty()) {
+        errmsg_ = "client manager not start.";
+        LOGE(errmsg_);
+        return NULL;
+    }
+    return new TCPClient(packhead, packtail, loops_[next_loop_++ % loops_.size()]);
 }
 }
\ No newline at end of file
@@ -29,9 +29,16 @@
 #define TCPCLIENT_H
 #include <string>
 #include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <future>
+#include <random>
 #include "uv.h"
 #include "net/packet_sync.h"
-#include "pod_circularbuffer.h"
+#include "net/tls_stream.h"
+#include "mpsc_ringbuffer.h"
+#include "disk_spool.h"
 #ifndef BUFFER_SIZE
 #define BUFFER_SIZE (1024*10)
 #endif
@@ -43,6 +50,7 @@ typedef struct _tcpclient_ctx {
     uv_tcp_t tcphandle;//store this on data
     uv_write_t write_req;//store this on data
     PacketSync* packet_;//store this on userdata
+    TLSStream* tls_;//NULL when not SetTLS
     uv_buf_t read_buf_;
     int clientid;
     void* parent_server;//store TCPClient point
@@ -52,21 +60,113 @@ void FreeTcpClientCtx(TcpClientCtx* ctx);
 
 typedef struct _write_param{//param of uv_write
 	uv_write_t write_req_;//store TCPClient on data
-	uv_buf_t buf_;
-	int buf_truelen_;
+	uv_buf_t buf_[2];//spans of write_circularbuf_, no copy. release after write finish
+	int bufcount_;
+	size_t len_;//total len of the spans of write_circularbuf_
+	char* tlsbuf_;//TLS records of the spans, buf_[0] point to it when TLS
+	size_t tlscap_;
 }write_param;
 write_param * AllocWriteParam(void);
 void FreeWriteParam(write_param* param);
 
+typedef struct _call_result {//result of TCPClient::Call
+    int status;//0 succeed, UV_ETIMEDOUT or UV_ECANCELED
+    NetPacket packethead;//the response packet head
+    std::string data;//the response packet data
+} CallResult;
+
+typedef enum {//jitter of the reconnect delay. n is the attempt count from 0
+    RECONNECT_JITTER_NONE = 0,//delay = min(max_delay, initial_delay * 2^n)
+    RECONNECT_JITTER_FULL,//delay = random[0, min(max_delay, initial_delay * 2^n)]
+    RECONNECT_JITTER_DECORRELATED,//delay = min(max_delay, random[initial_delay, last delay * 3])
+} RECONNECT_JITTER_TYPE;
+
+typedef struct _reconnect_policy {//see TCPClient::SetReconnectPolicy
+    int64_t initial_delay;//ms, default 1000. at least 1, a 0 delay never grows
+    int64_t max_delay;//ms, default 60000
+    int jitter;//RECONNECT_JITTER_TYPE, default RECONNECT_JITTER_NONE
+    bool random_endpoints;//false try the endpoints in order every round, true in random order. default false
+} ReconnectPolicy;
+
+typedef struct _reconnect_stats {//see TCPClient::GetReconnectStats
+    int64_t count;//times of reconnect succeed
+    int64_t last_ms;//time-to-reconnect(from disconnect to reconnect succeed) of the last reconnect
+    int64_t max_ms;//max time-to-reconnect
+    int64_t total_ms;//total time-to-reconnect, total_ms/count is the average
+    int last_attempts;//connect attempts of the last reconnect
+} ReconnectStats;
+
+class TCPClient;
+/*************************************************
+Fun: A loop thread shared by many TCPClient, create by TCPClientManager.
+     All libuv operations of the clients on it run in this thread.
+*************************************************/
+class TCPClientLoop
+{
+public:
+    TCPClientLoop();
+    virtual ~TCPClientLoop();
+    bool Start();//init the loop and start the loop thread
+    void Close();//close all handle and wait the loop thread exit. the clients on it must be deleted before.
+    uv_loop_t* GetLoop() {
+        return &loop_;
+    }
+    //run fun(arg) on the loop thread. can call from any thread
+    void Post(void (*fun)(void*), void* arg);
+    //the recv buffer shared by the clients on this loop, data is parsed in AfterRecv synchronously
+    uv_buf_t* GetReadBuf() {
+        return &read_buf_;
+    }
+    //shared reconnect timer, trigger TCPClient::reconnectinl after timeout ms. call on the loop thread
+    void StartTimer(TCPClient* client, uint64_t timeout);
+    void StopTimer(TCPClient* client);
+
+    const char* GetLastErrMsg() const {
+        return errmsg_.c_str();
+    };
+private:
+    static void LoopThread(void* arg);
+    static void AsyncCB(uv_async_t* handle);
+    static void TimerCB(uv_timer_t* handle);
+    static void CloseWalkCB(uv_handle_t* handle, void* arg);
+    void starttimer();//arm timer_ to the earliest deadline
+
+    uv_loop_t loop_;
+    uv_async_t async_handle_;
+    uv_thread_t threadhandle_;
+    bool isrunning_;
+    bool isuseraskforclosed_;
+
+    uv_mutex_t mutex_tasks_;//mutex of tasks_
+    std::list<std::pair<void (*)(void*), void*> > tasks_;//task to run on the loop thread
+
+    uv_timer_t timer_;
+    std::multimap<uint64_t, TCPClient*> timers_;//deadline(ms)-client
+    std::unordered_map<TCPClient*, std::multimap<uint64_t, TCPClient*>::iterator> timer_index_;
+
+    uv_buf_t read_buf_;
+    std::string errmsg_;
+private:// no copy
+    TCPClientLoop(const TCPClientLoop&);
+    TCPClientLoop& operator = (const TCPClientLoop&);
+};
+
 /*************************************************
 Fun: TCP Client
 Usage：
 Start the log fun(optional): StartLog
 Set the call back fun      : SetRecvCB/SetClosedCB/SetReconnectCB
-Connect Server             : Connect/Connect6
+Connect Server             : Connect/Connect6 return as soon as the connect finish(at most 10s),
+                             or ConnectAsync/ConnectAsync6 which return at once and report by ConnectCB.
+                             Connect/ConnectAsync accept a hostname too, it is resolved by uv_getaddrinfo and cached
 SetNoDelay(optional)       : SetNoDelay
 SetKeepAlive(optional)     : SetKeepAlive
-Send data                  : Send
+Reconnect(optional)        : SetReconnectPolicy/AddReconnectEndpoint, before Connect. GetReconnectStats for the metric
+Send data                  : Send(block), TrySend(never block) or SendAsync(cb when the data reach the kernel)
+                             each has a gather form taking uv_buf_t spans, send a PacketGather frame without packing it
+TLS(optional)              : SetTLS, before Connect. the connect finish after the handshake, reconnect resume the session
+Spool(optional)            : SetSpool, before Connect. Send/TrySend data go to disk while disconnected, replay after connect
+Request/response(optional) : Call. the response is matched by NetPacket.reserve
 Close Server               : Close. this fun only set the close command, call IsClosed to verify real closed.
                              or verify in the call back fun which SetRecvCB set.
 Stop the log fun(optional) : StopLog
@@ -82,11 +182,41 @@ public:
 	static void StopLog();
 public:
     void SetRecvCB(ClientRecvCB pfun, void* userdata);//set recv cb
+    void SetRecvChunkCB(ClientRecvChunkCB pfun, void* userdata);//set recv chunk cb, work with SetStreamThreshold
     void SetClosedCB(TcpCloseCB pfun, void* userdata);//set close cb.
 	void SetReconnectCB(ReconnectCB pfun, void* userdata);//set reconnect cb
-    bool Connect(const char* ip, int port);//connect the server, ipv4
+    //connect the server, ipv4 or hostname. hostname is resolved on the loop thread and cached(see SetDNSCacheTTL),
+    //when not in cache all the addresses are tried Happy Eyeballs style(ipv6 and ipv4 by turns, 250ms apart), first one wins
+    bool Connect(const char* ip, int port);
     bool Connect6(const char* ip, int port);//connect the server, ipv6
-    int  Send(const char* data, std::size_t len);//send data to server
+    //connect the server without wait. cb(can be NULL) is called on the loop thread with the result.
+    bool ConnectAsync(const char* ip, int port, ConnectCB cb, void* userdata);//ipv4 or hostname
+    bool ConnectAsync6(const char* ip, int port, ConnectCB cb, void* userdata);//ipv6
+    bool ConnectAsync(const struct sockaddr* addr, ConnectCB cb, void* userdata);//sockaddr_in or sockaddr_in6
+    int  Send(const char* data, std::size_t len);//send data to server. block until all data accepted or close
+    //block at most timeout ms(<0 wait forever) for the send buffer space. return the len accepted
+    int  Send(const char* data, std::size_t len, int64_t timeout);
+    //never block. return the len accepted, the rest is up to the caller
+    int  TrySend(const char* data, std::size_t len);
+    //never block. accept all data or nothing(return false, send buffer is full).
+    //cb(can be NULL) is called on the loop thread when all data written to the kernel, or with error status
+    bool SendAsync(const char* data, std::size_t len, SendCB cb, void* userdata);
+    //gather forms of the above: the nbufs spans are sent as one contiguous piece of data, eg. the PacketFrame of PacketGather.
+    //the spans are copied into the send buffer before return, the caller may reuse them as soon as the call return.
+    int  Send(const uv_buf_t* bufs, int nbufs, int64_t timeout = -1);
+    int  TrySend(const uv_buf_t* bufs, int nbufs);
+    bool SendAsync(const uv_buf_t* bufs, int nbufs, SendCB cb, void* userdata);
+
+    //Send a request and wait for the response asynchronously.
+    //packet.reserve is stamped with a correlation id, then packet&payload pack by PacketGather and send.
+    //The server must echo reserve in the response. The response is delivered to cb(not to the SetRecvCB cb) on the loop thread,
+    //or cb get UV_ETIMEDOUT after timeout ms, UV_ECANCELED when disconnect or close.
+    //the timeout covers the wait for the send buffer space too, Call block at most timeout ms.
+    //the frame is queued as a whole or not at all. a frame bigger than the send buffer needs SetSpool, else Call return false.
+    //return false if send failure, cb will not be called.
+    bool Call(NetPacket& packet, const unsigned char* payload, uint64_t timeout, ClientCallCB cb, void* userdata);
+    //future form of Call. the future get the CallResult.
+    std::future<CallResult> Call(NetPacket& packet, const unsigned char* payload, uint64_t timeout);
     void Close();//send close command. verify IsClosed for real closed
     bool IsClosed() {//verify if real closed
         return isclosed_;
@@ -98,12 +228,76 @@ public:
 	//delay is the initial delay in seconds, ignored when enable is zero
     bool SetKeepAlive(int enable, unsigned int delay);
 
+    //expire time(ms) of the hostname resolve result, the cache is shared by all TCPClient. default 60000, 0 disable the cache
+    static void SetDNSCacheTTL(int64_t ttl);
+
+    //spool the data of Send/TrySend to memory-mapped segment files in dir while disconnected,
+    //or when the send buffer hold more than threshold bytes(0 means the whole buffer), and replay them in order after connect.
+    //Send never block on the network then. maxbytes limit the spool(0 no limit), Send/TrySend return 0 when it is full.
+    //SendAsync fail while the spool is not empty. call before Connect
+    bool SetSpool(const char* dir, size_t threshold = 0, uint64_t maxbytes = 0);
+    uint64_t GetSpoolSize() const;//bytes wait in the spool
+
+    //Talk TLS to the server. cafile(PEM) verify the server certificate, NULL not verify(test only).
+    //servername is send by SNI and match the certificate, can be NULL. call before Connect
+    bool SetTLS(const char* cafile, const char* servername = NULL);
+    //the handshake of the current connection resume the last session(no full handshake)
+    bool IsTLSResumed() const {
+        return client_handle_->tls_ && client_handle_->tls_->IsResumed();
+    }
+
+    //Set the delay between reconnect attempts(capped exponential backoff with jitter). call before Connect
+    void SetReconnectPolicy(const ReconnectPolicy& policy);
+    //Add a failover endpoint. reconnect try the Connect endpoint and these ones by turns. call before Connect
+    void AddReconnectEndpoint(const char* ip, int port, bool isipv6 = false);
+    //time-to-reconnect metric. update on the loop thread, return a snapshot
+    ReconnectStats GetReconnectStats();
+
+    //The max packet data length accept from server. the connection is closed(and reconnect) on bigger packet.
+    void SetMaxFrameSize(int maxsize);
+    //Packet which data length >= threshold will be delivered to the cb which SetRecvChunkCB set
+    //chunk by chunk as they arrive. 0 disable. without SetRecvChunkCB the packet is delivered whole to the recv cb.
+    //an AEAD encrypted packet is delivered chunk by chunk only after the whole packet is authenticated.
+    void SetStreamThreshold(int threshold);
+    //Compress the packet data Call send when its length >= threshold and it gets smaller(see net/packet_compress.h).
+    //level is the zlib level 1-9, -1 default. 0 threshold disable. the server decompress it before the cb.
+    void SetCompression(int threshold, int level = -1);
+    //Encrypt the packet data Call send with the send key of keyring(AEAD, see net/packet_aead.h), the auth tag replace the check.
+    //packet from server must be encrypted by a key of keyring, others are dropped. empty keyring disable. must call before Connect.
+    //packet Send by yourself is sent as it is, encrypt it by a PacketSealer with the same keyring.
+    void SetEncryption(const PacketKeyring& keyring);
+    //count of the connection closed because of oversize packet
+    int64_t GetOversizeCount() const {
+        return oversize_count_;
+    }
+
     const char* GetLastErrMsg() const {
         return errmsg_.c_str();
     };
 protected:
+    //run on the loop of TCPClientManager, create by TCPClientManager::CreateClient. NULL loop run on its own loop thread
+    TCPClient(char packhead, char packtail, TCPClientLoop* loop);
     bool init();
     void closeinl();//real close fun
+    bool connectinl(const char* ip, int port, bool isipv6, ConnectCB cb, void* userdata);
+    int startconnect();//uv_tcp_connect to connectip_:connectport_
+    void connectresult(int status);//result of connect, by AfterConnect or the race
+    void connectdone(int status);//connect finish, after the TLS handshake when TLS
+    //connectip_ is a hostname: connect to the address in the dns cache, or resolve then race the addresses
+    struct ConnectRace;
+    int startresolve();
+    void finishrace(int status);
+    void cancelrace();
+    static void AfterResolve(uv_getaddrinfo_t* req, int status, struct addrinfo* res);
+    static void startattempt(ConnectRace* race);//connect to the next address of the race
+    static void RaceConnectCB(uv_connect_t* req, int status);
+    static void RaceTimerCB(uv_timer_t* handle);
+    bool waitconnect();//wait for connect finish
+    void finishconnect(int status);//trigger the ConnectAsync cb
+    void reconnectinl();//reconnect timer timeout
+    void startreconnecttimer();
+    void stopreconnecttimer();
+    static void ConnectTask(void* arg);//connect on the shared loop thread
     bool run(int status = UV_RUN_DEFAULT);
 	void send_inl(uv_write_t* req = NULL);//real send data fun
     static void ConnectThread(void* arg);//connect thread,run until use close the client
@@ -116,7 +310,20 @@ protected:
 	static void AsyncCB(uv_async_t* handle);//async close
 	static void CloseWalkCB(uv_handle_t* handle, void* arg);//close all handle in loop
     static void GetPacket(const NetPacket& packethead, const unsigned char* packetdata, void* userdata);
+    static void GetChunk(const NetPacket& packethead, const unsigned char* chunk, int chunklen, int offset, int chunktype, void* userdata);
 	static void ReconnectTimer(uv_timer_t* handle);
+    static void CallTimer(uv_timer_t* handle);//timeout the pending calls
+    static void FutureCallCB(int status, const NetPacket& packethead, const unsigned char* buf, void* userdata);
+    void startcalltimer();//arm call_timer_ to the earliest deadline
+    void failcalls(int status);//finish all pending calls with error status
+    void finishsends(int status);//trigger SendAsync cb which data had sent, all of them when status is not 0
+    void releasesend(write_param* writep, int status);//release the data of finish write to write_circularbuf_
+    int spoolinl(const uv_buf_t* bufs, int nbufs, std::size_t len);//1 spooled, 0 not spool(send as usual), -1 spool is full
+    void drainspool();//move the spool data to write_circularbuf_ when connected, loop thread only
+    write_param* getwriteparam();
+    //encrypt the spans(can be empty), write them with the pending handshake records
+    bool writetls(const char* span1, size_t len1, const char* span2, size_t len2);
+    static bool TLSPlainData(const char* data, size_t len, void* userdata);//the plaintext of tls_ to packet_
 
 private:
     enum {
@@ -127,23 +334,77 @@ private:
     };
 	TcpClientCtx *client_handle_;
 	uv_async_t async_handle_;
-    uv_loop_t loop_;
-    bool isclosed_;
-    bool isuseraskforclosed_;
+    uv_loop_t ownloop_;//the loop when not run on TCPClientManager
+    uv_loop_t* loop_;//ownloop_ or the loop of sharedloop_
+    TCPClientLoop* sharedloop_;//NULL when run on ownloop_
+    std::atomic<bool> isclosed_;
+    std::atomic<bool> isuseraskforclosed_;
+    int closinghandles_;//handles wait to close on shared loop
+    bool tcpclosing_;//tcphandle is closing for reconnect
+    bool isconnectpending_;//ConnectTask is posted but not finish, protect by mutex_connect_
+    std::atomic<bool> connectcancel_;//Close cancel the pending ConnectTask
+    bool isreleased_;//no handle of this client open on the shared loop, protect by mutex_connect_
+
+    ConnectCB connectcb_;
+    void* connectcb_userdata_;
 
     uv_thread_t connect_threadhandle_;
     uv_connect_t connect_req_;
+    ConnectRace* race_;//resolving or racing the hostname, NULL when not
+    bool iscachedconnect_;//connect to the address in the dns cache
 
-    int connectstatus_;
+    std::atomic<int> connectstatus_;//written by the loop thread, read by spoolinl on the Send threads
+    uv_mutex_t mutex_connect_;//mutex of cond_connect_ and reconnect_stats_
+    uv_cond_t cond_connect_;//signal when connectstatus_ leave CONNECT_DIS, wake up the blocking Connect
+    uv_cond_t cond_released_;//signal when isreleased_ set or isconnectpending_ clear, wake up the destructor
 
     //send param
-    uv_mutex_t mutex_writebuf_;//mutex of writebuf_list_
+    uv_mutex_t mutex_writebuf_;//mutex of cond_writebuf_ and sendcbs_. Send not lock it unless it must wait
+    uv_cond_t cond_writebuf_;//signal when write_circularbuf_ has space
+    std::atomic<int> sendwaiters_;//count of Send wait on cond_writebuf_
 	std::list<write_param*> writeparam_list_;//Availa write_t
-    PodCircularBuffer<char> write_circularbuf_;//the data prepare to send
+    MpscRingBuffer write_circularbuf_;//the data prepare to send. lock-free between Send threads and the loop thread, mirrored while under MIRROR_MEMORY_MAX_COUNT
+    size_t inflight_;//len of write_circularbuf_ passed to uv_write but not finish, loop thread only
+    //SendAsync cb. the data is [startseq, endseq) of the whole send stream
+    typedef struct _send_cb {
+        uint64_t startseq;
+        uint64_t endseq;
+        SendCB cb;
+        void* userdata;
+    } SendCBParam;
+    std::map<uint64_t, SendCBParam> sendcbs_;//endseq-cb, protect by mutex_writebuf_
+    uint64_t sent_seq_;//len had finished by AfterSend, loop thread only
+    DiskSpool* spool_;//NULL when not SetSpool
+    size_t spool_threshold_;
+    size_t spool_offset_;//len of the spool front record moved to write_circularbuf_, loop thread only
+    uv_mutex_t mutex_spool_;//spoolinl decide and append under it, drainspool move and pop under it, so the order decision is atomic
+    TLSContext* tls_ctx_;//NULL when not SetTLS
+    std::string tls_servername_;
+    uint64_t sendfail_seq_;//endseq of the last failure write, loop thread only
+    int sendfail_status_;
 
     ClientRecvCB recvcb_;
     void* recvcb_userdata_;
 
+    //pending calls. key is correlation id
+    typedef struct _pending_call {
+        ClientCallCB cb;
+        void* userdata;
+        std::multimap<uint64_t, int32_t>::iterator deadline;
+    } PendingCall;
+    std::unordered_map<int32_t, PendingCall> calls_;
+    std::multimap<uint64_t, int32_t> call_deadlines_;//deadline(ms)-correlation id
+    uv_mutex_t mutex_calls_;//mutex of calls_ and call_deadlines_
+    int32_t call_id_;//last correlation id
+    uv_timer_t call_timer_;//one timer for all pending calls
+
+    ClientRecvChunkCB recvchunkcb_;
+    void* recvchunkcb_userdata_;
+    int64_t oversize_count_;
+    int compress_threshold_;//packet data length to compress, 0 disable
+    int compress_level_;
+    PacketSealer sealer_;//encrypt Call packet, its keyring decrypt the received packet too
+
     TcpCloseCB closedcb_;
     void* closedcb_userdata_;
 
@@ -152,8 +413,23 @@ private:
 	bool StartReconnect(void);
 	void StopReconnect(void);
 	uv_timer_t reconnect_timer_;
-	bool isreconnecting_;
-	int64_t repeat_time_;//repeat reconnect time. y=2x(x=1..)
+	std::atomic<bool> isreconnecting_;//read by spoolinl on the Send threads
+	int64_t repeat_time_;//delay of the next reconnect, by nextreconnectdelay
+    int64_t nextreconnectdelay();//delay of the next attempt by reconnect_policy_
+    void nextendpoint();//set connectip_,connectport_,isIPv6_ to the next failover endpoint
+    ReconnectPolicy reconnect_policy_;
+    typedef struct _endpoint {
+        std::string ip;
+        int port;
+        bool isipv6;
+    } Endpoint;
+    std::vector<Endpoint> endpoints_;//[0] is the endpoint of Connect, others add by AddReconnectEndpoint
+    std::vector<size_t> endpoint_order_;//index of endpoints_, try order of this round
+    size_t endpoint_pos_;//next of endpoint_order_
+    int reconnect_attempts_;//attempts of this reconnect
+    uint64_t disconnect_time_;//uv_hrtime of disconnect
+    ReconnectStats reconnect_stats_;//protect by mutex_connect_
+    std::mt19937 reconnect_rng_;//for jitter and random endpoints
 
     std::string connectip_;
     int connectport_;
@@ -162,6 +438,38 @@ private:
 
     char PACKET_HEAD;//protocol head
     char PACKET_TAIL;//protocol tail
+
+    friend class TCPClientLoop;
+    friend class TCPClientManager;
+};
+
+/*************************************************
+Fun: Run many TCPClient on a few shared loop threads, instead of one loop thread per TCPClient
+Usage:
+Start the loop threads     : Start. loopcount 0 means the count of cpu
+Create client              : CreateClient. use it as a normal TCPClient, delete it when no longer use.
+                             ConnectAsync is recommended for connecting many clients in parallel.
+Stop the loop threads      : Close. all the clients must be deleted before.
+*************************************************/
+class TCPClientManager
+{
+public:
+    TCPClientManager();
+    virtual ~TCPClientManager();
+    bool Start(int loopcount = 0);
+    void Close();
+    TCPClient* CreateClient(char packhead, char packtail);//the client is assigned to the loops by turns
+
+    const char* GetLastErrMsg() const {
+        return errmsg_.c_str();
+    };
+private:
+    std::vector<TCPClientLoop*> loops_;
+    unsigned int next_loop_;
+    std::string errmsg_;
+private:// no copy
+    TCPClientManager(const TCPClientManager&);
+    TCPClientManager& operator = (const TCPClientManager&);
 };
 }
 
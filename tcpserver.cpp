@@ -12,6 +12,8 @@ TCPServer::TCPServer(char packhead, char packtail)
     , newconcb_(nullptr), newconcb_userdata_(nullptr), closedcb_(nullptr), closedcb_userdata_(nullptr)
     , isclosed_(true), isuseraskforclosed_(false)
     , startstatus_(START_DIS), protocol_(NULL)
+    , max_frame_size_(PACKET_MAX_FRAME_SIZE), stream_threshold_(0)
+    , compress_threshold_(0), compress_level_(-1), oversize_count_(0), tls_ctx_(NULL)
 {
     int iret = uv_loop_init(&loop_);
     if (iret) {
@@ -25,6 +27,12 @@ TCPServer::TCPServer(char packhead, char packtail)
         LOGE(errmsg_);
         fprintf(stdout, "uv_mutex_init error: %s\n", errmsg_.c_str());
     }
+    iret = uv_mutex_init(&mutex_respond_);
+    if (iret) {
+        errmsg_ = GetUVError(iret);
+        LOGE(errmsg_);
+        fprintf(stdout, "uv_mutex_init error: %s\n", errmsg_.c_str());
+    }
 }
 
 
@@ -33,6 +41,7 @@ TCPServer::~TCPServer()
     Close();
     uv_thread_join(&start_threadhandle_);
     uv_mutex_destroy(&mutex_clients_);
+    uv_mutex_destroy(&mutex_respond_);
     uv_loop_close(&loop_);
     for (auto it = avai_tcphandle_.begin(); it != avai_tcphandle_.end(); ++it) {
         FreeTcpClientCtx(*it);
@@ -43,6 +52,11 @@ TCPServer::~TCPServer()
         FreeWriteParam(*it);
     }
     writeparam_list_.clear();
+    for (auto it = respond_list_.begin(); it != respond_list_.end(); ++it) {
+        FreeWriteParam(it->second);
+    }
+    respond_list_.clear();
+    delete tls_ctx_;
     LOGI("tcp server exit.");
 }
 
@@ -59,6 +73,14 @@ bool TCPServer::init()
     }
     async_handle_close_.data = this;
 
+    iret = uv_async_init(&loop_, &async_handle_respond_, AsyncRespondCB);
+    if (iret) {
+        errmsg_ = GetUVError(iret);
+        LOGE(errmsg_);
+        return false;
+    }
+    async_handle_respond_.data = this;
+
     iret = uv_tcp_init(&loop_, &tcp_handle_);
     if (iret) {
         errmsg_ = GetUVError(iret);
@@ -291,6 +313,23 @@ void TCPServer::AcceptConnection(uv_stream_t* server, int status)
     }
     tmptcp->packet_->SetPacketCB(GetPacket, tmptcp);
     tmptcp->packet_->Start(tcpsock->packet_head, tcpsock->packet_tail);
+    tmptcp->packet_->SetMaxFrameSize(tcpsock->max_frame_size_);
+    tmptcp->packet_->SetStreamThreshold(tcpsock->stream_threshold_);
+    tmptcp->packet_->SetPacketChunkCB(tcpsock->stream_threshold_ > 0 ? GetChunk : NULL, tmptcp);
+    tmptcp->packet_->SetKeyring(tcpsock->sealer_.GetKeyring().Empty() ? NULL : &tcpsock->sealer_.GetKeyring());
+    if (tcpsock->tls_ctx_) {//the handshake go on in AfterRecv
+        if (!tmptcp->tls_) {
+            tmptcp->tls_ = new TLSStream;
+        }
+        if (!tmptcp->tls_->Start(*tcpsock->tls_ctx_, true, NULL)) {
+            uv_close((uv_handle_t*)&tmptcp->tcphandle, TCPServer::RecycleTcpHandle);
+            tcpsock->errmsg_ = tmptcp->tls_->GetLastErrMsg();
+            LOGE(tcpsock->errmsg_);
+            return;
+        }
+    } else if (tmptcp->tls_) {
+        tmptcp->tls_->Reset();
+    }
     iret = uv_read_start((uv_stream_t*)&tmptcp->tcphandle, AllocBufferForRecv, AfterRecv);
     if (iret) {
         uv_close((uv_handle_t*)&tmptcp->tcphandle, TCPServer::RecycleTcpHandle);
@@ -421,6 +460,52 @@ void TCPServer::AsyncCloseCB(uv_async_t* handle)
         return;
 }
 
+bool TCPServer::Respond(const ResponderToken& token, NetPacket& packet, const unsigned char* data)
+{
+    if (isclosed_ || isuseraskforclosed_) {
+        errmsg_ = "server is closed.";
+        return false;
+    }
+    packet.reserve = token.correlation;
+    //pack on the caller thread, not the loop. the data is copied once, into the buffer uv_write use
+    std::string zbuf, sbuf;
+    const unsigned char* body = sealer_.Seal(packet, PacketCompress(packet, data, compress_threshold_, compress_level_, zbuf), sbuf);
+    if (!body) {
+        errmsg_ = "encrypt packet failure.";
+        LOGE(errmsg_);
+        return false;
+    }
+    PacketFrame frame;
+    PacketGather(packet, body, frame);
+    write_param* writep = AllocWriteParam();
+    FillWriteParam(writep, frame.bufs, frame.nbufs);
+    uv_mutex_lock(&mutex_respond_);
+    respond_list_.push_back(std::make_pair(token.clientid, writep));
+    uv_mutex_unlock(&mutex_respond_);
+    uv_async_send(&async_handle_respond_);
+    return true;
+}
+
+void TCPServer::AsyncRespondCB(uv_async_t* handle)
+{
+    TCPServer* theclass = (TCPServer*)handle->data;
+    std::list<std::pair<int, write_param*> > responds;
+    uv_mutex_lock(&theclass->mutex_respond_);
+    responds.swap(theclass->respond_list_);
+    uv_mutex_unlock(&theclass->mutex_respond_);
+    uv_mutex_lock(&theclass->mutex_clients_);
+    for (auto it = responds.begin(); it != responds.end(); ++it) {
+        auto itfind = theclass->clients_list_.find(it->first);
+        if (itfind == theclass->clients_list_.end()) {
+            LOGW("client(" << it->first << ") had closed, drop the response");
+            FreeWriteParam(it->second);
+            continue;
+        }
+        theclass->writeinl(it->second, itfind->second->GetTcpHandle());
+    }
+    uv_mutex_unlock(&theclass->mutex_clients_);
+}
+
 void TCPServer::Close()
 {
     if (isclosed_) {
@@ -461,7 +546,19 @@ bool TCPServer::broadcast(const std::string& senddata, std::vector<int> excludei
 
 bool TCPServer::sendinl(const std::string& senddata, TcpClientCtx* client)
 {
-    if (senddata.empty()) {
+    uv_buf_t buf;
+    buf.base = (char*)senddata.data();
+    buf.len = senddata.length();
+    return sendinl(&buf, 1, client);
+}
+
+bool TCPServer::sendinl(const uv_buf_t* bufs, int nbufs, TcpClientCtx* client)
+{
+    std::size_t len = 0;
+    for (int i = 0; i < nbufs; ++i) {
+        len += bufs[i].len;
+    }
+    if (0 == len) {
         LOGA("send data is empty.");
         return true;
     }
@@ -472,12 +569,22 @@ bool TCPServer::sendinl(const std::string& senddata, TcpClientCtx* client)
         writep = writeparam_list_.front();
         writeparam_list_.pop_front();
     }
-    if (writep->buf_truelen_ < senddata.length()) {
-        writep->buf_.base = (char*)realloc(writep->buf_.base, senddata.length());
-        writep->buf_truelen_ = senddata.length();
+    FillWriteParam(writep, bufs, nbufs);
+    return writeinl(writep, client);
+}
+
+bool TCPServer::writeinl(write_param* writep, TcpClientCtx* client)
+{
+    if (client->tls_ && client->tls_->IsStarted()) {
+        if (!encrypttls(writep, client)) {
+            writeparam_list_.push_back(writep);
+            return false;
+        }
+        if (0 == writep->buf_.len) {
+            writeparam_list_.push_back(writep);
+            return true;
+        }
     }
-    memcpy(writep->buf_.base, senddata.data(), senddata.length());
-    writep->buf_.len = senddata.length();
     writep->write_req_.data = client;
     int iret = uv_write((uv_write_t*)&writep->write_req_, (uv_stream_t*)&client->tcphandle, &writep->buf_, 1, AfterSend);//发送
     if (iret) {
@@ -490,11 +597,106 @@ bool TCPServer::sendinl(const std::string& senddata, TcpClientCtx* client)
     return true;
 }
 
+bool TCPServer::recvtls(TcpClientCtx* client, const char* data, size_t len)
+{
+    bool ishandshake = !client->tls_->IsHandshakeDone();
+    bool isok = client->tls_->Feed(data, len, TLSPlainData, client);
+    flushtls(client);//the handshake records and session tickets, or the alert on error
+    if (!isok) {
+        LOGW("client(" << client->clientid << ")tls error: " << client->tls_->GetLastErrMsg());
+        return false;
+    }
+    if (ishandshake && client->tls_->IsHandshakeDone()) {
+        LOGI("client(" << client->clientid << ")tls handshake finish" << (client->tls_->IsResumed() ? ", session resumed" : ""));
+    }
+    return true;
+}
+
+bool TCPServer::encrypttls(write_param* writep, TcpClientCtx* client)
+{
+    TLSStream* tls = client->tls_;
+    if (writep->buf_.len > 0 && !tls->Write(writep->buf_.base, writep->buf_.len)) {//the data before the handshake finish is dropped too
+        errmsg_ = tls->GetLastErrMsg();
+        LOGE("client(" << client->clientid << ") tls send error:" << errmsg_);
+        return false;
+    }
+    size_t outlen = tls->OutputSize();
+    if ((size_t)writep->buf_truelen_ < outlen) {
+        writep->buf_.base = (char*)realloc(writep->buf_.base, outlen);
+        writep->buf_truelen_ = outlen;
+    }
+    writep->buf_.len = tls->TakeOutput(writep->buf_.base, outlen);
+    return true;
+}
+
+void TCPServer::flushtls(TcpClientCtx* client)
+{
+    if (0 == client->tls_->OutputSize()) {
+        return;
+    }
+    write_param* writep = NULL;
+    if (writeparam_list_.empty()) {
+        writep = AllocWriteParam();
+    } else {
+        writep = writeparam_list_.front();
+        writeparam_list_.pop_front();
+    }
+    writep->buf_.len = 0;
+    writeinl(writep, client);
+}
+
+bool TCPServer::TLSPlainData(const char* data, size_t len, void* userdata)
+{
+    TcpClientCtx* theclass = (TcpClientCtx*)userdata;
+    if (PACKET_ERR_OVERSIZE == theclass->packet_->recvdata((const unsigned char*)data, len)) {
+        TCPServer* parent = (TCPServer*)theclass->parent_server;
+        ++parent->oversize_count_;
+        LOGW("client(" << theclass->clientid << ")send oversize packet, close it");
+        return false;
+    }
+    return true;
+}
+
 void TCPServer::SetPortocol(TCPServerProtocolProcess* pro)
 {
     protocol_ = pro;
 }
 
+void TCPServer::SetMaxFrameSize(int maxsize)
+{
+    max_frame_size_ = maxsize;
+}
+
+void TCPServer::SetStreamThreshold(int threshold)
+{
+    stream_threshold_ = threshold;
+}
+
+bool TCPServer::SetTLS(const char* certfile, const char* keyfile)
+{
+    TLSContext* ctx = new TLSContext;
+    if (!ctx->InitServer(certfile, keyfile)) {
+        errmsg_ = ctx->GetLastErrMsg();
+        LOGE(errmsg_);
+        delete ctx;
+        return false;
+    }
+    delete tls_ctx_;
+    tls_ctx_ = ctx;
+    return true;
+}
+
+void TCPServer::SetEncryption(const PacketKeyring& keyring)
+{
+    sealer_.SetKeyring(keyring);
+}
+
+void TCPServer::SetCompression(int threshold, int level)
+{
+    compress_threshold_ = threshold;
+    compress_level_ = level;
+}
+
 /*****************************************AcceptClient*************************************************************/
 AcceptClient::AcceptClient(TcpClientCtx* control,  int clientid, char packhead, char packtail, uv_loop_t* loop)
     : client_handle_(control)
@@ -596,8 +798,18 @@ void AfterRecv(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf)
         return;
     } else if (0 == nread)  {/* Everything OK, but nothing read. */
 
-    } else {
-        theclass->packet_->recvdata((const unsigned char*)buf->base, nread);
+    } else if (theclass->tls_ && theclass->tls_->IsStarted()) {
+        TCPServer* parent = (TCPServer*)theclass->parent_server;
+        if (!parent->recvtls(theclass, buf->base, nread)) {
+            AcceptClient* acceptclient = (AcceptClient*)theclass->parent_acceptclient;
+            acceptclient->Close();
+        }
+    } else if (PACKET_ERR_OVERSIZE == theclass->packet_->recvdata((const unsigned char*)buf->base, nread)) {
+        TCPServer* parent = (TCPServer*)theclass->parent_server;
+        ++parent->oversize_count_;
+        LOGW("client(" << theclass->clientid << ")send oversize packet, close it");
+        AcceptClient* acceptclient = (AcceptClient*)theclass->parent_acceptclient;
+        acceptclient->Close();
     }
 }
 
@@ -622,15 +834,31 @@ void GetPacket(const NetPacket& packethead, const unsigned char* packetdata, voi
     assert(userdata);
     TcpClientCtx* theclass = (TcpClientCtx*)userdata;
     TCPServer* parent = (TCPServer*)theclass->parent_server;
+    ResponderToken token = {theclass->clientid, packethead.reserve};
+    if (parent->protocol_->ParsePacketAsync(packethead, packetdata, token)) {
+        return;//response later by TCPServer::Respond
+    }
     const std::string& senddata = parent->protocol_->ParsePacket(packethead, packetdata);
     parent->sendinl(senddata, theclass);
     return;
 }
 
+void GetChunk(const NetPacket& packethead, const unsigned char* chunk, int chunklen, int offset, int chunktype, void* userdata)
+{
+    assert(userdata);
+    TcpClientCtx* theclass = (TcpClientCtx*)userdata;
+    TCPServer* parent = (TCPServer*)theclass->parent_server;
+    const std::string& senddata = parent->protocol_->ParsePacketChunk(packethead, chunk, chunklen, offset, chunktype);
+    if (PACKET_CHUNK_END == chunktype && !senddata.empty()) {
+        parent->sendinl(senddata, theclass);
+    }
+}
+
 TcpClientCtx* AllocTcpClientCtx(void* parentserver)
 {
     TcpClientCtx* ctx = (TcpClientCtx*)malloc(sizeof(*ctx));
     ctx->packet_ = new PacketSync;
+    ctx->tls_ = NULL;
     ctx->read_buf_.base = (char*)malloc(BUFFER_SIZE);
     ctx->read_buf_.len = BUFFER_SIZE;
     ctx->parent_server = parentserver;
@@ -641,6 +869,7 @@ TcpClientCtx* AllocTcpClientCtx(void* parentserver)
 void FreeTcpClientCtx(TcpClientCtx* ctx)
 {
     delete ctx->packet_;
+    delete ctx->tls_;
     free(ctx->read_buf_.base);
     free(ctx);
 }
@@ -660,4 +889,22 @@ void FreeWriteParam(write_param* param)
     free(param);
 }
 
+void FillWriteParam(write_param* param, const uv_buf_t* bufs, int nbufs)
+{
+    std::size_t len = 0;
+    for (int i = 0; i < nbufs; ++i) {
+        len += bufs[i].len;
+    }
+    if ((std::size_t)param->buf_truelen_ < len) {
+        param->buf_.base = (char*)realloc(param->buf_.base, len);
+        param->buf_truelen_ = len;
+    }
+    char* pos = param->buf_.base;
+    for (int i = 0; i < nbufs; ++i) {
+        memcpy(pos, bufs[i].base, bufs[i].len);
+        pos += bufs[i].len;
+    }
+    param->buf_.len = len;
+}
+
 }
\ No newline at end of file
@@ -36,6 +36,7 @@
 #include <vector>
 #include "uv.h"
 #include "net/packet_sync.h"
+#include "net/tls_stream.h"
 #include "tcpserverprotocolprocess.h"
 #ifndef BUFFER_SIZE
 #define BUFFER_SIZE (1024*10)
@@ -48,6 +49,7 @@ class AcceptClient;
 typedef struct _tcpclient_ctx {
     uv_tcp_t tcphandle;//data filed store this
     PacketSync* packet_;//userdata filed storethis
+    TLSStream* tls_;//NULL when the server not SetTLS
     uv_buf_t read_buf_;
     int clientid;
     void* parent_server;//tcpserver
@@ -63,12 +65,14 @@ typedef struct _write_param { //the param of uv_write
 } write_param;
 write_param* AllocWriteParam(void);
 void FreeWriteParam(write_param* param);
+void FillWriteParam(write_param* param, const uv_buf_t* bufs, int nbufs);//copy the spans to buf_ one after another
 
 //Global Function
 static void AllocBufferForRecv(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
 static void AfterRecv(uv_stream_t* client, ssize_t nread, const uv_buf_t* buf);
 static void AfterSend(uv_write_t* req, int status);
 static void GetPacket(const NetPacket& packethead, const unsigned char* packetdata, void* userdata);
+static void GetChunk(const NetPacket& packethead, const unsigned char* chunk, int chunklen, int offset, int chunktype, void* userdata);
 
 /*************************************************
 Fun：TCP Server
@@ -76,6 +80,7 @@ Usage：
 Start the log fun(optional): StartLog
 Set the call back fun      : SetNewConnectCB/SetRecvCB/SetClosedCB
 SetPortocol                : SetPortocol. The send&recv data fun all in TCPServerProtocolProcess. user must inherit it and implement the method you need. 
+TLS(optional)              : SetTLS, before Start. every client must talk TLS then
 Start Server               : Start/Start6
 SetNoDelay(optional)       : SetNoDelay
 SetKeepAlive(optional)     : SetKeepAlive
@@ -105,6 +110,11 @@ public:
         return isclosed_;
     };
 
+    //Complete the deferred response of TCPServerProtocolProcess::ParsePacketAsync. can call from any thread.
+    //packet.reserve is set to token.correlation, then packet&data pack by PacketGather straight into the write buffer and send to the client.
+    //return false if server is closed. the response is dropped if the client had closed.
+    bool Respond(const ResponderToken& token, NetPacket& packet, const unsigned char* data);
+
     //Enable or disable Nagle’s algorithm. must call after Server succeed start.
     bool SetNoDelay(bool enable);
 
@@ -112,6 +122,28 @@ public:
 	//delay is the initial delay in seconds, ignored when enable is zero
     bool SetKeepAlive(int enable, unsigned int delay);
 
+    //The max packet data length accept from client. the client send bigger packet will be closed.
+    //must call before Start.
+    void SetMaxFrameSize(int maxsize);
+    //Packet which data length >= threshold will be delivered to TCPServerProtocolProcess::ParsePacketChunk
+    //chunk by chunk as they arrive. 0 disable. must call before Start.
+    //an AEAD encrypted packet is delivered chunk by chunk only after the whole packet is authenticated.
+    void SetStreamThreshold(int threshold);
+    //Talk TLS to the clients. certfile is the PEM certificate(chain), keyfile the PEM private key.
+    //session tickets are on, the reconnect client resume the session without full handshake. must call before Start.
+    bool SetTLS(const char* certfile, const char* keyfile);
+    //Compress the packet data Respond send when its length >= threshold and it gets smaller(see net/packet_compress.h).
+    //level is the zlib level 1-9, -1 default. 0 threshold disable. received compressed packet is always decompressed.
+    void SetCompression(int threshold, int level = -1);
+    //Encrypt the packet data Respond send with the send key of keyring(AEAD, see net/packet_aead.h), the auth tag replace the check.
+    //packet from clients must be encrypted by a key of keyring, others are dropped. empty keyring disable. must call before Start.
+    //the packet ParsePacket return is sent as it is, encrypt it by a PacketSealer with the same keyring.
+    void SetEncryption(const PacketKeyring& keyring);
+    //count of the client closed because of oversize packet
+    int64_t GetOversizeCount() const {
+        return oversize_count_;
+    }
+
     const char* GetLastErrMsg() const {
         return errmsg_.c_str();
     };
@@ -125,6 +157,7 @@ protected:
     static void AcceptConnection(uv_stream_t* server, int status);
     static void SubClientClosed(int clientid, void* userdata); //AcceptClient close cb
     static void AsyncCloseCB(uv_async_t* handle);//async close
+    static void AsyncRespondCB(uv_async_t* handle);//async send the deferred responses
 	static void CloseWalkCB(uv_handle_t* handle, void* arg);//close all handle in loop
 
 private:
@@ -142,10 +175,18 @@ private:
     bool bind6(const char* ip, int port);
     bool listen(int backlog = SOMAXCONN);
     bool sendinl(const std::string& senddata, TcpClientCtx* client);
+    bool sendinl(const uv_buf_t* bufs, int nbufs, TcpClientCtx* client);//gather the spans into a write_param and write
+    bool writeinl(write_param* writep, TcpClientCtx* client);//write the filled writep, recycle it on failure
+    //TLS client: feed the records to tls_, the plaintext go to packet_. return false when the client should close
+    bool recvtls(TcpClientCtx* client, const char* data, size_t len);
+    bool encrypttls(write_param* writep, TcpClientCtx* client);//replace the plaintext of writep with the TLS records
+    void flushtls(TcpClientCtx* client);//write the records tls_ make itself, eg. the handshake
+    static bool TLSPlainData(const char* data, size_t len, void* userdata);
     bool broadcast(const std::string& senddata, std::vector<int> excludeid);//broadcast to all clients, except the client who's id in excludeid
     uv_loop_t loop_;
     uv_tcp_t tcp_handle_;
     uv_async_t async_handle_close_;
+    uv_async_t async_handle_respond_;
     bool isclosed_;
     bool isuseraskforclosed_;
 
@@ -154,6 +195,9 @@ private:
 
     TCPServerProtocolProcess* protocol_;//protocol
 
+    std::list<std::pair<int, write_param*> > respond_list_;//deferred responses wait to send, packed on the caller thread. clientid-packet
+    uv_mutex_t mutex_respond_;//respond_list_ mutex
+
     uv_thread_t start_threadhandle_;//start thread handle
     static void StartThread(void* arg);//start thread,run until use close the server
     int startstatus_;
@@ -171,6 +215,13 @@ private:
 
     char packet_head;//protocol head
     char packet_tail;//protocol tail
+    int max_frame_size_;//max packet data length
+    int stream_threshold_;//packet data length to deliver chunk by chunk
+    int compress_threshold_;//packet data length to compress on Respond, 0 disable
+    int compress_level_;
+    PacketSealer sealer_;//encrypt Respond packet, its keyring decrypt the received packet too
+    int64_t oversize_count_;//count of oversize packet
+    TLSContext* tls_ctx_;//NULL when not SetTLS
 
     std::list<TcpClientCtx*> avai_tcphandle_;//Availa accept client data
     std::list<write_param*> writeparam_list_;//Availa write_t
@@ -180,6 +231,7 @@ public:
     friend void AfterRecv(uv_stream_t* client, ssize_t nread, const uv_buf_t* buf);
     friend void AfterSend(uv_write_t* req, int status);
     friend void GetPacket(const NetPacket& packethead, const unsigned char* packetdata, void* userdata);
+    friend void GetChunk(const NetPacket& packethead, const unsigned char* chunk, int chunklen, int offset, int chunktype, void* userdata);
 };
 
 /***********************************************Accept client on Server**********************************************************************/
@@ -230,6 +282,7 @@ public:
     friend void AfterRecv(uv_stream_t* client, ssize_t nread, const uv_buf_t* buf);
     friend void AfterSend(uv_write_t* req, int status);
     friend void GetPacket(const NetPacket& packethead, const unsigned char* packetdata, void* userdata);
+    friend void GetChunk(const NetPacket& packethead, const unsigned char* chunk, int chunklen, int offset, int chunktype, void* userdata);
 };
 
 }
@@ -8,6 +8,13 @@
 #ifndef TCP_SERVER_PROTOCOL_PROCESS_H
 #define TCP_SERVER_PROTOCOL_PROCESS_H
 #include <string>
+#include <stdint.h>
+
+//token to complete a deferred response, see ParsePacketAsync
+typedef struct _ResponderToken {
+    int clientid;       //the accept client which send the request
+    int32_t correlation;//NetPacket.reserve of the request
+} ResponderToken;
 
 class TCPServerProtocolProcess
 {
@@ -20,6 +27,25 @@ public:
 	//buf        : the packet data
 	//std::string: the response packet. no response can't return empty string.
     virtual const std::string& ParsePacket(const NetPacket& packet, const unsigned char* buf) = 0;
+
+    //async variant of ParsePacket, call before ParsePacket.
+	//packet     : the recv packet
+	//buf        : the packet data, only valid in this call. copy it if you need it later.
+	//token      : complete it later by TCPServer::Respond, from any thread and in any order.
+	//bool       : return true if the response will be complete by token, false to fall back to ParsePacket.
+    virtual bool ParsePacketAsync(const NetPacket& /*packet*/, const unsigned char* /*buf*/, const ResponderToken& /*token*/) {
+        return false;
+    }
+
+    //parse the big packet chunk by chunk, only call when TCPServer::SetStreamThreshold enable.
+	//packet     : the recv packet head
+	//chunk      : part of the packet data, start at offset. NULL when chunktype is PACKET_CHUNK_END/PACKET_CHUNK_ERROR
+	//chunktype  : see PACKET_CHUNK_TYPE. on PACKET_CHUNK_ERROR the chunks before are invalid
+	//std::string: the response packet, only send on PACKET_CHUNK_END. no response can return empty string.
+    virtual const std::string& ParsePacketChunk(const NetPacket& /*packet*/, const unsigned char* /*chunk*/, int /*chunklen*/, int /*offset*/, int /*chunktype*/) {
+        static const std::string empty_response;
+        return empty_response;
+    }
 };
 
 #endif//TCP_SERVER_PROTOCOL_PROCESS_H
\ No newline at end of file
@@ -27,16 +27,17 @@ void ReadCB(const NetPacket& packet, const unsigned char* buf, void* userdata)
     fprintf(stdout, "%s\n", senddata);
     NetPacket tmppack = packet;
     tmppack.datalen = (std::min)(strlen(senddata), sizeof(senddata) - 1);
-    std::string retstr = PacketData(tmppack, (const unsigned char*)senddata);
-    if (client->Send(&retstr[0], retstr.length()) <= 0) {
+    PacketFrame frame;//帧头与包尾编码在frame中，senddata由Send直接拷入发送缓冲区
+    PacketGather(tmppack, (const unsigned char*)senddata, frame);
+    if (client->Send(frame.bufs, frame.nbufs) <= 0) {
         fprintf(stdout, "(%p)send error.%s\n", client, client->GetLastErrMsg());
     }
 }
 
 int main(int argc, char** argv)
 {
-    if (argc != 3) {
-        fprintf(stdout, "usage: %s server_ip_address clientcount\neg.%s 192.168.1.1 50\n", argv[0], argv[0]);
+    if (argc != 3 && argc != 4) {
+        fprintf(stdout, "usage: %s server_ip_address clientcount [loopcount]\neg.%s 192.168.1.1 50 4\n", argv[0], argv[0]);
         return 0;
     }
     serverip = argv[1];
@@ -44,11 +45,16 @@ int main(int argc, char** argv)
     const int clientsize = std::stoi(argv[2]);
     TCPClient** pClients = new TCPClient*[clientsize];
     TCPClient::StartLog("log/");
+    TCPClientManager manager;//clients share the loops of manager when loopcount is given
+    if (argc == 4 && !manager.Start(std::stoi(argv[3]))) {
+        fprintf(stdout, "start client manager error:%s\n", manager.GetLastErrMsg());
+        return 0;
+    }
 
     int i = 0;
     char senddata[256];
     for (int i = 0; i < clientsize; ++i) {
-        pClients[i] = new TCPClient(0x01, 0x02);
+        pClients[i] = argc == 4 ? manager.CreateClient(0x01, 0x02) : new TCPClient(0x01, 0x02);
         pClients[i]->SetRecvCB(ReadCB, pClients[i]);
         pClients[i]->SetClosedCB(CloseCB, pClients[i]);
         if (!pClients[i]->Connect(serverip.c_str(), 12345)) {
@@ -59,6 +65,13 @@ int main(int argc, char** argv)
         memset(senddata, 0, sizeof(senddata));
         sprintf(senddata, "client(%p) call %d", pClients[i], ++call_time);
         NetPacket packet;
+        packet.version = NET_PACKAGE_VERSION;//MD5校验, SetNetPacketCheckType可改为其他校验方式
+        if (i % 2) {//一半客户端用紧凑的v2格式+CRC32C，服务器两种格式都能解析
+            packet.version = NET_PACKAGE_VERSION_V2;
+            SetNetPacketCheckType(packet, NET_CHECK_CRC32C);
+        }
+        packet.type = 0;
+        packet.reserve = 0;
         packet.header = 0x01;
         packet.tail = 0x02;
         packet.datalen = (std::min)(strlen(senddata), sizeof(senddata) - 1);
@@ -36,11 +36,15 @@ void ReConnectCB(NET_EVENT_TYPE eventtype, void* userdata)
 {
     TCPClient* client = (TCPClient*)userdata;
     if (NET_EVENT_TYPE_RECONNECT == eventtype) {
-        fprintf(stdout, "succeed reconnect.\n");
+        ReconnectStats stats = client->GetReconnectStats();
+        fprintf(stdout, "succeed reconnect. take %lld ms, %d attempts\n", (long long)stats.last_ms, stats.last_attempts);
 		char senddata[256];
         memset(senddata, 0, sizeof(senddata));
         sprintf(senddata, "client(%p) call %d", client, ++call_time);
         NetPacket packet;
+        packet.version = NET_PACKAGE_VERSION;//MD5校验, SetNetPacketCheckType可改为其他校验方式
+        packet.type = 0;
+        packet.reserve = 0;
         packet.header = 0x01;
         packet.tail = 0x02;
         packet.datalen = (std::min)(strlen(senddata), sizeof(senddata) - 1);
@@ -57,8 +61,8 @@ void ReConnectCB(NET_EVENT_TYPE eventtype, void* userdata)
 
 int main(int argc, char** argv)
 {
-    if (argc != 3) {
-        fprintf(stdout, "usage: %s server_ip_address clientcount\neg.%s 192.168.1.1 50\n", argv[0], argv[0]);
+    if (argc != 3 && argc != 4) {
+        fprintf(stdout, "usage: %s server_ip_address clientcount [cafile]\neg.%s 192.168.1.1 50\n", argv[0], argv[0]);
         return 0;
     }
     serverip = argv[1];
@@ -72,6 +76,16 @@ int main(int argc, char** argv)
     pClients.SetRecvCB(ReadCB, &pClients);
     pClients.SetClosedCB(CloseCB, &pClients);
     pClients.SetReconnectCB(ReConnectCB, &pClients);
+    ReconnectPolicy policy;
+    policy.initial_delay = 1000;
+    policy.max_delay = 30000;
+    policy.jitter = RECONNECT_JITTER_FULL;//clients not reconnect at the same time after server restart
+    policy.random_endpoints = false;
+    pClients.SetReconnectPolicy(policy);
+    if (argc == 4 && !pClients.SetTLS(argv[3])) {//reconnect resume the tls session
+        fprintf(stdout, "SetTLS error:%s\n", pClients.GetLastErrMsg());
+        return 1;
+    }
     if (!pClients.Connect(serverip.c_str(), 12345)) {
         fprintf(stdout, "connect error:%s\n", pClients.GetLastErrMsg());
     } else {
@@ -80,6 +94,9 @@ int main(int argc, char** argv)
     memset(senddata, 0, sizeof(senddata));
     sprintf(senddata, "client(%p) call %d", &pClients, ++call_time);
     NetPacket packet;
+    packet.version = NET_PACKAGE_VERSION;//MD5校验, SetNetPacketCheckType可改为其他校验方式
+    packet.type = 0;
+    packet.reserve = 0;
     packet.header = 0x01;
     packet.tail = 0x02;
     packet.datalen = (std::min)(strlen(senddata), sizeof(senddata) - 1);
@@ -46,6 +46,10 @@ int main(int argc, char** argv)
     TCPServer::StartLog("log/");
     server.SetNewConnectCB(NewConnect,&server);
 	server.SetPortocol(&protocol);
+    if (argc == 3 && !server.SetTLS(argv[1], argv[2])) {//usage: test_tcpserver [certfile keyfile]
+        fprintf(stdout, "SetTLS error:%s\n", server.GetLastErrMsg());
+        return 1;
+    }
     if(!server.Start("0.0.0.0",12345)) {
         fprintf(stdout,"Start Server error:%s\n",server.GetLastErrMsg());
     }